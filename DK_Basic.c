@@ -0,0 +1,245 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the basic tasks; see DK_Basic.h.
+
+Each basic task is a function, a priority, and a flag set by activation and
+cleared when the dispatcher starts it.  Activations made before a task starts
+are merged into one.  The dispatcher sleeps in the WAITING state while nothing
+is activated, and an activation wakes it.
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  12
+
+#include "DK_Global.h"
+
+
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+typedef struct
+{
+  DK_BasicFunction Function;
+  unsigned char Priority;
+  volatile unsigned char Activated;
+} DK_BasicTCB;
+
+/* Basic task identities are one more than their index here. */
+static DK_BasicTCB BasicSegment[DK_MAXIMUM_BASIC_TASKS];
+static unsigned char NumberOfBasicTasks = 0;
+
+/* The dispatcher's task identity, zero until DK_BasicInitialize, and the
+   priority of the basic task it is running, zero for none. */
+static unsigned char Dispatcher = 0;
+static volatile unsigned char RunningPriority = 0;
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+static DK_BasicTCB * DK_BasicHighest( unsigned char Ceiling );
+static void DK_BasicDispatch( unsigned char Ceiling );
+
+signed DK_BasicInitialize(void)
+{
+/* This function starts the dispatcher.  Call it once, after
+   DK_InitializeKernel.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if there was no task control block for
+   the dispatcher. */
+
+  Dispatcher = DK_InitializeTask( (DK_TaskAddress)DK_BasicDispatcher,
+                                  READY,
+                                  DK_BASIC_QUANTUM_SHARE );
+
+  if(Dispatcher == (unsigned)0)
+  {
+    return DK_FAILURE;
+  }
+
+  return DK_SUCCESS;
+}
+
+
+unsigned char DK_InitializeBasicTask( DK_BasicFunction Function,
+                                      unsigned char Priority )
+{
+/* This function initializes a basic task.  Basic tasks are never killed.
+
+   Parameters:
+   Function  The basic task.
+   Priority  From one to 255, higher first.
+
+   Result:
+   The basic task's identity if successful (positive non-zero), 0 if there is
+   no room for another or the priority is zero. */
+
+  unsigned char Identity = 0;
+
+  if(Priority == (unsigned)0)
+  {
+    return 0;
+  }
+
+  DK_EnterCriticalSection();
+
+  if(NumberOfBasicTasks < (unsigned)DK_MAXIMUM_BASIC_TASKS)
+  {
+    BasicSegment[NumberOfBasicTasks].Function = Function;
+    BasicSegment[NumberOfBasicTasks].Priority = Priority;
+    BasicSegment[NumberOfBasicTasks].Activated = FALSE;
+
+    Identity = ++NumberOfBasicTasks;
+  }
+
+  DK_ExitCriticalSection();
+
+  return Identity;
+}
+
+
+signed DK_ActivateBasicTask( unsigned char Identity )
+{
+/* This function activates a basic task.  Called from a basic task of lower
+   priority, the new task runs before this returns.  Otherwise it runs once
+   the dispatcher is free, and this never waits, so it may be called from
+   DK_QuantumTrigger or an interrupt handler.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if there is no such basic task. */
+
+  DK_BasicTCB * pTask = 0;
+  unsigned char Preempt = FALSE;
+
+  if( Identity == (unsigned)0 || Identity > NumberOfBasicTasks )
+  {
+    return DK_FAILURE;
+  }
+
+  pTask = &BasicSegment[Identity - 1];
+
+  /* Only a basic task, on the dispatcher with interrupts enabled, may run
+     another in its place.  An interrupt handler may find the dispatcher
+     running too, but has interrupts disabled. */
+  if( RunningPriority != (unsigned)0 &&
+      pTask->Priority > RunningPriority &&
+      DK_GetRunningTaskIdentity() == Dispatcher &&
+      DK_InterruptsEnabled() != FALSE )
+  {
+    Preempt = TRUE;
+  }
+
+  DK_EnterCriticalSection();
+
+  pTask->Activated = TRUE;
+
+  if( Preempt == FALSE &&
+      Dispatcher != (unsigned)0 &&
+      TCBSegment[Dispatcher].State == WAITING )
+  {
+    DK_ConfigureTaskState(Dispatcher, READY);
+  }
+
+  DK_ExitCriticalSection();
+
+  if(Preempt != FALSE)
+  {
+    DK_BasicDispatch(RunningPriority);
+  }
+
+  return DK_SUCCESS;
+}
+
+
+void DK_BasicDispatcher(void)
+{
+/* The dispatcher task.  It runs activated basic tasks, highest priority first,
+   until there are none left, then sleeps until DK_ActivateBasicTask wakes
+   it. */
+
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+
+  while(1)
+  {
+    DK_BasicDispatch(0);
+
+    DK_EnterCriticalSection();
+
+    /* Deciding to sleep and going to sleep happen together, so no activation
+       is missed in between. */
+    if(DK_BasicHighest(0) == 0)
+    {
+      DK_ConfigureTaskState(Identity, WAITING);
+
+      DK_ExitCriticalSection();
+
+      DK_InvokeScheduler();
+      continue;
+    }
+
+    DK_ExitCriticalSection();
+  }
+}
+
+
+static DK_BasicTCB * DK_BasicHighest( unsigned char Ceiling )
+{
+/* This function finds the activated basic task of the highest priority above
+   Ceiling.  Called in a critical section.
+
+   Result:
+   The basic task, or zero if there is none. */
+
+  DK_BasicTCB * pResult = 0;
+  unsigned char Index = 0;
+
+  for(Index = 0; Index < NumberOfBasicTasks; ++Index)
+  {
+    if( BasicSegment[Index].Activated != FALSE &&
+        BasicSegment[Index].Priority > Ceiling &&
+        ( pResult == 0 ||
+          BasicSegment[Index].Priority > pResult->Priority ) )
+    {
+      pResult = &BasicSegment[Index];
+    }
+  }
+
+  return pResult;
+}
+
+
+static void DK_BasicDispatch( unsigned char Ceiling )
+{
+/* This function runs every activated basic task of priority above Ceiling,
+   highest first, on the calling stack.  Called by the dispatcher with a
+   ceiling of zero, and by DK_ActivateBasicTask with the running basic task's
+   priority. */
+
+  DK_BasicTCB * pTask = 0;
+
+  while(1)
+  {
+    DK_EnterCriticalSection();
+
+    pTask = DK_BasicHighest(Ceiling);
+
+    if(pTask == 0)
+    {
+      DK_ExitCriticalSection();
+      break;
+    }
+
+    pTask->Activated = FALSE;
+    RunningPriority = pTask->Priority;
+
+    DK_ExitCriticalSection();
+
+    pTask->Function();
+  }
+
+  /* Back to whatever this preempted, if anything. */
+  RunningPriority = Ceiling;
+}
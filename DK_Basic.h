@@ -0,0 +1,50 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the declarations for DK_Basic.c, the basic tasks.
+
+A basic task is a function run to completion each time it is activated.  Every
+basic task runs on the stack of one classic task, the dispatcher, so dozens of
+them cost a few bytes apiece where a classic task costs a task control block
+and a whole stack slice.  The dispatcher is an ordinary task in the ready
+list, so basic tasks share the processor with classic tasks by time share as
+always.
+
+Among themselves, basic tasks are scheduled by priority, one to 255, higher
+first.  When a basic task activates one of higher priority, the new task runs
+at once, nested on the same stack, and the first resumes when it returns.
+Activations from anywhere else, classic tasks and interrupt handlers included,
+are run in priority order as soon as the running basic task returns.  The
+stack must hold one frame of each priority at once, no more.  A basic task
+must not wait on anything, and is not given an argument; what it works on is
+its own business.
+*******************************************************************************/
+
+#ifndef DK_BASIC_H
+#define DK_BASIC_H
+
+
+/* User definable.  The most basic tasks that may be initialized. */
+#ifndef DK_MAXIMUM_BASIC_TASKS
+  #define DK_MAXIMUM_BASIC_TASKS  16
+#endif
+
+/* The dispatcher's time share. */
+#ifndef DK_BASIC_QUANTUM_SHARE
+  #define DK_BASIC_QUANTUM_SHARE  1
+#endif
+
+
+/* A basic task. */
+typedef void (* DK_BasicFunction)(void);
+
+
+signed DK_BasicInitialize(void);
+unsigned char DK_InitializeBasicTask( DK_BasicFunction Function,
+                                      unsigned char Priority );
+signed DK_ActivateBasicTask( unsigned char Identity );
+void DK_BasicDispatcher(void);
+
+
+#endif /* DK_BASIC_H */
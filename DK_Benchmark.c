@@ -0,0 +1,934 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the kernel microbenchmarks for the POSIX host target.  Each
+benchmark is run by Task_Benchmark, which spawns whatever worker tasks it needs
+and kills them again when it is done.  Results are printed one per line as
+
+  <name> <value> <unit>
+
+where units ending in "/s" are better when higher and all others are better when
+lower.  Given a previous run's output with -b, each result is compared against
+it and the program exits non-zero if any result regressed by more than the
+tolerance given with -t (percent, 10 by default).
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  9
+
+#include "DK_Global.h"
+#include <stdlib.h>
+#include <time.h>
+
+
+#ifndef DK_POSIX
+  #error The kernel benchmarks run on the POSIX host target only.
+#endif
+
+
+/*******************************************************************************
+Benchmark parameters.
+*******************************************************************************/
+/* How long each throughput benchmark runs, in seconds. */
+#define BENCHMARK_DURATION    (0.5)
+
+/* How many samples each latency benchmark takes. */
+#define BENCHMARK_SAMPLES     (20000)
+
+/* The largest number of ready tasks DK_ConfigureTaskState is measured with.
+   Two tasks are reserved for the benchmark task and the task being
+   configured. */
+#define BENCHMARK_READY_TASKS (DK_MAXIMUM_TASKS - 2)
+
+/* The most results a run may produce. */
+#define BENCHMARK_RESULTS     (32)
+
+
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+typedef struct
+{
+  char Name[64];
+  double Value;
+  char Unit[16];
+} BenchmarkResult;
+
+static BenchmarkResult Results[BENCHMARK_RESULTS];
+static unsigned NumberOfResults = 0;
+
+/* Command line options. */
+static const char * BaselinePath = 0;
+static double Tolerance = 10.0;
+
+/* Counters shared between Task_Benchmark and its workers. */
+static volatile unsigned long Switches = 0,
+                              Churned = 0;
+
+/* ISR wakeup bookkeeping. */
+static volatile unsigned char WaiterIdentity = 0;
+static volatile double TriggerTime = 0.0,
+                       WakeupTime = 0.0;
+static volatile unsigned long Wakeups = 0;
+
+static double Samples[BENCHMARK_SAMPLES];
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+static double Now(void)
+{
+/* Result:
+   The monotonic clock in seconds. */
+
+  struct timespec Time;
+
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+
+  return Time.tv_sec + Time.tv_nsec * 1e-9;
+}
+
+
+static void Record( const char * Name,
+                    double Value,
+                    const char * Unit )
+{
+/* Adds a result to the table and prints it. */
+
+  if(NumberOfResults < (unsigned)BENCHMARK_RESULTS)
+  {
+    snprintf(Results[NumberOfResults].Name, 64, "%s", Name);
+    Results[NumberOfResults].Value = Value;
+    snprintf(Results[NumberOfResults].Unit, 16, "%s", Unit);
+
+    ++NumberOfResults;
+  }
+
+  printf("%s %.1f %s\n", Name, Value, Unit);
+  fflush(stdout);
+}
+
+
+static int CompareSamples( const void * pA,
+                           const void * pB )
+{
+  double A = *(const double *)pA,
+         B = *(const double *)pB;
+
+  return (A > B) - (A < B);
+}
+
+
+static void RecordSamples( const char * Name,
+                           unsigned Count )
+{
+/* Records the mean, median, and 99th percentile of the first Count samples, in
+   nanoseconds. */
+
+  char Label[64];
+  double Sum = 0.0;
+  unsigned Index = 0;
+
+  for(Index = 0; Index < Count; ++Index)
+  {
+    Sum += Samples[Index];
+  }
+
+  qsort(Samples, Count, sizeof(Samples[0]), CompareSamples);
+
+  snprintf(Label, sizeof(Label), "%s_mean", Name);
+  Record(Label, Sum / Count * 1e9, "ns");
+
+  snprintf(Label, sizeof(Label), "%s_p50", Name);
+  Record(Label, Samples[Count / 2] * 1e9, "ns");
+
+  snprintf(Label, sizeof(Label), "%s_p99", Name);
+  Record(Label, Samples[Count * 99 / 100] * 1e9, "ns");
+}
+
+
+static void KillTask(unsigned char Identity)
+{
+/* Returns a worker task's resources to the kernel. */
+
+  signed Result = 0;
+
+  Result = DK_ConfigureTaskState(Identity, DEAD);
+  DK_Assert(Result != DK_SUCCESS);
+}
+
+
+/*******************************************************************************
+Worker tasks.
+*******************************************************************************/
+void Task_Yield(void)
+{
+/* Gives up the processor as fast as it is given it. */
+
+  while(1)
+  {
+    ++Switches;
+    DK_InvokeScheduler();
+  }
+}
+
+
+void Task_Churn(void)
+{
+/* Task_Test3: does its little bit of work, then releases its resources. */
+
+  ++Churned;
+
+  DK_ConfigureTaskState(DK_GetRunningTaskIdentity(), DEAD);
+  DK_InvokeScheduler();
+}
+
+
+void Task_Wait(void)
+{
+/* Waits to be woken by DK_ISR, then notes when that happened, and counts the
+   wakeup once the time is noted. */
+
+  while(1)
+  {
+    DK_ConfigureTaskState(DK_GetRunningTaskIdentity(), WAITING);
+    DK_InvokeScheduler();
+
+    WakeupTime = Now();
+    ++Wakeups;
+  }
+}
+
+
+void Job_Churn( void * pArgument )
+{
+/* Task_Churn as a job: its little bit of work, and nothing to release. */
+
+  ++Churned;
+}
+
+
+/* Watchdog bookkeeping: how many times Task_Restarted has started, and the
+   identity it last started with. */
+static volatile unsigned long Starts = 0;
+static volatile unsigned char RestartedIdentity = 0;
+
+void Task_Spin(void)
+{
+/* Never checks in. */
+
+  while(1)
+  {
+  }
+}
+
+
+void Task_Restarted(void)
+{
+/* Counts its starts, then never checks in. */
+
+  RestartedIdentity = DK_GetRunningTaskIdentity();
+  ++Starts;
+
+  while(1)
+  {
+  }
+}
+
+
+/* Basic task bookkeeping: the order they ran in, and the identities of the
+   pair that checks it. */
+static char BasicOrder[4];
+static volatile unsigned char BasicRan = 0,
+                              BasicLow = 0,
+                              BasicHigh = 0,
+                              BasicTimed = FALSE;
+static volatile unsigned long BasicPreempted = 0;
+
+void Basic_High(void)
+{
+/* Notes that it ran. */
+
+  if(BasicRan < sizeof(BasicOrder))
+  {
+    BasicOrder[BasicRan++] = 'H';
+  }
+
+  ++BasicPreempted;
+}
+
+
+void Basic_Low(void)
+{
+/* Activates Basic_High, which should run before this continues. */
+
+  if(BasicRan < sizeof(BasicOrder))
+  {
+    BasicOrder[BasicRan++] = 'L';
+  }
+
+  DK_ActivateBasicTask(BasicHigh);
+
+  if(BasicRan < sizeof(BasicOrder))
+  {
+    BasicOrder[BasicRan++] = 'l';
+  }
+}
+
+
+void Basic_Preempt(void)
+{
+/* Activates Basic_High over and over, each time running it nested. */
+
+  unsigned Index = 0;
+  double Start = Now();
+
+  for(Index = 0; Index < (unsigned)BENCHMARK_SAMPLES; ++Index)
+  {
+    DK_ActivateBasicTask(BasicHigh);
+  }
+
+  Record( "basic_task_preempt",
+          (Now() - Start) / BENCHMARK_SAMPLES * 1e9, "ns" );
+
+  BasicTimed = TRUE;
+}
+
+
+/*******************************************************************************
+Benchmarks.
+*******************************************************************************/
+static void Benchmark_ContextSwitchRate(void)
+{
+/* Three tasks, including this one, hand the processor around as fast as they
+   can.  Every scheduler invocation is one context switch. */
+
+  unsigned char First = DK_InitializeTask(Task_Yield, READY, 1),
+                Second = DK_InitializeTask(Task_Yield, READY, 1);
+  double Start = 0.0,
+         Elapsed = 0.0;
+
+  Switches = 0;
+  Start = Now();
+
+  do
+  {
+    ++Switches;
+    DK_InvokeScheduler();
+
+    Elapsed = Now() - Start;
+  } while(Elapsed < BENCHMARK_DURATION);
+
+  Record("context_switch_rate", Switches / Elapsed, "switches/s");
+
+  KillTask(First);
+  KillTask(Second);
+}
+
+
+static void Benchmark_YieldRoundTrip(void)
+{
+/* This task and one other yield back and forth; each sample is one trip around
+   the two of them. */
+
+  unsigned char Echo = DK_InitializeTask(Task_Yield, READY, 1);
+  unsigned Index = 0;
+  double Start = 0.0;
+
+  for(Index = 0; Index < (unsigned)BENCHMARK_SAMPLES; ++Index)
+  {
+    Start = Now();
+    DK_InvokeScheduler();
+    Samples[Index] = Now() - Start;
+  }
+
+  RecordSamples("yield_round_trip", BENCHMARK_SAMPLES);
+
+  KillTask(Echo);
+}
+
+
+static void Benchmark_SpawnKill(void)
+{
+/* Task_Test2's pattern: spawn short lived tasks while there is room, and let
+   them run and kill themselves. */
+
+  double Start = 0.0,
+         Elapsed = 0.0;
+
+  Churned = 0;
+  Start = Now();
+
+  do
+  {
+    while(DK_GetNumberOfLivingTasks() < (unsigned)DK_MAXIMUM_TASKS)
+    {
+      DK_InitializeTask(Task_Churn, READY, 1);
+    }
+
+    DK_InvokeScheduler();
+
+    Elapsed = Now() - Start;
+  } while(Elapsed < BENCHMARK_DURATION);
+
+  Record("spawn_kill_rate", Churned / Elapsed, "tasks/s");
+
+  /* Let the stragglers finish. */
+  while(DK_GetNumberOfLivingTasks() > (unsigned)2)
+  {
+    DK_InvokeScheduler();
+  }
+}
+
+
+static void Benchmark_ConfigureTaskState(unsigned ReadyTasks)
+{
+/* Moves a task in and out of a ready list of ReadyTasks other tasks.  The
+   scheduler clock is stopped so the loop measures nothing else. */
+
+  unsigned char Filler[DK_MAXIMUM_TASKS],
+                Subject = 0;
+  char Label[64];
+  unsigned Index = 0;
+  double Start = 0.0,
+         Elapsed = 0.0;
+
+  /* This task is one of the ready tasks. */
+  for(Index = 1; Index < ReadyTasks; ++Index)
+  {
+    Filler[Index] = DK_InitializeTask(Task_Yield, READY, 1);
+  }
+
+  Subject = DK_InitializeTask(Task_Yield, DORMANT, 1);
+
+  DK_StopScheduler();
+  Start = Now();
+
+  for(Index = 0; Index < (unsigned)BENCHMARK_SAMPLES; ++Index)
+  {
+    DK_ConfigureTaskState(Subject, READY);
+    DK_ConfigureTaskState(Subject, DORMANT);
+  }
+
+  Elapsed = Now() - Start;
+  DK_StartScheduler();
+
+  snprintf(Label, sizeof(Label), "configure_task_state_%u_ready", ReadyTasks);
+  Record(Label, Elapsed / (2.0 * BENCHMARK_SAMPLES) * 1e9, "ns");
+
+  KillTask(Subject);
+
+  for(Index = 1; Index < ReadyTasks; ++Index)
+  {
+    KillTask(Filler[Index]);
+  }
+}
+
+
+static void Benchmark_ISRWakeup(void)
+{
+/* Raises a user interrupt whose handler readies a waiting task; each sample is
+   the time from raising the interrupt to the task running. */
+
+  unsigned Index = 0;
+  unsigned long Expected = 0;
+
+  WaiterIdentity = DK_InitializeTask(Task_Wait, READY, 1);
+
+  for(Index = 0; Index < (unsigned)BENCHMARK_SAMPLES; ++Index)
+  {
+    /* Let the waiter get back to waiting. */
+    while(TCBSegment[WaiterIdentity].State != WAITING)
+    {
+      DK_InvokeScheduler();
+    }
+
+    /* WakeupTime is only this wakeup's once the waiter has counted it. */
+    Expected = Wakeups + 1;
+
+    TriggerTime = Now();
+    raise(SIGUSR1);
+
+    while(Wakeups != Expected)
+    {
+      DK_InvokeScheduler();
+    }
+
+    Samples[Index] = WakeupTime - TriggerTime;
+  }
+
+  RecordSamples("isr_wakeup", BENCHMARK_SAMPLES);
+
+  KillTask(WaiterIdentity);
+  WaiterIdentity = 0;
+}
+
+
+static void Benchmark_SchedulerLock(void)
+{
+/* Times a critical section and a scheduler lock, each entered and left with
+   nothing inside.  Then checks that a yield made under the scheduler lock is
+   put off until the lock is released, and exits if it was not. */
+
+  unsigned char Other = DK_InitializeTask(Task_Yield, READY, 1);
+  unsigned Index = 0;
+  unsigned long Seen = 0;
+  double Start = 0.0;
+
+  Start = Now();
+
+  for(Index = 0; Index < (unsigned)BENCHMARK_SAMPLES; ++Index)
+  {
+    DK_EnterCriticalSection();
+    DK_ExitCriticalSection();
+  }
+
+  Record( "critical_section",
+          (Now() - Start) / BENCHMARK_SAMPLES * 1e9, "ns" );
+
+  Start = Now();
+
+  for(Index = 0; Index < (unsigned)BENCHMARK_SAMPLES; ++Index)
+  {
+    DK_SchedulerLock();
+    DK_SchedulerUnlock();
+  }
+
+  Record( "scheduler_lock",
+          (Now() - Start) / BENCHMARK_SAMPLES * 1e9, "ns" );
+
+  DK_SchedulerLock();
+  Seen = Switches;
+
+  for(Index = 0; Index < (unsigned)100; ++Index)
+  {
+    DK_InvokeScheduler();
+  }
+
+  if(Switches != Seen)
+  {
+    printf("# a task ran while the scheduler was locked FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* The switch put off is made here. */
+  DK_SchedulerUnlock();
+
+  if(Switches == Seen)
+  {
+    printf("# no task ran once the scheduler was unlocked FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+
+  KillTask(Other);
+}
+
+
+static void Benchmark_Watchdog(void)
+{
+/* Times how long past its timeout a task that never checks in is suspended.
+   Then checks that a task killed by its watchdog is started again, and keeps
+   its identity from other tasks until it is, that a deadline met is not
+   counted, and that one missed is, and exits if not. */
+
+  const DK_Time Timeout = 5;
+  unsigned char Spinner = DK_InitializeTask(Task_Spin, READY, 1),
+                Self = DK_GetRunningTaskIdentity(),
+                Identity = 0,
+                Other = 0;
+  DK_Time Start = 0;
+  double Began = 0.0;
+
+  Began = Now();
+  DK_WatchdogConfigure(Spinner, Timeout, DK_WATCHDOG_SUSPEND);
+
+  while(TCBSegment[Spinner].State != DORMANT)
+  {
+    DK_InvokeScheduler();
+  }
+
+  Record( "watchdog_overshoot",
+          (Now() - Began - Timeout * DK_QUANTUM) * 1e9, "ns" );
+
+  if(DK_WatchdogGetMisses(Spinner) != (unsigned)1)
+  {
+    printf("# a suspended task missed more than once FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+
+  KillTask(Spinner);
+
+  Starts = 0;
+  Identity = DK_InitializeTask(Task_Restarted, READY, 1);
+  DK_WatchdogConfigure(Identity, Timeout, DK_WATCHDOG_RESTART);
+  Began = Now();
+
+  while(Starts < (unsigned)3)
+  {
+    if(Now() - Began > 1.0)
+    {
+      printf("# a task killed by its watchdog was not restarted FAILED\n");
+      exit(EXIT_FAILURE);
+    }
+
+    DK_InvokeScheduler();
+  }
+
+  /* Catch it while a restart is pending.  Its identity must not be handed out
+     until it has been started again. */
+  while(1)
+  {
+    DK_SchedulerLock();
+    Identity = RestartedIdentity;
+
+    if(TCBSegment[Identity].State == DEAD)
+    {
+      break;
+    }
+
+    DK_SchedulerUnlock();
+    DK_InvokeScheduler();
+  }
+
+  Other = DK_InitializeTask(Task_Spin, DORMANT, 1);
+  DK_SchedulerUnlock();
+
+  if(Other == Identity)
+  {
+    printf("# a task took the identity of one awaiting restart FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(Other != (unsigned)0)
+  {
+    KillTask(Other);
+  }
+
+  /* Stop it while no restart is pending.  The watchdogs are not checked while
+     the scheduler is locked. */
+  while(1)
+  {
+    DK_SchedulerLock();
+    Identity = RestartedIdentity;
+
+    if(TCBSegment[Identity].State != DEAD)
+    {
+      break;
+    }
+
+    DK_SchedulerUnlock();
+    DK_InvokeScheduler();
+  }
+
+  if(DK_WatchdogGetMisses(Identity) < (unsigned)2)
+  {
+    printf("# a restarted task lost its misses FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+
+  DK_WatchdogConfigure(Identity, 0, DK_WATCHDOG_LOG);
+  KillTask(Identity);
+  DK_SchedulerUnlock();
+
+  DK_DeadlineDeclare(1000);
+
+  if( DK_DeadlineComplete() != DK_SUCCESS ||
+      DK_WatchdogGetMisses(Self) != (unsigned)0 )
+  {
+    printf("# a deadline met was counted as missed FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+
+  DK_DeadlineDeclare(1);
+  Start = DK_GetTickCount();
+
+  while(DK_TimeBefore(DK_GetTickCount(), Start + 3))
+  {
+    DK_InvokeScheduler();
+  }
+
+  if( DK_DeadlineComplete() != DK_FAILURE ||
+      DK_WatchdogGetMisses(Self) != (unsigned)1 )
+  {
+    printf("# a deadline missed was not counted FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+static void Benchmark_Jobs(void)
+{
+/* Benchmark_SpawnKill's pattern with jobs in place of tasks: keep the job
+   queue full, and let the pool work through it.  Then each sample is one job
+   submitted and waited for. */
+
+  static DK_JobCompletion Completion;
+
+  unsigned Index = 0;
+  double Start = 0.0,
+         Elapsed = 0.0;
+
+  Churned = 0;
+  Start = Now();
+
+  do
+  {
+    while(DK_JobSubmit(Job_Churn, 0, 0) == DK_SUCCESS)
+    {
+    }
+
+    DK_InvokeScheduler();
+
+    Elapsed = Now() - Start;
+  } while(Elapsed < BENCHMARK_DURATION);
+
+  Record("job_rate", Churned / Elapsed, "jobs/s");
+
+  for(Index = 0; Index < (unsigned)BENCHMARK_SAMPLES; ++Index)
+  {
+    Start = Now();
+
+    /* The queue may still hold the last of the jobs above. */
+    while(DK_JobSubmit(Job_Churn, 0, &Completion) != DK_SUCCESS)
+    {
+      DK_InvokeScheduler();
+    }
+
+    DK_JobWait(&Completion);
+    Samples[Index] = Now() - Start;
+  }
+
+  RecordSamples("job_round_trip", BENCHMARK_SAMPLES);
+}
+
+
+static void Benchmark_BasicTasks(void)
+{
+/* Checks that a basic task activated by one of lower priority preempts it, and
+   exits if not.  Then each sample is a basic task activated from this task
+   and run to completion on the dispatcher.  Last, a basic task times
+   activations of one of higher priority, each run nested. */
+
+  unsigned char Preempt = 0;
+  unsigned Index = 0;
+  double Start = 0.0;
+
+  BasicLow = DK_InitializeBasicTask(Basic_Low, 1);
+  BasicHigh = DK_InitializeBasicTask(Basic_High, 3);
+  Preempt = DK_InitializeBasicTask(Basic_Preempt, 2);
+
+  BasicRan = 0;
+  DK_ActivateBasicTask(BasicLow);
+
+  while(BasicRan < (unsigned)3)
+  {
+    DK_InvokeScheduler();
+  }
+
+  if(memcmp(BasicOrder, "LHl", 3) != 0)
+  {
+    printf("# basic tasks ran out of priority order FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(Index = 0; Index < (unsigned)BENCHMARK_SAMPLES; ++Index)
+  {
+    BasicPreempted = 0;
+    Start = Now();
+
+    DK_ActivateBasicTask(BasicHigh);
+
+    while(BasicPreempted == (unsigned)0)
+    {
+      DK_InvokeScheduler();
+    }
+
+    Samples[Index] = Now() - Start;
+  }
+
+  RecordSamples("basic_task_round_trip", BENCHMARK_SAMPLES);
+
+  DK_ActivateBasicTask(Preempt);
+
+  while(BasicTimed == FALSE)
+  {
+    DK_InvokeScheduler();
+  }
+}
+
+
+/*******************************************************************************
+Baseline comparison.
+*******************************************************************************/
+static signed CompareWithBaseline(void)
+{
+/* Compares this run's results with those in the baseline file.
+
+   Result:
+   DK_SUCCESS if nothing regressed beyond the tolerance, DK_FAILURE
+   otherwise. */
+
+  signed Result = DK_SUCCESS;
+  FILE * pBaseline = fopen(BaselinePath, "r");
+  char Line[128],
+       Name[64],
+       Unit[16];
+  double Value = 0.0,
+         Change = 0.0;
+  unsigned Index = 0;
+
+  if(pBaseline == 0)
+  {
+    fprintf(stderr, "Cannot open baseline %s.\n", BaselinePath);
+    return DK_FAILURE;
+  }
+
+  printf("# comparison against %s, tolerance %.1f%%\n", BaselinePath, Tolerance);
+
+  while(fgets(Line, sizeof(Line), pBaseline) != 0)
+  {
+    if( Line[0] == '#' ||
+        sscanf(Line, "%63s %lf %15s", Name, &Value, Unit) != 3 ||
+        Value == 0.0 )
+    {
+      continue;
+    }
+
+    for(Index = 0; Index < NumberOfResults; ++Index)
+    {
+      if(strcmp(Results[Index].Name, Name) == 0)
+      {
+        /* Positive changes are improvements. */
+        Change = (Results[Index].Value - Value) / Value * 100.0;
+
+        if(strstr(Unit, "/s") == 0)
+        {
+          Change = -Change;
+        }
+
+        printf( "# %s %.1f -> %.1f %s (%+.1f%%)%s\n",
+                Name,
+                Value,
+                Results[Index].Value,
+                Unit,
+                Change,
+                Change < -Tolerance ? " REGRESSION" : "" );
+
+        if(Change < -Tolerance)
+        {
+          Result = DK_FAILURE;
+        }
+
+        break;
+      }
+    }
+  }
+
+  fclose(pBaseline);
+
+  return Result;
+}
+
+
+/*******************************************************************************
+User defined functions called by the kernel.
+*******************************************************************************/
+void DK_IdleTaskHook(void)
+{
+}
+
+
+void DK_ISR(void)
+{
+/* The benchmark's only user interrupt wakes the waiting task. */
+
+  if( WaiterIdentity != 0 &&
+      TCBSegment[WaiterIdentity].State == WAITING )
+  {
+    DK_ConfigureTaskState(WaiterIdentity, READY);
+    DK_InvokeScheduler();
+  }
+}
+
+
+void DK_QuantumTrigger(unsigned QuantumCount)
+{
+}
+
+
+void Task_Benchmark(void)
+{
+/* Runs every benchmark in turn, then exits the program. */
+
+  unsigned ReadyTasks = 1;
+
+  printf("# Dreamcatcher Kernel benchmarks, %u tasks, %g s quantum\n",
+         (unsigned)DK_MAXIMUM_TASKS, (double)DK_QUANTUM);
+
+  Benchmark_ContextSwitchRate();
+  Benchmark_YieldRoundTrip();
+  Benchmark_SpawnKill();
+
+  while(ReadyTasks <= (unsigned)BENCHMARK_READY_TASKS)
+  {
+    Benchmark_ConfigureTaskState(ReadyTasks);
+    ReadyTasks *= 4;
+  }
+
+  Benchmark_ISRWakeup();
+  Benchmark_SchedulerLock();
+  Benchmark_Watchdog();
+
+  /* The job workers and the basic task dispatcher live on once started, so
+     they are measured last. */
+  DK_JobInitialize();
+  Benchmark_Jobs();
+
+  DK_BasicInitialize();
+  Benchmark_BasicTasks();
+
+  if(BaselinePath != 0 && CompareWithBaseline() != DK_SUCCESS)
+  {
+    exit(EXIT_FAILURE);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+
+/******************************************************************************/
+int main( int ArgumentCount,
+          char * Arguments[] )
+{
+  signed Result = 0;
+  int Option = 0;
+
+  for(Option = 1; Option < ArgumentCount; ++Option)
+  {
+    if(strcmp(Arguments[Option], "-b") == 0 && Option + 1 < ArgumentCount)
+    {
+      BaselinePath = Arguments[++Option];
+    }
+    else if(strcmp(Arguments[Option], "-t") == 0 && Option + 1 < ArgumentCount)
+    {
+      Tolerance = atof(Arguments[++Option]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-b baseline] [-t tolerance percent]\n",
+              Arguments[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  Result = DK_InitializeKernel();
+  DK_Assert(Result != DK_SUCCESS);
+
+  DK_InitializeTask(Task_Benchmark, READY, 1);
+
+  DK_StartKernel();
+
+  return EXIT_SUCCESS;
+}
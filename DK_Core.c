@@ -5,6 +5,9 @@ Stephen Niedzielski
 This file contains all kernel related functions that are not device dependent.
 *******************************************************************************/
 
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  1
+
 #include "DK_Global.h"
 
 
@@ -23,6 +26,25 @@ DK_TCB * pCurrentTaskTCB = 0;
 static unsigned NumberOfLivingTasks = 1,
                 QuantumCount = 0;
 
+/* Kernel time: the number of whole quanta since the kernel started, and the
+   scheduler clock counts accumulated toward the next.  Unlike QuantumCount,
+   these are never reset. */
+static DK_Time TickCount = 0;
+static unsigned long TickRemainder = 0;
+
+/* Critical section nesting.  The interrupt state from before the outermost
+   DK_EnterCriticalSection is restored by the matching DK_ExitCriticalSection.
+   Interrupts are disabled throughout, so no task switch or interrupt handler
+   ever sees a count other than zero. */
+static unsigned char CriticalNesting = 0;
+static DK_InterruptState CriticalInterrupts;
+
+/* Scheduler lock nesting, and whether the scheduler has passed over a task
+   switch while the lock was held.  Only tasks lock the scheduler, and no task
+   switch happens while it is locked, so the count needs no protection. */
+static volatile unsigned char SchedulerLocks = 0,
+                              SwitchPending = FALSE;
+
 
 /*******************************************************************************
 Function definitions.
@@ -45,6 +67,9 @@ signed DK_InitializeKernel(void)
 
   Result = DK_InitializeScheduler();
   DK_Assert(Result != DK_SUCCESS);
+
+  Result = DK_WatchdogInitialize();
+  DK_Assert(Result != DK_SUCCESS);
   
   DK_USB_Initialize();
   DK_Assert(Result != DK_SUCCESS);
@@ -83,6 +108,9 @@ signed DK_InitializeTCBSegment(void)
   TCBSegment[0].StackPointer = DK_MASTER_STACK_START;
   
   TCBSegment[0].Identity = 0;
+  TCBSegment[0].QuantumShare = 1; /* A zero share would roll over and keep the
+                                     idle task running until QuantumShare
+                                     wraps back around. */
   TCBSegment[0].State = RUNNING; /* Although the idle task is technically not
                                     running at the moment, it will be very
                                     shortly and may be initialized as such. */
@@ -133,17 +161,53 @@ signed DK_Scheduler(void)
   /* The number of quantum the current running task.  Start at 1 so it'll
      decrement to zero on the first run. */
   static unsigned QuantumShare = 1;
+
+  /* The tick the watchdogs were last checked at. */
+  static DK_Time MonitoredTick = 0;
   
   signed Result = 0;
+  unsigned long Elapsed = 0;
+  #ifdef DK_ONE_SHOT_SLICE
+  DK_Time StartTick = TickCount;
+  #endif
   
+  #ifdef DK_ONE_SHOT_SLICE
+  /* The clock interrupts once per slice, so the slice is over.  It may have
+     ended early, so QuantumCount is advanced below, once the clock has said
+     how long it lasted. */
+  QuantumShare = 0;
+  #else
   ++QuantumCount;
   DK_QuantumTrigger(QuantumCount);
 
   --QuantumShare;
-  if(QuantumShare == (unsigned)0)
+  #endif
+
+  /* Check the watchdogs once a tick.  While the scheduler is locked they wait,
+     since a task can be neither suspended nor started then. */
+  if( SchedulerLocks == (unsigned)0 && MonitoredTick != TickCount )
+  {
+    MonitoredTick = TickCount;
+
+    if(DK_WatchdogMonitor(TickCount) != FALSE)
+    {
+      /* The running task was suspended or killed. */
+      QuantumShare = 0;
+    }
+  }
+
+  if( QuantumShare == (unsigned)0 && SchedulerLocks != (unsigned)0 )
+  {
+    /* The scheduler is locked.  The current task keeps running a quantum at a
+       time, and DK_SchedulerUnlock invokes the scheduler once it is free. */
+    SwitchPending = TRUE;
+    QuantumShare = 1;
+  }
+  else if(QuantumShare == (unsigned)0)
   {
     /* The currently running task has completed its time share.  Switch to the
        next task. */
+    SwitchPending = FALSE;
    
     if( pCurrentTaskTCB->State == RUNNING )
     {
@@ -159,7 +223,47 @@ signed DK_Scheduler(void)
     
     /* Update QuantumShare with the new task's time share. */
     QuantumShare = pCurrentTaskTCB->QuantumShare;
+
+    #ifdef DK_ONE_SHOT_SLICE
+    /* The whole slice must fit in the scheduler clock. */
+    if( QuantumShare == (unsigned)0 )
+    {
+      QuantumShare = 1;
+    }
+    else if( QuantumShare > (unsigned)DK_MAXIMUM_QUANTUM_SHARE )
+    {
+      QuantumShare = DK_MAXIMUM_QUANTUM_SHARE;
+    }
+    #endif
   }
+
+  /* Program the clock for the next interrupt: the incoming task's whole slice,
+     or a single quantum. */
+  #ifdef DK_ONE_SHOT_SLICE
+  DK_ReloadSchedulerClock( (unsigned long)QuantumShare
+                           * DK_SCHEDULER_CLOCK_QUANTUM, &Elapsed );
+  #else
+  DK_ReloadSchedulerClock(DK_SCHEDULER_CLOCK_QUANTUM, &Elapsed);
+  #endif
+
+  /* Advance kernel time by however long the period that just ended lasted.
+     Slices end early when a task yields, so this is not always a whole number
+     of quanta. */
+  TickRemainder += Elapsed;
+
+  while( TickRemainder >= DK_SCHEDULER_CLOCK_QUANTUM )
+  {
+    TickRemainder -= DK_SCHEDULER_CLOCK_QUANTUM;
+    ++TickCount;
+  }
+
+  #ifdef DK_ONE_SHOT_SLICE
+  /* Count only the quanta that passed, not the share that was programmed, so
+     that a task yielding or blocking early does not run the count ahead of
+     kernel time. */
+  QuantumCount += (unsigned)(TickCount - StartTick);
+  DK_QuantumTrigger(QuantumCount);
+  #endif
     
   return Result;
 }
@@ -167,115 +271,107 @@ signed DK_Scheduler(void)
 
 static signed DK_RegisterTask( unsigned char Identity )
 {
-/* Registers a task with the scheduler.
+/* Registers a task with the scheduler.  The task is placed at the end of the
+   ready list, so that every task already ready runs before it does.
 
    Result:
    DK_SUCCESS if succesful. */
 
+  DK_TCB * pTask = &TCBSegment[Identity],
+         * pFirst = pCurrentTaskTCB;
+
   /* Update the ready list. */
-  
+
+  /* The end of the list is just in front of the task that runs next.  That is
+     the current task if it is in the list.  Otherwise, the idle task is running
+     or the running task has already left the list, and the task that runs next
+     is the current task's successor. */
+  if( pCurrentTaskTCB == &TCBSegment[0] ||
+      ( pCurrentTaskTCB->State != READY &&
+        pCurrentTaskTCB->State != RUNNING ) )
+  {
+    pFirst = pCurrentTaskTCB->Next;
+  }
+
   /*  Possible cases:
-      1. Idle task is running and this is the first ready task.
-      2. Idle task is running and this is not the first ready task.
-      3. Idle task is not running and this is the first ready task.
-      4. Idle task is not running and this is not the first ready task. */
-  
-  if( pCurrentTaskTCB == &TCBSegment[0] )
+      1. This is the first ready task.
+      2. This is not the first ready task. */
+
+  if( pFirst == &TCBSegment[0] )
   {
-    /* Case 1 & 2 & 3. */
-    
-    if(pCurrentTaskTCB->Next == &TCBSegment[0])
-    {
-      /* Case 1 & 3. */
-      
-      /*  This is the only ready task, so it should point to itself and take the
-          idle task out of the loop. */
-      TCBSegment[Identity].Next = &TCBSegment[Identity];
-      TCBSegment[Identity].Prev = &(TCBSegment[Identity]);
-      
-      /* The next task to run should be this task. */
-      pCurrentTaskTCB->Next = &TCBSegment[Identity];
-    }
-    else /* There are other ready tasks. */
-    {
-      /* Case 2. */
-      
-      /*  There are other ready task(s), but the current task is the idle task.
-          Put at the end. */
-      pCurrentTaskTCB->Prev->Next = &TCBSegment[Identity];
-      
-      /*  Skip the idle task and tell the next ready task's previous pointer to
-          point to the new task. */
-      pCurrentTaskTCB->Next->Prev = &TCBSegment[Identity];
-      
-      /* Point to the next task to keep the link (skip the idle task). */
-      TCBSegment[Identity].Next = pCurrentTaskTCB->Next;
-      
-      /* Point to the previous task to keep the link. */
-      TCBSegment[Identity].Prev = pCurrentTaskTCB->Prev;
-    }
+    /* Case 1. */
+
+    /*  This is the only ready task, so it should point to itself and take the
+        idle task out of the loop. */
+    pTask->Next = pTask;
+    pTask->Prev = pTask;
+
+    /* The next task to run should be this task. */
+    pCurrentTaskTCB->Next = pTask;
   }
-  else /* The idle task is not running. */
+  else
   {
-    /* Case 4. */
-    
-    /* Set the previous pointer to the previous previous task. */
-    TCBSegment[Identity].Prev = pCurrentTaskTCB->Prev;
-    
-    /* Set the last task's next pointer. */
-    pCurrentTaskTCB->Prev->Next = &TCBSegment[Identity];
-    
-    /* Set the next pointer to the current task. */
-    TCBSegment[Identity].Next = pCurrentTaskTCB;
+    /* Case 2. */
+
+    /* Put at end. */
+    pTask->Next = pFirst;
+    pTask->Prev = pFirst->Prev;
+    pFirst->Prev->Next = pTask;
+    pFirst->Prev = pTask;
   }
-  
-  /* Put at end. */
-  pCurrentTaskTCB->Prev = &TCBSegment[Identity];
-  
+
   return DK_SUCCESS;
 }
 
 
 static signed DK_DeregisterTask(unsigned char Identity)
 {
-/* Deregisters a task with the scheduler.
+/* Deregisters a task with the scheduler.  The task may or may not be the
+   running task.
 
    Result:
    DK_SUCCESS if succesful. */
 
+  DK_TCB * pTask = &TCBSegment[Identity],
+         * pNext = pTask->Next;
+
   /* Update the ready list. */
-  
+
   /*  Possible cases:
-      1. Idle task is running and this is the only ready task.
-      2. Idle task is running and this is not the only ready task.
-      3. Idle task is not running and this is the only ready task.
-      4. Idle task is not running and this is not the only ready task. */
-  
-  if( pCurrentTaskTCB->Next == pCurrentTaskTCB
-      || pCurrentTaskTCB == &TCBSegment[0])
+      1. This is the only ready task.
+      2. This is not the only ready task. */
+
+  if( pNext == pTask )
   {
-    /* Case 1 & 3. */
+    /* Case 1. */
 
     /* This is the only ready task, so it should reinstitute the idle task. */
-    pCurrentTaskTCB->Next = &TCBSegment[0];
-    
+    pNext = &TCBSegment[0];
+
     /* Configure the idle task to point at itself. */
     TCBSegment[0].Prev = &TCBSegment[0];
     TCBSegment[0].Next = &TCBSegment[0];
   }
-  else /* There are other ready tasks. */
+  else
   {
-    /* Case 2 & 4. */
-    
-    /*  There are other ready task(s), but the current task is the idle task.
-        Update the previous task's next pointer to this task's next pointer. */
-    pCurrentTaskTCB->Prev->Next = TCBSegment[Identity].Next;
-    
-    /*  Update the next task's previous pointer to this task's previous
-        pointer. */
-    pCurrentTaskTCB->Next->Prev = TCBSegment[Identity].Prev;
+    /* Case 2. */
+
+    /* Close the gap left by this task. */
+    pTask->Prev->Next = pNext;
+    pNext->Prev = pTask->Prev;
   }
-  
+
+  /* The task keeps pointing at its successor so that, if it is the running
+     task, the scheduler can still find the next task to run. */
+  pTask->Next = pNext;
+
+  /* A running task outside the list (the idle task, or a task that has already
+     deregistered itself) may also point at this task and must skip it. */
+  if( pCurrentTaskTCB->Next == pTask )
+  {
+    pCurrentTaskTCB->Next = pNext;
+  }
+
   return DK_SUCCESS;
 }
 
@@ -283,13 +379,14 @@ static signed DK_DeregisterTask(unsigned char Identity)
 signed DK_ConfigureTaskState( unsigned char Identity,
                               DK_TaskState NewState )
 {
-/* Changes the specified tasks state.
+/* Changes the specified tasks state.  This function contains a critical
+   section, and may be called from an interrupt handler or DK_QuantumTrigger.
 
    Result:
    DK_SUCCESS if succesful. */
 
   /* Enter critical section. */
-  DK_DisableInterrupts();
+  DK_EnterCriticalSection();
   
   /* If the old task state was DEAD and the new task state is not DEAD,
      increment the number of living tasks. */
@@ -340,7 +437,7 @@ signed DK_ConfigureTaskState( unsigned char Identity,
   TCBSegment[Identity].State = NewState;
   
   /* Exit critical section. */
-  DK_EnableInterrupts();
+  DK_ExitCriticalSection();
   
   return DK_SUCCESS;
 }
@@ -378,6 +475,162 @@ signed DK_ResetQuantumCount(void)
 }
 
 
+DK_Time DK_GetTickCount(void)
+{
+/* Result:
+   The number of quanta since the kernel started.  This cannot be reset; it
+   wraps around, so compare it with DK_TimeAfter and friends. */
+
+  DK_Time Result = 0;
+
+  DK_EnterCriticalSection();
+  Result = TickCount;
+  DK_ExitCriticalSection();
+
+  return Result;
+}
+
+
+DK_Time DK_GetTimeMicroseconds(void)
+{
+/* Reads kernel time to the resolution of the scheduler clock, by adding the
+   scheduler clock's progress into the current period to the tick count.  Like
+   the tick count, this wraps around, every 71 minutes or so.  Do not call
+   from DK_QuantumTrigger; use DK_GetTickCount there.
+
+   Result:
+   The number of microseconds since the kernel started. */
+
+  DK_Time Result = 0;
+
+  DK_EnterCriticalSection();
+  Result = DK_GetTimeMicrosecondsFromISR();
+  DK_ExitCriticalSection();
+
+  return Result;
+}
+
+
+DK_Time DK_GetTimeMicrosecondsFromISR(void)
+{
+/* DK_GetTimeMicroseconds for interrupt handlers, or any code that already has
+   interrupts disabled; interrupts are left as they are.  Within
+   DK_QuantumTrigger kernel time has not yet advanced past the period that
+   just ended, unless DK_ONE_SHOT_SLICE is defined, so the result there may be
+   up to a period early.
+
+   Result:
+   The number of microseconds since the kernel started. */
+
+  /* The last time returned. */
+  static DK_Time LastTime = 0;
+
+  DK_Time Result = 0;
+  unsigned long Counts = 0;
+
+  Result = TickCount;
+  Counts = TickRemainder + DK_ReadSchedulerClock();
+
+  /* The counts may span several quanta when a long slice is running. */
+  Result += (DK_Time)(Counts / DK_SCHEDULER_CLOCK_QUANTUM);
+  Counts %= DK_SCHEDULER_CLOCK_QUANTUM;
+
+  Result = Result * DK_QUANTUM_US
+           + (DK_Time)(Counts * DK_QUANTUM_US / DK_SCHEDULER_CLOCK_QUANTUM);
+
+  /* Right at a rollover the clock may read a count or so past the end of the
+     period it was programmed for, so the next result can land a few counts
+     behind the last.  Hold time still across that step, but no larger one:
+     the last result may be more than half a wrap old, and only seem ahead
+     because time has wrapped since. */
+  if( DK_TimeBefore(Result, LastTime) &&
+      (DK_Time)(LastTime - Result)
+        <= (DK_Time)(4UL * DK_QUANTUM_US / DK_SCHEDULER_CLOCK_QUANTUM + 1) )
+  {
+    Result = LastTime;
+  }
+
+  LastTime = Result;
+
+  return Result;
+}
+
+
+void DK_EnterCriticalSection(void)
+{
+/* Disables interrupts until the matching DK_ExitCriticalSection.  Critical
+   sections nest, and may be entered from an interrupt handler: only the
+   outermost exit restores interrupts, and then to the state they were in
+   before the outermost entry rather than enabled.  Keep them short; every
+   interrupt, the scheduler clock's included, waits on them.  Code that only
+   needs to keep other tasks out should use DK_SchedulerLock instead. */
+
+  DK_InterruptState Interrupts;
+
+  DK_SaveInterrupts(Interrupts);
+
+  if(CriticalNesting == (unsigned)0)
+  {
+    CriticalInterrupts = Interrupts;
+  }
+
+  ++CriticalNesting;
+}
+
+
+void DK_ExitCriticalSection(void)
+{
+/* Leaves a critical section entered by DK_EnterCriticalSection. */
+
+  if(CriticalNesting == (unsigned)0)
+  {
+    /* Unbalanced. */
+    return;
+  }
+
+  --CriticalNesting;
+
+  if(CriticalNesting == (unsigned)0)
+  {
+    DK_RestoreInterrupts(CriticalInterrupts);
+  }
+}
+
+
+void DK_SchedulerLock(void)
+{
+/* Keeps the running task running until the matching DK_SchedulerUnlock, with
+   interrupts left enabled.  The scheduler clock still runs, and so do
+   DK_QuantumTrigger and every other interrupt handler, but task switches,
+   DK_InvokeScheduler's included, are put off until the scheduler is unlocked.
+   Locks nest.  For tasks only, and a task must not wait on another task while
+   it holds the lock. */
+
+  ++SchedulerLocks;
+}
+
+
+void DK_SchedulerUnlock(void)
+{
+/* Releases a lock taken by DK_SchedulerLock.  If a task switch was put off
+   while the scheduler was locked, the outermost unlock makes it now. */
+
+  if(SchedulerLocks == (unsigned)0)
+  {
+    /* Unbalanced. */
+    return;
+  }
+
+  --SchedulerLocks;
+
+  if( SchedulerLocks == (unsigned)0 && SwitchPending != FALSE )
+  {
+    SwitchPending = FALSE;
+    DK_InvokeScheduler();
+  }
+}
+
+
 void DK_IdleTask(void)
 {
 /* A special task that is always READY or RUNNING for use when no other other
@@ -57,7 +57,38 @@ typedef enum
 
 /* A pointer to a task typedef.  Tasks should have a signature of
    void Task(void). */
-typedef long short unsigned  DK_TaskAddress;
+#ifdef __18F4550
+  typedef long short unsigned  DK_TaskAddress;
+#else
+  typedef void (* DK_TaskAddress)(void);
+#endif
+
+
+/* Kernel time.  Tick counts and microsecond times are 32 bits wide and wrap
+   around, so compare them only with the macros below.  These are correct so
+   long as the two times are less than half the range apart: about 24 days of
+   one millisecond ticks, or 35 minutes of microseconds. */
+#ifdef DK_POSIX
+  typedef unsigned int  DK_Time;
+  typedef signed int    DK_TimeDifference;
+#else
+  typedef unsigned long DK_Time;
+  typedef signed long   DK_TimeDifference;
+#endif
+
+/* Nonzero if time A is later than time B. */
+#define DK_TimeAfter( A, B )\
+  ( (DK_TimeDifference)((DK_Time)(B) - (DK_Time)(A)) < 0 )
+
+/* Nonzero if time A is earlier than time B. */
+#define DK_TimeBefore( A, B ) DK_TimeAfter( B, A )
+
+/* Nonzero if time A is the same as or later than time B. */
+#define DK_TimeAfterOrEqual( A, B )\
+  ( (DK_TimeDifference)((DK_Time)(A) - (DK_Time)(B)) >= 0 )
+
+/* The time elapsed from time Since until time Now. */
+#define DK_TimeElapsed( Since, Now ) ( (DK_Time)((DK_Time)(Now) - (DK_Time)(Since)) )
 
 
 signed DK_InitializeKernel(void);
@@ -68,6 +99,13 @@ unsigned char DK_GetRunningTaskIdentity(void);
 unsigned DK_GetNumberOfLivingTasks(void);
 unsigned DK_GetQuantumCount(void);
 signed DK_ResetQuantumCount(void);
+DK_Time DK_GetTickCount(void);
+DK_Time DK_GetTimeMicroseconds(void);
+DK_Time DK_GetTimeMicrosecondsFromISR(void);
+void DK_EnterCriticalSection(void);
+void DK_ExitCriticalSection(void);
+void DK_SchedulerLock(void);
+void DK_SchedulerUnlock(void);
 
 
 /*******************************************************************************
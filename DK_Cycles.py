@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+"""
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+Cycle-exact timing of the PIC18F4550 image under gpsim.  The image's map file
+gives the address of every phase of the scheduler clock interrupt, its hex file
+gives every return address of DK_USB_SendPacket, and gpsim is run in batch mode
+with an execution breakpoint on each.  The cycle counter read at every
+breakpoint yields:
+
+  context_save     DK_ISR_SchedulerClock to DK_SaveContext_Dispatch.
+  schedule         DK_Scheduler to DK_RestoreContext, including the user's
+                   DK_QuantumTrigger.
+  context_restore  DK_RestoreContext to the retfie at DK_RestoreContext_Return,
+                   excluding the retfie itself.
+  usb_send_packet  DK_USB_SendPacket to its return, with both of EP1 IN's ping
+                   pong buffers handed back to the MCU before every run so
+                   each call performs its copy.
+
+Results are printed as "<name> <value> cycles", the same format as
+DK_Benchmark, and the worst case of each phase is checked against a budget.  The
+program exits non-zero if any budget is exceeded or a phase was never seen.
+
+Usage: DK_Cycles.py [-n stops] [-b name=cycles ...] image
+where image is the path to the linker output without an extension.
+"""
+
+import re
+import subprocess
+import sys
+
+
+# Worst case instruction cycles allowed for each phase.  The context frame is
+# 33 movff (36 with DK_FLOAT_CONTEXT) plus ten cycles per hardware return stack
+# entry to save and thirteen to restore.
+BUDGETS = {
+  "context_save":    140,
+  "schedule":        2500,
+  "context_restore": 160,
+  "usb_send_packet": 400,
+}
+
+# gpsim commands.  The cycle counter is printed as a number in the reply.
+GPSIM = "gpsim"
+GPSIM_CYCLES = "cycles"
+GPSIM_MARKER = "echo @@"
+
+
+def ReadMap(Path):
+  """Returns a dictionary of symbol name to address from an MPLINK map file."""
+
+  Symbols = {}
+
+  with open(Path) as Map:
+    for Line in Map:
+      Match = re.match(r"\s*(\S+)\s+0x([0-9a-fA-F]+)\s+(program|data)\s", Line)
+
+      if Match:
+        Symbols[Match.group(1)] = int(Match.group(2), 16)
+
+  return Symbols
+
+
+def ReadHex(Path):
+  """Returns a dictionary of byte address to byte from an Intel hex file."""
+
+  Image = {}
+  Base = 0
+
+  with open(Path) as Hex:
+    for Line in Hex:
+      Line = Line.strip()
+
+      if not Line.startswith(":"):
+        continue
+
+      Record = bytes.fromhex(Line[1:])
+      Length, Address, Type = Record[0], (Record[1] << 8) | Record[2], Record[3]
+      Data = Record[4:4 + Length]
+
+      if Type == 0:
+        for Offset, Byte in enumerate(Data):
+          Image[Base + Address + Offset] = Byte
+      elif Type == 4:
+        Base = ((Data[0] << 8) | Data[1]) << 16
+
+  return Image
+
+
+def FindReturnAddresses(Image, Target):
+  """Returns the address following every CALL or RCALL to Target."""
+
+  Returns = []
+
+  for Address in sorted(Image):
+    if Address & 1 or Address + 1 not in Image:
+      continue
+
+    Word = Image[Address] | (Image[Address + 1] << 8)
+
+    if Word & 0xF800 == 0xD800:
+      # RCALL n: PC + 2 + 2n, n signed eleven bits.
+      Offset = Word & 0x7FF
+
+      if Offset & 0x400:
+        Offset -= 0x800
+
+      if Address + 2 + 2 * Offset == Target:
+        Returns.append(Address + 2)
+
+    elif Word & 0xFE00 == 0xEC00 and Address + 3 in Image:
+      # CALL k: the second word holds the upper twelve bits of k.
+      Second = Image[Address + 2] | (Image[Address + 3] << 8)
+
+      if Second & 0xF000 == 0xF000 and \
+         ((Word & 0xFF) | ((Second & 0xFFF) << 8)) * 2 == Target:
+        Returns.append(Address + 4)
+
+  return Returns
+
+
+def WriteScript(Breakpoints, Stops, BufferStatuses):
+  """Returns the gpsim command script: every breakpoint, then Stops runs, each
+     followed by the cycle counter."""
+
+  Lines = ["break e 0x%x" % Address for Address in sorted(Breakpoints)]
+
+  for Stop in range(Stops):
+    # Hand EP1 IN back to the MCU so DK_USB_SendPacket always copies.
+    for BufferStatus in BufferStatuses:
+      Lines.append("reg(0x%x) = 0x08" % BufferStatus)
+    Lines.append(GPSIM_MARKER + "run")
+    Lines.append("run")
+    Lines.append(GPSIM_MARKER + "cycles")
+    Lines.append(GPSIM_CYCLES)
+
+  Lines.append("quit")
+
+  return "\n".join(Lines) + "\n"
+
+
+def ParseTranscript(Transcript, Breakpoints):
+  """Returns a list of (breakpoint name, cycle) for every stop in the gpsim
+     transcript."""
+
+  Stops = []
+  Chunks = Transcript.split("@@run")[1:]
+
+  for Chunk in Chunks:
+    Halt, _, Cycles = Chunk.partition("@@cycles")
+
+    Addresses = [int(Value, 16) for Value in re.findall(r"0x([0-9a-fA-F]+)", Halt)]
+    Names = [Breakpoints[Address] for Address in Addresses if Address in Breakpoints]
+    Counts = re.findall(r"(?:0x([0-9a-fA-F]+)|(\d+))", Cycles)
+
+    if not Names or not Counts:
+      continue
+
+    Hex, Decimal = Counts[-1]
+    Stops.append((Names[0], int(Hex, 16) if Hex else int(Decimal)))
+
+  return Stops
+
+
+def Measure(Stops):
+  """Returns a dictionary of phase name to list of cycle counts."""
+
+  Phases = {Name: [] for Name in BUDGETS}
+  Phase = {
+    "DK_SaveContext_Dispatch":  ("DK_ISR_SchedulerClock", "context_save"),
+    "DK_RestoreContext":        ("DK_Scheduler", "schedule"),
+    "DK_RestoreContext_Return": ("DK_RestoreContext", "context_restore"),
+    "DK_USB_SendPacket_Return": ("DK_USB_SendPacket", "usb_send_packet"),
+  }
+  Last = {}
+
+  for Name, Cycle in Stops:
+    if Name in Phase:
+      Start, Measurement = Phase[Name]
+
+      if Start in Last:
+        Phases[Measurement].append(Cycle - Last.pop(Start))
+
+    Last[Name] = Cycle
+
+  return Phases
+
+
+def main(Arguments):
+  Stops = 4000
+  Budgets = dict(BUDGETS)
+  Image = None
+
+  while Arguments:
+    Argument = Arguments.pop(0)
+
+    if Argument == "-n" and Arguments:
+      Stops = int(Arguments.pop(0))
+    elif Argument == "-b" and Arguments:
+      Name, _, Value = Arguments.pop(0).partition("=")
+      Budgets[Name] = int(Value)
+    elif Image is None and not Argument.startswith("-"):
+      Image = Argument
+    else:
+      Image = None
+      break
+
+  if Image is None:
+    sys.stderr.write(__doc__.strip().splitlines()[-2] + "\n")
+    return 1
+
+  Symbols = ReadMap(Image + ".map")
+  Breakpoints = {}
+
+  for Name in ("DK_ISR_SchedulerClock", "DK_SaveContext_Dispatch",
+               "DK_Scheduler", "DK_RestoreContext", "DK_RestoreContext_Return",
+               "DK_USB_SendPacket"):
+    if Name not in Symbols:
+      sys.stderr.write("%s is not in %s.map.\n" % (Name, Image))
+      return 1
+
+    Breakpoints[Symbols[Name]] = Name
+
+  for Address in FindReturnAddresses(ReadHex(Image + ".hex"),
+                                     Symbols["DK_USB_SendPacket"]):
+    Breakpoints[Address] = "DK_USB_SendPacket_Return"
+
+  # The STAT of BufferDescriptorTable[USB_BD(1, 1, 0)] and [USB_BD(1, 1, 1)],
+  # EP1 IN's even and odd descriptors.
+  Script = WriteScript(Breakpoints, Stops,
+                       [Symbols["BufferDescriptorTable"] + Index * 4
+                        for Index in (4, 5)])
+
+  Transcript = subprocess.run([GPSIM, "-i", "-p", "p18f4550",
+                               "-s", Image + ".cof"],
+                              input=Script, capture_output=True,
+                              text=True).stdout
+
+  Result = 0
+
+  print("# Dreamcatcher Kernel PIC18F4550 cycle counts, %d stops" % Stops)
+
+  for Name, Cycles in Measure(ParseTranscript(Transcript, Breakpoints)).items():
+    if not Cycles:
+      print("# %s was never measured" % Name)
+      Result = 1
+      continue
+
+    print("%s_min %d cycles" % (Name, min(Cycles)))
+    print("%s_max %d cycles" % (Name, max(Cycles)))
+
+    if max(Cycles) > Budgets[Name]:
+      print("# %s worst case %d exceeds budget of %d cycles OVER BUDGET"
+            % (Name, max(Cycles), Budgets[Name]))
+      Result = 1
+
+  return Result
+
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv[1:]))
@@ -12,5 +12,10 @@ This file provides a means to easily link to all headers with a single include.
 #include "DK_Core.h"
 #include "DK_Specific.h"
 #include "DK_USB.h"
+#include "DK_USART.h"
+#include "DK_Log.h"
+#include "DK_Job.h"
+#include "DK_Basic.h"
+#include "DK_Watchdog.h"
 
 #endif /* DK_GLOBAL_H. */
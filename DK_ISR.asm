@@ -13,6 +13,7 @@
   ; Imports.
   extern DK_Scheduler
   extern DK_USB_ISR
+  extern DK_USART_ISR
   extern DK_ISR
   extern pCurrentTaskTCB
   extern __AARGB0
@@ -27,9 +28,11 @@
   extern __BARGB1
   extern __BARGB2
   extern __BARGB3
+#ifdef DK_FLOAT_CONTEXT
   extern __AEXP
   extern __BEXP
   extern __FPFLAGS
+#endif
   extern __TEMPB0
   extern __TEMPB1
   extern __TEMPB2
@@ -64,7 +67,9 @@ DK_SaveContext:
   movff __AARGB1,PREINC1    ;
   movff __AARGB2,PREINC1    ;
   movff __AARGB3,PREINC1    ;
-  movff __FPFLAGS,PREINC1   ;
+#ifdef DK_FLOAT_CONTEXT
+  movff __FPFLAGS,PREINC1   ; Floating point only.  See DK_FLOAT_CONTEXT.
+#endif
   movff __AARGB4,PREINC1    ;
   movff __AARGB5,PREINC1    ;
   movff __AARGB6,PREINC1    ;
@@ -73,8 +78,10 @@ DK_SaveContext:
   movff __BARGB1,PREINC1    ;
   movff __BARGB2,PREINC1    ;
   movff __BARGB3,PREINC1    ;
-  movff __AEXP,PREINC1      ;
-  movff __BEXP,PREINC1      ;
+#ifdef DK_FLOAT_CONTEXT
+  movff __AEXP,PREINC1      ; Floating point only.
+  movff __BEXP,PREINC1      ; ''
+#endif
   movff __TEMPB0,PREINC1    ;
   movff __TEMPB1,PREINC1    ;
   movff __TEMPB2,PREINC1    ;
@@ -120,6 +127,22 @@ DK_SaveContext_Continue:
   ; stack is empty and must be loaded prior to performing a return from
   ; interrupt command, as that will pop the stack once more.
 
+  ; The context is saved.  (This label costs no cycles; DK_Cycles.py uses it to
+  ; time the save.)
+DK_SaveContext_Dispatch:
+
+  ; If the USART has received a character, or its transmit register is free
+  ; while there is more to send, call the USART ISR.
+  btfsc PIR1,RCIF
+  bra DK_SaveContext_USART
+  btfss PIE1,TXIE
+  bra DK_SaveContext_User
+  btfss PIR1,TXIF
+  bra DK_SaveContext_User
+DK_SaveContext_USART:
+  call DK_USART_ISR
+DK_SaveContext_User:
+
   ; If this is not a TMR0 or USB interrupt, invoke the user's interrupt handler.
   btfsc INTCON,TMR0IF
   bra $+8
@@ -182,8 +205,10 @@ DK_RestoreContext_Continue:
   movff POSTDEC1,__TEMPB2
   movff POSTDEC1,__TEMPB1
   movff POSTDEC1,__TEMPB0
+#ifdef DK_FLOAT_CONTEXT
   movff POSTDEC1,__BEXP
   movff POSTDEC1,__AEXP
+#endif
   movff POSTDEC1,__BARGB3
   movff POSTDEC1,__BARGB2
   movff POSTDEC1,__BARGB1
@@ -192,7 +217,9 @@ DK_RestoreContext_Continue:
   movff POSTDEC1,__AARGB6
   movff POSTDEC1,__AARGB5
   movff POSTDEC1,__AARGB4
+#ifdef DK_FLOAT_CONTEXT
   movff POSTDEC1,__FPFLAGS
+#endif
   movff POSTDEC1,__AARGB3
   movff POSTDEC1,__AARGB2
   movff POSTDEC1,__AARGB1
@@ -218,6 +245,7 @@ DK_RestoreContext_Continue:
   bsf T0CON,7,0
 
   ; Jump back to the restored process and re-enable interrupts.
+DK_RestoreContext_Return:
   retfie 0
 
 
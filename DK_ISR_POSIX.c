@@ -0,0 +1,97 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains POSIX host specific code for saving and restoring context
+data.  It takes the place of DK_ISR.asm when the kernel is built as a Linux
+process.
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  3
+
+#include "DK_Global.h"
+#include <errno.h>
+
+
+#ifdef DK_POSIX
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+/* SIGALRM (the scheduler clock) and SIGUSR1 (user interrupts). */
+sigset_t DK_InterruptSignals;
+
+/* The saved context of every task.  The idle task's context is filled in the
+   first time it is switched out; every other context is built by
+   DK_InitializeTask. */
+ucontext_t DK_ContextSegment[DK_MAXIMUM_TASKS];
+
+/* The function each task was initialized with, called by DK_TaskEntry. */
+DK_TaskAddress DK_TaskEntryPoint[DK_MAXIMUM_TASKS];
+
+/* Storage carved into individual task stacks by DK_InitializeTask. */
+unsigned char DK_MasterStack[DK_MASTER_STACK_SIZE]
+  __attribute__((aligned(16)));
+
+
+/* Imports. */
+void DK_ISR(void);
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+void DK_ISR_SchedulerClock(int Signal)
+{
+/* The host interrupt vector.  Both kernel signals are masked on entry.  If this
+   is not a scheduler clock interrupt, the user's interrupt handler is invoked;
+   otherwise the scheduler is called.  If the scheduler selected a different
+   task, the current context is saved and the new one restored.  The old task
+   resumes here, still inside the handler, the next time it is selected, and
+   the return from the handler plays the part of retfie. */
+
+  DK_TCB * pOldTaskTCB = pCurrentTaskTCB;
+
+  /* errno is the one piece of C library state a task can observe changing
+     underneath it, so it is part of the context. */
+  int SavedErrno = errno;
+
+  if(Signal == SIGALRM)
+  {
+    DK_Scheduler();
+  }
+  else
+  {
+    DK_ISR();
+  }
+
+  if(pCurrentTaskTCB != pOldTaskTCB)
+  {
+    swapcontext( &DK_ContextSegment[pOldTaskTCB->Identity],
+                 &DK_ContextSegment[pCurrentTaskTCB->Identity] );
+  }
+
+  errno = SavedErrno;
+}
+
+
+void DK_TaskEntry(void)
+{
+/* The first code run on every new task context.  Enables interrupts, calls the
+   task and, should it ever return, kills it rather than letting it fall off the
+   end of its stack. */
+
+  DK_EnableInterrupts();
+
+  DK_TaskEntryPoint[DK_GetRunningTaskIdentity()]();
+
+  DK_ConfigureTaskState(DK_GetRunningTaskIdentity(), DEAD);
+
+  while(1)
+  {
+    /* The task forfeits one quantum per invocation until the scheduler moves
+       on; it is never selected again. */
+    DK_InvokeScheduler();
+  }
+}
+#endif /* DK_POSIX */
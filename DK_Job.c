@@ -0,0 +1,225 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the job pool; see DK_Job.h.
+
+The queue is a ring of job slots.  Any task or interrupt handler may push, and
+any worker may pop.  There are several of each, and the PIC has no atomic
+read-modify-write to claim a slot with, so each push and pop is a critical
+section the length of a three pointer copy.  No one ever waits on anyone else
+to finish with the queue.  Idle workers sleep in the WAITING state, and a push
+wakes one of them.
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  11
+
+#include "DK_Global.h"
+
+
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+typedef struct
+{
+  DK_JobFunction Function;
+  void * pArgument;
+  DK_JobCompletion * pCompletion;
+} DK_Job;
+
+/* The job queue.  DK_JobSubmit adds at Head, and the workers take from Tail.
+   Both count freely and are masked into the ring, so their difference is the
+   number of jobs queued. */
+static DK_Job Queue[DK_JOB_QUEUE_SIZE];
+static volatile unsigned char Head = 0,
+                              Tail = 0;
+
+/* The workers' task identities, zero until DK_JobInitialize. */
+static unsigned char Workers[DK_JOB_WORKERS] = {0};
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+signed DK_JobInitialize(void)
+{
+/* This function starts the worker tasks.  Call it once, after
+   DK_InitializeKernel.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if there were not enough task control
+   blocks for every worker. */
+
+  unsigned char Index = 0;
+
+  for(Index = 0; Index < (unsigned)DK_JOB_WORKERS; ++Index)
+  {
+    Workers[Index] = DK_InitializeTask( (DK_TaskAddress)DK_JobWorker,
+                                        READY,
+                                        DK_JOB_QUANTUM_SHARE );
+
+    if(Workers[Index] == (unsigned)0)
+    {
+      return DK_FAILURE;
+    }
+  }
+
+  return DK_SUCCESS;
+}
+
+
+signed DK_JobSubmit( DK_JobFunction Function,
+                     void * pArgument,
+                     DK_JobCompletion * pCompletion )
+{
+/* This function queues a job, and wakes a worker to run it if need be.  It
+   never waits, so it may be called from DK_QuantumTrigger or an interrupt
+   handler.
+
+   Parameters:
+   Function     The job.
+   pArgument    Passed to the job.
+   pCompletion  Set when the job is done, or zero for no notification.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if the queue is full. */
+
+  signed Result = DK_FAILURE;
+  unsigned char Index = 0,
+                Awake = 0;
+  DK_Job * pJob = 0;
+
+  if(pCompletion != 0)
+  {
+    pCompletion->Done = FALSE;
+    pCompletion->Waiter = 0;
+  }
+
+  DK_EnterCriticalSection();
+
+  if( (unsigned char)(Head - Tail) < (unsigned)DK_JOB_QUEUE_SIZE )
+  {
+    pJob = &Queue[Head & (DK_JOB_QUEUE_SIZE - 1)];
+    pJob->Function = Function;
+    pJob->pArgument = pArgument;
+    pJob->pCompletion = pCompletion;
+    ++Head;
+
+    Result = DK_SUCCESS;
+
+    /* Workers that are awake take jobs until the queue is empty, so one more
+       is only woken if there are more jobs queued than workers awake. */
+    for(Index = 0; Index < (unsigned)DK_JOB_WORKERS; ++Index)
+    {
+      if( Workers[Index] != (unsigned)0 &&
+          TCBSegment[Workers[Index]].State != WAITING )
+      {
+        ++Awake;
+      }
+    }
+
+    for(Index = 0; Index < (unsigned)DK_JOB_WORKERS; ++Index)
+    {
+      if( (unsigned char)(Head - Tail) > Awake &&
+          Workers[Index] != (unsigned)0 &&
+          TCBSegment[Workers[Index]].State == WAITING )
+      {
+        DK_ConfigureTaskState(Workers[Index], READY);
+        break;
+      }
+    }
+  }
+
+  DK_ExitCriticalSection();
+
+  return Result;
+}
+
+
+signed DK_JobWait( DK_JobCompletion * pCompletion )
+{
+/* This function puts the calling task to sleep until a job submitted with
+   pCompletion is done.  For tasks other than the idle task only.
+
+   Result:
+   DK_SUCCESS once the job is done, DK_FAILURE if called from the idle
+   task. */
+
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+
+  if(Identity == (unsigned)0)
+  {
+    return DK_FAILURE;
+  }
+
+  while(1)
+  {
+    DK_EnterCriticalSection();
+
+    if(pCompletion->Done != FALSE)
+    {
+      DK_ExitCriticalSection();
+      break;
+    }
+
+    /* Deciding to sleep and going to sleep happen together, so the worker
+       cannot finish in between and leave this task asleep. */
+    pCompletion->Waiter = Identity;
+    DK_ConfigureTaskState(Identity, WAITING);
+
+    DK_ExitCriticalSection();
+
+    DK_InvokeScheduler();
+  }
+
+  return DK_SUCCESS;
+}
+
+
+void DK_JobWorker(void)
+{
+/* A worker task.  It runs queued jobs one at a time until there are none left,
+   then sleeps until DK_JobSubmit wakes it. */
+
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+  DK_Job Job;
+
+  while(1)
+  {
+    DK_EnterCriticalSection();
+
+    if(Head == Tail)
+    {
+      /* As in DK_JobWait, nothing can be queued between finding the queue
+         empty and going to sleep. */
+      DK_ConfigureTaskState(Identity, WAITING);
+
+      DK_ExitCriticalSection();
+
+      DK_InvokeScheduler();
+      continue;
+    }
+
+    Job = Queue[Tail & (DK_JOB_QUEUE_SIZE - 1)];
+    ++Tail;
+
+    DK_ExitCriticalSection();
+
+    Job.Function(Job.pArgument);
+
+    if(Job.pCompletion != 0)
+    {
+      DK_EnterCriticalSection();
+
+      Job.pCompletion->Done = TRUE;
+
+      if(Job.pCompletion->Waiter != (unsigned)0)
+      {
+        DK_ConfigureTaskState(Job.pCompletion->Waiter, READY);
+      }
+
+      DK_ExitCriticalSection();
+    }
+  }
+}
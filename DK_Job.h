@@ -0,0 +1,64 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the declarations for DK_Job.c, the job pool.
+
+A job is a function and an argument, run to completion by one of a fixed pool
+of worker tasks.  Submitting a job costs a queue push rather than the life of
+a task: no task control block is searched for, no stack is carved, and no
+context is built.  Jobs may be submitted from tasks, DK_QuantumTrigger, or
+interrupt handlers, and run in the order submitted.  A job runs on a worker's
+stack and is preempted like any other task, but should not wait on anything,
+as every other job waits behind it.
+
+  static DK_JobCompletion Completion;
+
+  DK_JobSubmit(Job_Test3, 0, &Completion);
+  DK_JobWait(&Completion);
+*******************************************************************************/
+
+#ifndef DK_JOB_H
+#define DK_JOB_H
+
+
+/* User definable.  The number of worker tasks, each of which takes a task
+   control block and a stack of its own. */
+#ifndef DK_JOB_WORKERS
+  #define DK_JOB_WORKERS  1
+#endif
+
+/* Size in jobs of the job queue.  Must be a power of two no larger than
+   128. */
+#ifndef DK_JOB_QUEUE_SIZE
+  #define DK_JOB_QUEUE_SIZE  8
+#endif
+
+/* The workers' time share. */
+#ifndef DK_JOB_QUANTUM_SHARE
+  #define DK_JOB_QUANTUM_SHARE  1
+#endif
+
+
+/* A job's function.  The argument is the one given to DK_JobSubmit. */
+typedef void (* DK_JobFunction)( void * pArgument );
+
+/* Completion notification for a job, given to DK_JobSubmit.  Done is set once
+   the job has returned, and DK_JobWait sleeps until it is.  Must not be reused
+   until its job is done. */
+typedef struct
+{
+  volatile unsigned char Done;
+  volatile unsigned char Waiter; /* The task in DK_JobWait, or zero. */
+} DK_JobCompletion;
+
+
+signed DK_JobInitialize(void);
+signed DK_JobSubmit( DK_JobFunction Function,
+                     void * pArgument,
+                     DK_JobCompletion * pCompletion );
+signed DK_JobWait( DK_JobCompletion * pCompletion );
+void DK_JobWorker(void);
+
+
+#endif /* DK_JOB_H */
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+"""
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+Input latency of the game pad, from the moment the controller is latched to
+the moment its report reaches a Linux host.  Every report the firmware sends
+carries a sequence number, the kernel time at which its reading was latched,
+and the USB frame number at that moment (see USB_HID_REPORT_SIZE in
+DK_USB.h).  The reports are read from the game pad's hidraw node, each stamped
+with the host's monotonic clock as it is received.
+
+The device's and the host's clocks are unrelated, so they are correlated
+through the bus:
+
+  1. Frame numbers count the host controller's milliseconds.  A line fitted
+     through the device times against the frame numbers gives the device
+     clock's error, and what is left over is where within its frame each
+     reading was latched.  This puts every latch on the bus's clock.
+  2. The fastest reports received are the ones that lost no time.  A line
+     fitted through the fastest of each run of reports, latch on the bus clock
+     against receipt on the host's, maps one clock to the other.
+
+Each report's latency is then its receipt less its latch, measured from the
+fastest delivery seen; add the transfer and system call time that the
+fastest delivery still took, which is the same for every report, for an
+absolute figure.  Reports missing from the sequence are counted as dropped.
+
+Results are printed as "<name> <value> <unit>", the same format as
+DK_Benchmark, and the percentiles are checked against a budget, so the run
+can gate changes to the polling, scheduling, and USB paths.  The program exits
+non-zero if any budget is exceeded.  Press buttons
+while it runs: the game pad only reports changes, and otherwise every
+NES_KEEPALIVE_FRAMES.
+
+Usage: DK_Latency.py [-n reports] [-b name=microseconds ...] hidraw
+where hidraw is the game pad's node, such as /dev/hidraw0.
+"""
+
+import os
+import sys
+import time
+
+
+# Worst case microseconds allowed for each percentile, relative to the fastest
+# report.  The host polls the HID endpoint every frame.
+BUDGETS = {
+  "latency_p50":  1000,
+  "latency_p90":  1500,
+  "latency_p99":  2000,
+  "latency_p999": 4000,
+}
+
+# The report, as laid out by USB_HID_REPORT_SIZE and its offsets in DK_USB.h.
+REPORT_SIZE = 9
+REPORT_SEQUENCE = 1
+REPORT_TIME = 3
+REPORT_FRAME = 7
+
+# The number of reports in each run whose fastest is used to map the bus clock
+# to the host's.
+ENVELOPE_RUN = 50
+
+
+def Field(Report, Offset, Size):
+  """Returns a little endian field of a report."""
+
+  return int.from_bytes(Report[Offset:Offset + Size], "little")
+
+
+def Unwrap(Values, Modulus):
+  """Returns a list of counters that wrap at Modulus, made to count on."""
+
+  Result = []
+  Base = 0
+
+  for Index, Value in enumerate(Values):
+    if Index and Value + Base < Result[-1] - Modulus // 2:
+      Base += Modulus
+
+    Result.append(Value + Base)
+
+  return Result
+
+
+def Fit(Xs, Ys):
+  """Returns the intercept and slope of the least squares line through the
+  points."""
+
+  Count = len(Xs)
+  MeanX = sum(Xs) / Count
+  MeanY = sum(Ys) / Count
+  Spread = sum((X - MeanX) ** 2 for X in Xs)
+
+  if Spread == 0:
+    return MeanY, 0.0
+
+  Slope = sum((X - MeanX) * (Y - MeanY) for X, Y in zip(Xs, Ys)) / Spread
+
+  return MeanY - Slope * MeanX, Slope
+
+
+def Percentile(Sorted, Fraction):
+  """Returns the nearest rank percentile of a sorted list."""
+
+  return Sorted[min(len(Sorted) - 1, int(Fraction * len(Sorted)))]
+
+
+def Read(Path, Reports):
+  """Returns a list of (host microseconds, report) read from a hidraw
+  node."""
+
+  Received = []
+  Node = os.open(Path, os.O_RDONLY)
+
+  try:
+    while len(Received) < Reports:
+      Report = os.read(Node, 64)
+      Now = time.monotonic_ns() // 1000
+
+      if len(Report) >= REPORT_SIZE:
+        Received.append((Now, Report[:REPORT_SIZE]))
+  finally:
+    os.close(Node)
+
+  return Received
+
+
+def Measure(Received):
+  """Returns a dictionary of result name to (value, unit)."""
+
+  Hosts = [Host for Host, _ in Received]
+  Sequences = Unwrap([Field(Report, REPORT_SEQUENCE, 2)
+                      for _, Report in Received], 1 << 16)
+  Devices = Unwrap([Field(Report, REPORT_TIME, 4)
+                    for _, Report in Received], 1 << 32)
+  Frames = Unwrap([Field(Report, REPORT_FRAME, 2) & 0x07FF
+                   for _, Report in Received], 1 << 11)
+
+  # The device's clock against the bus's; the residue is each latch's place
+  # within its frame, less that of the earliest latched.
+  Intercept, Rate = Fit(Frames, Devices)
+  Residues = [Device - (Intercept + Rate * Frame)
+              for Frame, Device in zip(Frames, Devices)]
+  Earliest = min(Residues)
+  Latches = [Frame * 1000 + (Residue - Earliest) * 1000 / Rate
+             for Frame, Residue in zip(Frames, Residues)]
+
+  # The bus's clock against the host's, through the fastest of each run.
+  Delays = [Host - Latch for Host, Latch in zip(Hosts, Latches)]
+  Envelope = [min(range(Start, min(Start + ENVELOPE_RUN, len(Delays))),
+                  key=lambda Index: Delays[Index])
+              for Start in range(0, len(Delays), ENVELOPE_RUN)]
+  Offset, Drift = Fit([Latches[Index] for Index in Envelope],
+                      [Delays[Index] for Index in Envelope])
+
+  Latencies = sorted(Delay - (Offset + Drift * Latch)
+                     for Delay, Latch in zip(Delays, Latches))
+  Floor = Latencies[0]
+  Latencies = [Latency - Floor for Latency in Latencies]
+
+  return {
+    "reports":      (len(Received), "reports"),
+    "dropped":      (Sequences[-1] - Sequences[0] + 1 - len(Received),
+                     "reports"),
+    "device_clock": ((Rate / 1000 - 1) * 1e6, "ppm"),
+    "latency_p50":  (Percentile(Latencies, 0.50), "us"),
+    "latency_p90":  (Percentile(Latencies, 0.90), "us"),
+    "latency_p99":  (Percentile(Latencies, 0.99), "us"),
+    "latency_p999": (Percentile(Latencies, 0.999), "us"),
+    "latency_max":  (Latencies[-1], "us"),
+  }
+
+
+def main(Arguments):
+  Reports = 1000
+  Budgets = dict(BUDGETS)
+  Path = None
+
+  while Arguments:
+    Argument = Arguments.pop(0)
+
+    if Argument == "-n" and Arguments:
+      Reports = int(Arguments.pop(0))
+    elif Argument == "-b" and Arguments:
+      Name, _, Value = Arguments.pop(0).partition("=")
+      Budgets[Name] = float(Value)
+    elif Path is None and not Argument.startswith("-"):
+      Path = Argument
+    else:
+      Path = None
+      break
+
+  if Path is None or Reports < 2:
+    sys.stderr.write(__doc__.strip().splitlines()[-2] + "\n")
+    return 1
+
+  Result = 0
+
+  print("# Dreamcatcher Kernel game pad input latency, %d reports" % Reports)
+
+  for Name, (Value, Unit) in Measure(Read(Path, Reports)).items():
+    print("%s %.1f %s" % (Name, Value, Unit))
+
+    if Name in Budgets and Value > Budgets[Name]:
+      print("# %s of %.1f exceeds budget of %.1f us OVER BUDGET"
+            % (Name, Value, Budgets[Name]))
+      Result = 1
+
+  return Result
+
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv[1:]))
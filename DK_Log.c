@@ -0,0 +1,212 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the deferred format log; see DK_Log.h.
+
+Records are written whole or not at all.  Any task or interrupt handler may
+write, and a single reader drains the ring a byte at a time.  The reader and
+the writers never wait on one another: only the writers move Head, and only
+the reader moves Tail.  Writers may interrupt one another, and the PIC has no
+atomic read-modify-write to claim space with, so each record is laid out
+first and then copied in with interrupts held off, in a critical section, for
+the few dozen cycles the copy takes.
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  6
+
+#include "DK_Global.h"
+
+
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+/* The log ring.  DK_LogWrite adds whole records at Head, and DK_LogDrain takes
+   bytes from Tail.  Both count freely and are masked into the ring, so their
+   difference is the number of bytes queued.  On the PIC it is a section of
+   its own, which the linker places in whichever data bank has room. */
+#ifdef __18F4550
+#pragma udata DK_LogRing /* Begin relocatable uninitialized data region. */
+  static unsigned char Ring[DK_LOG_RING_SIZE];
+#pragma udata  /* Return to default data region. */
+#else
+  static unsigned char Ring[DK_LOG_RING_SIZE];
+#endif
+static volatile unsigned char Head = 0,
+                              Tail = 0;
+
+/* Records that found the ring full. */
+static volatile unsigned long Drops = 0;
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+static void DK_LogRecord( unsigned short Identity,
+                          unsigned char Arguments,
+                          const unsigned long * pValues );
+
+void DK_LogWrite0( unsigned short Identity )
+{
+/* This function appends a record with no arguments.  Called through
+   DK_Log0.
+
+   Parameters:
+   Identity  The call site; see DK_LOG_IDENTITY. */
+
+  DK_LogRecord(Identity, DK_LOG_ARGUMENTS(0, 0, 0, 0), 0);
+}
+
+
+void DK_LogWrite1( unsigned short Identity,
+                   unsigned char Arguments,
+                   unsigned long A )
+{
+/* This function appends a record with one argument.  Called through
+   DK_Log1.
+
+   Parameters:
+   Identity   The call site; see DK_LOG_IDENTITY.
+   Arguments  The argument count and size; see DK_LOG_ARGUMENTS.
+   A          The argument. */
+
+  DK_LogRecord(Identity, Arguments, &A);
+}
+
+
+void DK_LogWrite( unsigned short Identity,
+                  unsigned char Arguments,
+                  unsigned long A,
+                  unsigned long B,
+                  unsigned long C )
+{
+/* This function appends a record with two or three arguments.  Called
+   through DK_Log2 and DK_Log3.
+
+   Parameters:
+   Identity   The call site; see DK_LOG_IDENTITY.
+   Arguments  The argument count and sizes; see DK_LOG_ARGUMENTS.
+   A, B, C    The arguments, those past the count ignored. */
+
+  unsigned long Values[3];
+
+  Values[0] = A;
+  Values[1] = B;
+  Values[2] = C;
+
+  DK_LogRecord(Identity, Arguments, Values);
+}
+
+
+static void DK_LogRecord( unsigned short Identity,
+                          unsigned char Arguments,
+                          const unsigned long * pValues )
+{
+/* This function appends a record to the log ring, or counts it as dropped if
+   there is no room.  The record is laid out before interrupts are held off,
+   so the critical section only claims the space and copies it in.
+
+   Parameters:
+   Identity   The call site; see DK_LOG_IDENTITY.
+   Arguments  The argument count and sizes; see DK_LOG_ARGUMENTS.
+   pValues    The arguments, as many as the count gives. */
+
+  unsigned char Record[3 + 3 * sizeof(unsigned long)];
+  const unsigned char * pValue = 0;
+  unsigned char Length = 0,
+                Count = Arguments & 0x03,
+                Sizes = Arguments >> 2,
+                Index = 0,
+                Size = 0,
+                At = 0;
+
+  Record[Length++] = (unsigned char)Identity;
+  Record[Length++] = (unsigned char)(Identity >> 8);
+  Record[Length++] = Arguments;
+
+  /* Each argument's low one, two, or four bytes, least significant first,
+     taken straight from memory rather than shifted out. */
+  for(Index = 0; Index < Count; ++Index)
+  {
+    Size = 1 << (Sizes & 0x03);
+    Sizes >>= 2;
+
+    pValue = (const unsigned char *)&pValues[Index];
+
+#ifdef M52233DEMO
+    /* The ColdFire is big endian, so the low bytes are the last ones. */
+    pValue += sizeof(unsigned long);
+
+    while(Size-- != 0)
+    {
+      Record[Length++] = *--pValue;
+    }
+#else
+    while(Size-- != 0)
+    {
+      Record[Length++] = *pValue++;
+    }
+#endif
+  }
+
+  DK_EnterCriticalSection();
+
+  if( (unsigned char)(Head - Tail) > (unsigned char)(DK_LOG_RING_SIZE - Length) )
+  {
+    ++Drops;
+    DK_ExitCriticalSection();
+    return;
+  }
+
+  At = Head;
+
+  for(Index = 0; Index < Length; ++Index)
+  {
+    Ring[At++ & (DK_LOG_RING_SIZE - 1)] = Record[Index];
+  }
+
+  /* Publish the record only once it is whole. */
+  Head = At;
+
+  DK_ExitCriticalSection();
+}
+
+
+unsigned char DK_LogDrain( signed (* pSend)( unsigned char Byte ) )
+{
+/* This function hands queued log bytes to pSend, oldest first, until the ring
+   is empty or pSend refuses one, which is kept for next time.  Only one task
+   may drain the log.  DK_USART_SendCharacter and DK_USB_SendCharacter both
+   fit.
+
+   Parameters:
+   pSend  Takes a byte, returning DK_SUCCESS if it was accepted.
+
+   Result:
+   The number of bytes handed over. */
+
+  unsigned char Result = 0;
+
+  while(Tail != Head)
+  {
+    if(pSend(Ring[Tail & (DK_LOG_RING_SIZE - 1)]) != DK_SUCCESS)
+    {
+      break;
+    }
+
+    ++Tail;
+    ++Result;
+  }
+
+  return Result;
+}
+
+
+unsigned long DK_LogGetDrops(void)
+{
+/* Result:
+   The number of records dropped because the log ring was full. */
+
+  return Drops;
+}
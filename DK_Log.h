@@ -0,0 +1,104 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the declarations for DK_Log.c, the deferred format log.
+
+A log call stores only a record: the call site's sixteen bit identity, a byte
+giving the number and sizes of its arguments, and the arguments' raw bytes,
+least significant first.  The format string is never compiled in.  DK_Log.py
+collects every call's format from the source into a table at build time, and
+renders the records with it on the host.
+
+A call site's identity is its file's DK_LOG_FILE, one to 31, in the top five
+bits and its line, below 2048, in the rest.  Each source file that logs
+defines DK_LOG_FILE before including DK_Global.h, and no two files may share a
+number.  The format must be a string literal on the same line as the call's
+name, and may use the integer conversions %d, %i, %u, %x, %X, %o, and %c;
+each argument, of up to four bytes, is stored at its own size and converted
+on the host.
+
+  DK_Log2("Pad %u is now %02x", Pad, Buttons);
+*******************************************************************************/
+
+#ifndef DK_LOG_H
+#define DK_LOG_H
+
+
+/* If this macro is zero, log calls compile to nothing. */
+#ifndef DK_LOG_ENABLED
+  #define DK_LOG_ENABLED  1
+#endif
+
+/* Size in bytes of the log ring.  Must be a power of two no larger than
+   128.  A quarter of that on the PIC18F4550, which has little RAM outside its
+   USB banks; 32 bytes still hold two records of the longest kind. */
+#ifndef DK_LOG_RING_SIZE
+  #ifdef __18F4550
+    #define DK_LOG_RING_SIZE  32
+  #else
+    #define DK_LOG_RING_SIZE  128
+  #endif
+#endif
+
+/* Zero for sources that do not number themselves.  DK_Log.py refuses to
+   build a table with two calls at the same identity. */
+#ifndef DK_LOG_FILE
+  #define DK_LOG_FILE  0
+#endif
+
+/* The identity of the call site this is expanded at. */
+#define DK_LOG_IDENTITY\
+  ((unsigned short)(((unsigned short)DK_LOG_FILE << 11) | __LINE__))
+
+/* An argument's size code: 0 for one byte, 1 for two, 2 for four. */
+#define DK_LOG_SIZE( Argument )\
+  (sizeof(Argument) == 1 ? 0 : (sizeof(Argument) == 2 ? 1 : 2))
+
+/* A record's argument byte: the argument count in bits zero and one, then
+   each argument's size code, two bits apiece. */
+#define DK_LOG_ARGUMENTS( Count, A, B, C )\
+  ((unsigned char)((Count) | (A) << 2 | (B) << 4 | (C) << 6))
+
+
+#if DK_LOG_ENABLED
+  #define DK_Log0( Format );\
+    DK_LogWrite0( DK_LOG_IDENTITY );
+
+  #define DK_Log1( Format, A );\
+    DK_LogWrite1( DK_LOG_IDENTITY,\
+                  DK_LOG_ARGUMENTS(1, DK_LOG_SIZE(A), 0, 0),\
+                  (unsigned long)(A) );
+
+  #define DK_Log2( Format, A, B );\
+    DK_LogWrite( DK_LOG_IDENTITY,\
+                 DK_LOG_ARGUMENTS(2, DK_LOG_SIZE(A), DK_LOG_SIZE(B), 0),\
+                 (unsigned long)(A), (unsigned long)(B), 0 );
+
+  #define DK_Log3( Format, A, B, C );\
+    DK_LogWrite( DK_LOG_IDENTITY,\
+                 DK_LOG_ARGUMENTS( 3, DK_LOG_SIZE(A), DK_LOG_SIZE(B),\
+                                   DK_LOG_SIZE(C) ),\
+                 (unsigned long)(A), (unsigned long)(B), (unsigned long)(C) );
+#else
+  #define DK_Log0( Format ); /* */
+  #define DK_Log1( Format, A ); /* */
+  #define DK_Log2( Format, A, B ); /* */
+  #define DK_Log3( Format, A, B, C ); /* */
+#endif
+
+
+void DK_LogWrite0( unsigned short Identity );
+void DK_LogWrite1( unsigned short Identity,
+                   unsigned char Arguments,
+                   unsigned long A );
+void DK_LogWrite( unsigned short Identity,
+                  unsigned char Arguments,
+                  unsigned long A,
+                  unsigned long B,
+                  unsigned long C );
+unsigned char DK_LogDrain( signed (* pSend)( unsigned char Byte ) );
+unsigned long DK_LogGetDrops(void);
+
+
+#endif /* DK_LOG_H */
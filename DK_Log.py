@@ -0,0 +1,277 @@
+#!/usr/bin/env python3
+"""
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+Renders the deferred format log.  The firmware stores only each log call's
+identity and raw arguments (see DK_Log.h); the format strings live here, in a
+table collected from the source at build time.
+
+  table   Scans the sources for DK_LOG_FILE and every DK_Log0 through DK_Log3
+          and DK_Assert call, and prints one line per call site:
+          "<identity> <file>:<line> <format>", separated by tabs.  Fails if two
+          call sites share an identity, a file number is out of range, a file
+          is too long, or a format uses a conversion the log cannot store.
+  decode  Reads the log as drained from the firmware, from a file or standard
+          input, and prints each record as "<file>:<line>: <text>".
+
+Usage: DK_Log.py table source ...
+       DK_Log.py decode table [log]
+"""
+
+import re
+import sys
+
+
+# The identity's layout, as given by DK_LOG_IDENTITY in DK_Log.h.
+FILE_SHIFT = 11
+FILE_MAXIMUM = 31
+LINE_LIMIT = 1 << FILE_SHIFT
+
+# What DK_Assert logs in place of its condition.
+ASSERT_FORMAT = "Assertion occured: (%s)"
+
+# A printf conversion: flags, width, precision, length, and conversion.
+CONVERSION = re.compile(r"%([-+ #0]*)(\d*)(\.\d+)?(hh|h|ll|l)?(.)")
+CONVERSIONS = "diuxXoc%"
+
+ESCAPES = {"n": "\n", "t": "\t", "r": "\r", "a": "\a", "b": "\b", "f": "\f",
+           "v": "\v", "\\": "\\", "'": "'", '"': '"', "?": "?"}
+
+
+def StripComments(Text):
+  """Returns C source with its comments blanked, keeping its lines and string
+  literals."""
+
+  return re.sub(r'/\*.*?\*/|//[^\n]*|"(?:\\.|[^"\\\n])*"|\'(?:\\.|[^\'\\\n])*\'',
+                lambda Match: Match.group(0) if Match.group(0)[0] in "\"'"
+                else "\n" * Match.group(0).count("\n"),
+                Text, flags=re.S)
+
+
+def Balanced(Text, Start):
+  """Returns the text between the parenthesis at Start and its match."""
+
+  Depth = 0
+
+  for Index in range(Start, len(Text)):
+    if Text[Index] == "(":
+      Depth += 1
+    elif Text[Index] == ")":
+      Depth -= 1
+
+      if Depth == 0:
+        return Text[Start + 1:Index]
+
+  return None
+
+
+def Unescape(Literal):
+  """Returns the characters of a C string literal's body."""
+
+  return re.sub(r"\\(x[0-9a-fA-F]+|[0-7]{1,3}|.)",
+                lambda Match: chr(int(Match.group(1)[1:], 16))
+                if Match.group(1)[0] == "x"
+                else chr(int(Match.group(1), 8)) if Match.group(1)[0].isdigit()
+                else ESCAPES.get(Match.group(1), Match.group(1)),
+                Literal)
+
+
+def Scan(Path):
+  """Returns a list of (identity, line, format) for a source file's call sites,
+  raising ValueError if one cannot be logged."""
+
+  with open(Path, newline="") as Source:
+    Text = StripComments(Source.read().replace("\r\n", "\n"))
+
+  Match = re.search(r"^\s*#\s*define\s+DK_LOG_FILE\s+(\d+)", Text, re.M)
+  Number = int(Match.group(1)) if Match else 0
+
+  if Number > FILE_MAXIMUM:
+    raise ValueError("%s: DK_LOG_FILE %d exceeds %d"
+                     % (Path, Number, FILE_MAXIMUM))
+
+  Result = []
+
+  for Call in re.finditer(r"\b(DK_Log([0-3])|DK_Assert)\s*\(", Text):
+    Line = Text.count("\n", 0, Call.start()) + 1
+    Where = "%s:%d" % (Path, Line)
+
+    # The macros' own definitions.
+    if re.search(r"#\s*define\s+$", Text[:Call.start()].rsplit("\n", 1)[-1]):
+      continue
+
+    if Call.group(1) == "DK_Assert":
+      Condition = Balanced(Text, Call.end() - 1)
+      Format = ASSERT_FORMAT % " ".join(Condition.split())
+      Count = 0
+    else:
+      Literals = re.match(r'[ \t]*((?:"(?:\\.|[^"\\])*"[ \t]*)+)',
+                          Text[Call.end():])
+
+      if not Literals:
+        raise ValueError("%s: the format must be a string literal on the "
+                         "call's line" % Where)
+
+      Format = Unescape("".join(re.findall(r'"((?:\\.|[^"\\])*)"',
+                                           Literals.group(1))))
+      Count = int(Call.group(2))
+
+    if Line >= LINE_LIMIT:
+      raise ValueError("%s: a logging file must be shorter than %d lines"
+                       % (Where, LINE_LIMIT))
+
+    Conversions = [Conversion for Conversion in CONVERSION.finditer(Format)
+                   if Conversion.group(5) != "%"]
+
+    for Conversion in Conversions:
+      if Conversion.group(5) not in CONVERSIONS:
+        raise ValueError("%s: %s cannot be logged; only integers are stored"
+                         % (Where, Conversion.group(0)))
+
+    if len(Conversions) != Count:
+      raise ValueError("%s: %d conversions for %d arguments"
+                       % (Where, len(Conversions), Count))
+
+    Result.append((Number << FILE_SHIFT | Line, Line, Format))
+
+  return Result
+
+
+def Table(Paths):
+  """Prints the format table for the sources; returns non-zero on error."""
+
+  Entries = {}
+  Numbers = {}
+
+  try:
+    for Path in Paths:
+      Sites = Scan(Path)
+
+      for Identity, Line, Format in Sites:
+        Where = "%s:%d" % (Path, Line)
+
+        if Identity in Entries:
+          raise ValueError("%s: identity %d is also %s; give each file its own "
+                           "DK_LOG_FILE" % (Where, Identity, Entries[Identity][0]))
+
+        Entries[Identity] = (Where, Format)
+
+      if Sites:
+        Number = Sites[0][0] >> FILE_SHIFT
+
+        if Number in Numbers:
+          raise ValueError("%s: DK_LOG_FILE %d is also %s's"
+                           % (Path, Number, Numbers[Number]))
+
+        Numbers[Number] = Path
+  except ValueError as Error:
+    sys.stderr.write("DK_Log.py: %s\n" % Error)
+    return 1
+
+  for Identity in sorted(Entries):
+    Where, Format = Entries[Identity]
+    print("%d\t%s\t%s" % (Identity, Where, Format.encode("unicode_escape")
+                                                 .decode("ascii")))
+
+  return 0
+
+
+def ReadTable(Path):
+  """Returns a dictionary of identity to (file:line, format) from a table."""
+
+  Entries = {}
+
+  with open(Path) as Lines:
+    for Line in Lines:
+      Identity, Where, Format = Line.rstrip("\n").split("\t", 2)
+      Entries[int(Identity)] = (Where, Format.encode("ascii")
+                                .decode("unicode_escape"))
+
+  return Entries
+
+
+def Render(Format, Arguments):
+  """Returns a format applied to a record's (value, size) arguments."""
+
+  Values = iter(Arguments)
+
+  def Convert(Conversion):
+    Flags, Width, Precision, _, Kind = Conversion.groups()
+
+    if Kind == "%":
+      return "%"
+
+    Value, Size = next(Values)
+
+    if Kind in "di" and Value >= 1 << (Size * 8 - 1):
+      Value -= 1 << (Size * 8)
+    elif Kind == "c":
+      Value = chr(Value & 0xFF)
+
+    return ("%" + Flags + Width + (Precision or "")
+            + {"i": "d", "u": "d"}.get(Kind, Kind)) % Value
+
+  return CONVERSION.sub(Convert, Format)
+
+
+def Decode(TablePath, LogPath):
+  """Prints the records of a drained log; returns non-zero if the log ends
+  mid record."""
+
+  Entries = ReadTable(TablePath)
+
+  if LogPath is None:
+    Log = sys.stdin.buffer.read()
+  else:
+    with open(LogPath, "rb") as File:
+      Log = File.read()
+
+  At = 0
+
+  while At < len(Log):
+    if At + 3 > len(Log):
+      print("# the log ends mid record")
+      return 1
+
+    Identity = Log[At] | Log[At + 1] << 8
+    Count = Log[At + 2] & 0x03
+    Sizes = [1 << ((Log[At + 2] >> (2 + Index * 2)) & 0x03)
+             for Index in range(Count)]
+    At += 3
+
+    if At + sum(Sizes) > len(Log):
+      print("# the log ends mid record")
+      return 1
+
+    Arguments = []
+
+    for Size in Sizes:
+      Arguments.append((int.from_bytes(Log[At:At + Size], "little"), Size))
+      At += Size
+
+    if Identity not in Entries:
+      print("# unknown identity %d (file %d, line %d): %s"
+            % (Identity, Identity >> FILE_SHIFT, Identity & (LINE_LIMIT - 1),
+               " ".join(str(Value) for Value, _ in Arguments)))
+      continue
+
+    Where, Format = Entries[Identity]
+    print("%s: %s" % (Where, Render(Format, Arguments)))
+
+  return 0
+
+
+def main(Arguments):
+  if len(Arguments) >= 2 and Arguments[0] == "table":
+    return Table(Arguments[1:])
+
+  if len(Arguments) in (2, 3) and Arguments[0] == "decode":
+    return Decode(Arguments[1], Arguments[2] if len(Arguments) == 3 else None)
+
+  sys.stderr.write("\n".join(__doc__.strip().splitlines()[-2:]) + "\n")
+  return 1
+
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv[1:]))
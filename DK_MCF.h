@@ -0,0 +1,117 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the ColdFire peripheral registers used by the kernel and the
+demonstration.  It is included by both C and DK_ISR_ColdFire.S, so everything
+outside of the __ASSEMBLER__ check must be a plain number.
+
+Two boards are supported: the M52233DEMO itself, and QEMU's mcf5208evb machine
+when DK_QEMU is also defined.  The MCF5208's PIT, interrupt controller, and UART
+are laid out like the MCF52233's, but live at different addresses and the PIT
+raises a different interrupt source.
+*******************************************************************************/
+
+#ifndef DK_MCF_H
+#define DK_MCF_H
+
+
+#ifdef DK_QEMU
+/* Peripheral base addresses. */
+#define DK_MCF_PIT0   0xFC080000
+#define DK_MCF_INTC0  0xFC048000
+#define DK_MCF_UART0  0xFC060000
+
+/* PIT0 is interrupt source four.  The MCF5208 interrupt control registers hold
+   only the level, six. */
+#define DK_MCF_PIT0_SOURCE  4
+#define DK_MCF_PIT0_ICR     0x06
+
+#else
+/* Internal peripheral system base address, as left by reset. */
+#define DK_MCF_IPSBAR 0x40000000
+
+/* Peripheral base addresses. */
+#define DK_MCF_PIT0   (DK_MCF_IPSBAR + 0x150000)
+#define DK_MCF_INTC0  (DK_MCF_IPSBAR + 0x000C00)
+#define DK_MCF_UART0  (DK_MCF_IPSBAR + 0x000200)
+#define DK_MCF_GPIO   (DK_MCF_IPSBAR + 0x100000)
+
+/* PIT0 is interrupt source 55.  Level six, maximum priority.  The scheduler
+   clock interrupt should not be configured to unmaskable, level seven, as
+   doing this removes the ability to atomicly disable all interrupts. */
+#define DK_MCF_PIT0_SOURCE  55
+#define DK_MCF_PIT0_ICR     0x37
+#endif
+
+
+/* The exception vector taken for the scheduler clock.  Interrupt controller
+   zero's sources begin at vector 64. */
+#define DK_MCF_PIT0_VECTOR  (64 + DK_MCF_PIT0_SOURCE)
+
+/* Scheduler clock control and status register. */
+#define DK_MCF_PIT0_PCSR_ADDRESS  (DK_MCF_PIT0 + 0x0)
+
+/* PIT0's bit in the interrupt mask and interrupt force registers.  Sources 32
+   through 63 are in the high registers. */
+#if DK_MCF_PIT0_SOURCE >= 32
+  #define DK_MCF_PIT0_IMR_ADDRESS     (DK_MCF_INTC0 + 0x08)
+  #define DK_MCF_PIT0_INTFRC_ADDRESS  (DK_MCF_INTC0 + 0x10)
+  #define DK_MCF_PIT0_BIT             (1 << (DK_MCF_PIT0_SOURCE - 32))
+#else
+  #define DK_MCF_PIT0_IMR_ADDRESS     (DK_MCF_INTC0 + 0x0C)
+  #define DK_MCF_PIT0_INTFRC_ADDRESS  (DK_MCF_INTC0 + 0x14)
+  #define DK_MCF_PIT0_BIT             (1 << DK_MCF_PIT0_SOURCE)
+#endif
+
+/* PCSR bits. */
+#define DK_MCF_PCSR_EN   0x0001
+#define DK_MCF_PCSR_PIF  0x0004
+
+
+#ifndef __ASSEMBLER__
+#define DK_MCF_REGISTER( Type, Address ) (*(volatile Type *)(Address))
+
+/* Programmable interrupt timer zero, the scheduler clock. */
+#define MCF_PIT0_PCSR   DK_MCF_REGISTER(unsigned short, DK_MCF_PIT0 + 0x0)
+#define MCF_PIT0_PMR    DK_MCF_REGISTER(unsigned short, DK_MCF_PIT0 + 0x2)
+#define MCF_PIT0_PCNTR  DK_MCF_REGISTER(unsigned short, DK_MCF_PIT0 + 0x4)
+
+/* Interrupt controller zero. */
+#define MCF_INTC0_IMRH         DK_MCF_REGISTER(unsigned long, DK_MCF_INTC0 + 0x08)
+#define MCF_INTC0_IMRL         DK_MCF_REGISTER(unsigned long, DK_MCF_INTC0 + 0x0C)
+#define MCF_INTC0_ICR(Source)  DK_MCF_REGISTER(unsigned char,\
+                                               DK_MCF_INTC0 + 0x40 + (Source))
+#define MCF_INTC_IMRL_MASKALL  0x00000001
+
+#define DK_MCF_PIT0_IMR     DK_MCF_REGISTER(unsigned long, DK_MCF_PIT0_IMR_ADDRESS)
+#define DK_MCF_PIT0_INTFRC  DK_MCF_REGISTER(unsigned long,\
+                                            DK_MCF_PIT0_INTFRC_ADDRESS)
+
+/* UART zero, the console. */
+#define MCF_UART0_UMR   DK_MCF_REGISTER(unsigned char, DK_MCF_UART0 + 0x00)
+#define MCF_UART0_USR   DK_MCF_REGISTER(unsigned char, DK_MCF_UART0 + 0x04)
+#define MCF_UART0_UCSR  DK_MCF_REGISTER(unsigned char, DK_MCF_UART0 + 0x04)
+#define MCF_UART0_UCR   DK_MCF_REGISTER(unsigned char, DK_MCF_UART0 + 0x08)
+#define MCF_UART0_URB   DK_MCF_REGISTER(unsigned char, DK_MCF_UART0 + 0x0C)
+#define MCF_UART0_UTB   DK_MCF_REGISTER(unsigned char, DK_MCF_UART0 + 0x0C)
+#define MCF_UART0_UBG1  DK_MCF_REGISTER(unsigned char, DK_MCF_UART0 + 0x18)
+#define MCF_UART0_UBG2  DK_MCF_REGISTER(unsigned char, DK_MCF_UART0 + 0x1C)
+#define MCF_UART_USR_RXRDY  0x01
+#define MCF_UART_USR_TXRDY  0x04
+
+#ifndef DK_QEMU
+/* General purpose I/O.  The demonstration's LEDs are on port TC and the NES
+   controller is on port TA. */
+#define MCF_GPIO_PORTTA  DK_MCF_REGISTER(unsigned char, DK_MCF_GPIO + 0x0E)
+#define MCF_GPIO_PORTTC  DK_MCF_REGISTER(unsigned char, DK_MCF_GPIO + 0x0F)
+#define MCF_GPIO_DDRTA   DK_MCF_REGISTER(unsigned char, DK_MCF_GPIO + 0x26)
+#define MCF_GPIO_DDRTC   DK_MCF_REGISTER(unsigned char, DK_MCF_GPIO + 0x27)
+#define MCF_GPIO_SETTA   DK_MCF_REGISTER(unsigned char, DK_MCF_GPIO + 0x36)
+#define MCF_GPIO_PTAPAR  DK_MCF_REGISTER(unsigned char, DK_MCF_GPIO + 0x6E)
+#define MCF_GPIO_PTCPAR  DK_MCF_REGISTER(unsigned char, DK_MCF_GPIO + 0x6F)
+#define MCF_GPIO_PUAPAR  DK_MCF_REGISTER(unsigned char, DK_MCF_GPIO + 0x71)
+#endif /* DK_QEMU */
+#endif /* __ASSEMBLER__ */
+
+#endif /* DK_MCF_H */
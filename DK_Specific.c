@@ -5,9 +5,39 @@ Stephen Niedzielski
 This file contains all USB source for the PIC18F4550.
 *******************************************************************************/
 
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  2
+
 #include "DK_Global.h"
 
 
+#ifdef DK_POSIX
+/* The host scheduler clock.  it_interval holds the configured period and
+   it_value the time remaining until the next rollover. */
+static struct itimerval SchedulerClock = {{0, 0}, {0, 0}};
+#endif
+
+#if defined(DK_POSIX) && defined(DK_ONE_SHOT_SLICE)
+/* When the current slice is due to end.  Slices are measured from here
+   rather than from when the signal is handled. */
+static struct timespec SchedulerDeadline = {0, 0};
+#endif
+
+/* Set by DK_InvokeScheduler so that DK_ReloadSchedulerClock starts the next
+   slice from now rather than from the last rollover. */
+static volatile unsigned char SchedulerInvoked = FALSE;
+
+/* Length of the scheduler clock's current period in counts. */
+static unsigned long SchedulerPeriod = DK_SCHEDULER_CLOCK_QUANTUM;
+
+#ifdef M52233DEMO
+/* Storage carved into individual task stacks by DK_InitializeTask. */
+unsigned char DK_MasterStack[DK_MASTER_STACK_SIZE] __attribute__((aligned(4)));
+
+static void DK_TaskExit(void);
+#endif
+
+
 signed DK_InitializeSchedulerClock(void)
 {
 /* Initializes the scheduler clock.  Called by dk_InitializeScheduler.
@@ -17,10 +47,6 @@ signed DK_InitializeSchedulerClock(void)
 
   signed Result = 0;
 
-  unsigned char Prescaler = 0;
-  
-  unsigned short Modulo = 0;
-
   #ifdef __18F4550
   /*  Configure scheduler clock.
       7: TMR0ON     0
@@ -57,127 +83,97 @@ signed DK_InitializeSchedulerClock(void)
          0: EN           0 */
   MCF_PIT0_PCSR = (unsigned short)(0x001E);
 
-  /* Configure interrupt.  Interrupt controller zero, level six, maximum
-     priority.  The scheduler clock interrupt should not be configured to
-     unmaskable, level seven, as doing this removes the ability to atomicly
-     disable all interrupts. */
-  MCF_INTC0_ICR55 =  0x37;
+  /* Configure interrupt.  Interrupt controller zero, level six (see
+     DK_MCF.h). */
+  MCF_INTC0_ICR(DK_MCF_PIT0_SOURCE) = DK_MCF_PIT0_ICR;
   
-  /* Unmask interrupt. */
-  MCF_INTC0_IMRH &= ~0x00800000;
+  /* Unmask interrupt, and the interrupt controller as a whole. */
+  DK_MCF_PIT0_IMR &= ~DK_MCF_PIT0_BIT;
+  MCF_INTC0_IMRL &= ~MCF_INTC_IMRL_MASKALL;
   #endif
 
-  /* Calculate the prescale and modulo for the quantum specified. */
-  Result = DK_CalculatePrescaleAndModulo
-           (
-             (DK_QUANTUM),
-             &Prescaler,
-             &Modulo
-           );
-  DK_Assert(Result != DK_SUCCESS);
-  
-  /* Initialize the clock to the prescale and modulo found. */
-  Result = DK_ConfigureSchedulerClock(Prescaler, Modulo);
+  #ifdef DK_POSIX
+  {
+    struct sigaction Action;
+
+    /* Configure interrupt.  Each kernel signal masks all of the others while
+       it is handled, just as the PIC18 vector clears GIE on entry. */
+    sigemptyset(&DK_InterruptSignals);
+    sigaddset(&DK_InterruptSignals, SIGALRM);
+    sigaddset(&DK_InterruptSignals, SIGUSR1);
+
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = DK_ISR_SchedulerClock;
+    Action.sa_mask = DK_InterruptSignals;
+    Action.sa_flags = SA_RESTART;
+
+    sigaction(SIGALRM, &Action, 0);
+    sigaction(SIGUSR1, &Action, 0);
+  }
+  #endif
+
+  /* Initialize the clock to the prescale and modulo for the quantum
+     specified, which were calculated at compile time. */
+  Result = DK_ConfigureSchedulerClock( DK_SCHEDULER_CLOCK_PRESCALER,
+                                       DK_SCHEDULER_CLOCK_MODULO );
   DK_Assert(Result != DK_SUCCESS);
 
   return Result;
 }
 
 
-signed DK_CalculatePrescaleAndModulo( double Duration,
+signed DK_CalculatePrescaleAndModulo( unsigned long Microseconds,
                                       unsigned char * pPrescaler,
                                       unsigned short * pModulo )
 {
 /* Determines the scheduler clock prescale and modulo for the length of time
-   specified in seconds by Duration.  The final result is truncated down to
-   integer form to fit in a short.
-  
+   specified in microseconds.  The result is truncated down to the nearest
+   clock count.  Only integer arithmetic is used, so this may be called at run
+   time to change the quantum without pulling in the floating point library.
+   The boot time quantum is calculated at compile time instead; see
+   DK_SCHEDULER_CLOCK_PRESCALER.
+
    Parameters:
-   Duration   Length of time to calculate prescale and modulo for in quantum.
-              Value must be greater than zero.
-   pPrescale  The storage location for the prescale result.
-   pModulo    The storage location for the modulo result.
+   Microseconds  Length of time to calculate prescale and modulo for.
+   pPrescaler    The storage location for the prescale result.
+   pModulo       The storage location for the modulo result.
 
    Result:
-   DK_SUCCESS if successful. */
+   DK_SUCCESS if successful, 0 if the time cannot be represented. */
 
   signed Result = 0;
   unsigned char Prescaler = 0;
-  double Modulo = 0.0;
 
-  #ifdef __18F4550
-  /* Solving for modulo:
-     Multiply duration by the constants to remove them from future
-     calculations. */
-  Modulo = -Duration * DK_SYSTEM_CLOCK_HZ / (4 * 2);  
-  
-  /* Account for the first pass, which should really be division by 2^0. */
-  Modulo *= 2;
-  
-  /* Find the correct modulo for the smallest prescaler.  Each pass increments
-     Prescaler (2^Prescaler), and thus halves modulo, according to the
-     formula. */
-  while( Prescaler < (unsigned)8 /* The highest prescaler is 7. */ )
+  /* Clock counts at the smallest prescaler.  Split at the millisecond to
+     avoid overflow. */
+  unsigned long Counts
+    = (Microseconds / 1000) * DK_SCHEDULER_CLOCK_COUNTS_PER_MS
+      + (Microseconds % 1000) * DK_SCHEDULER_CLOCK_COUNTS_PER_MS / 1000;
+
+  /* Find the smallest prescaler whose counts fit the modulo register.  Each
+     pass doubles the prescaler, and thus halves the counts. */
+  while( Prescaler <= (unsigned)DK_SCHEDULER_CLOCK_PRESCALER_MAXIMUM )
   {
-    /* Halve the modulo. */
-    Modulo /= 2;
-  
-    /* Make sure the Modulo can fit within the constraints of the 16 bit
-       register. */
-    if( Modulo >= -(65535 + 2 * 4) &&
-        Modulo <= -(2 * 4) )
+    if( Counts <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM )
     {
-      Modulo += 65535 + 2 * 4;
+      /* A larger prescaler would only make a short time shorter. */
+      if( Counts >= DK_SCHEDULER_CLOCK_COUNTS_MINIMUM )
+      {
+        /* We have a winner. */
+        Result = DK_SUCCESS;
 
-      /* We have a winner. */
-      Result = DK_SUCCESS;
-      
-      /* Store the results. */
-      *pPrescaler = Prescaler;
-      *pModulo = (unsigned short)Modulo;
-      
-      break;
-    }
+        /* Store the results. */
+        *pPrescaler = Prescaler;
+        *pModulo = (unsigned short)DK_SchedulerClockModulo(Counts);
+      }
 
-    ++Prescaler;
-  } /* End while. */
-  #endif
-  
-  #ifdef M52233DEMO
-  /* Task Duration = (2^Prescaler * 4 * Modulo) / Clock Frequency;
-     Solving for modulo:
-     Multiply duration by the constants to remove them from future
-     calculations. */
-  Modulo = Duration * SYSTEM_CLOCK * 1000000 / 4;
-  
-  /* Account for the first pass, which should really be division by 2^0. */
-  Modulo *= 2;
-  
-  /* Find the correct modulo for the smallest prescaler.  Each pass increments
-     Prescaler (2^Prescaler), and thus halves modulo, according to the
-     formula. */
-  while( Prescaler < 16 /* The highest prescaler is 15. */ )
-  {
-    /* Halve the modulo. */
-    Modulo /= 2;
-  
-    /* Make sure the ModuloGuess can fit within the constraints of a short. */
-    if( (unsigned)Modulo <= ((unsigned short)(-1)) /* Capacity of short type. */ )
-    {
-      /* We have a winner. */
-      Result = DK_SUCCESS; /* Result = success. */
-      
-      /* Store the results. */
-      *pPrescale = Prescaler;
-      *pModulo = (unsigned short)Modulo;
-      
       break;
     }
 
+    Counts >>= 1;
     ++Prescaler;
   } /* End while. */
-  #endif
-  
+
   return Result;
 }
 
@@ -222,10 +218,272 @@ signed DK_ConfigureSchedulerClock( unsigned char Prescaler,
   MCF_PIT0_PMR = Modulo;
   #endif
 
+  #ifdef DK_POSIX
+  {
+    long Microseconds = (long)Modulo << Prescaler;
+
+    SchedulerClock.it_interval.tv_sec = Microseconds / 1000000;
+    SchedulerClock.it_interval.tv_usec = Microseconds % 1000000;
+
+    /* Reset the current timer count to the specified period. */
+    SchedulerClock.it_value = SchedulerClock.it_interval;
+  }
+  #endif
+
   return DK_SUCCESS;
 }
 
 
+signed DK_ReloadSchedulerClock( unsigned long Counts,
+                                unsigned long * pElapsed )
+{
+/* Programs the scheduler clock to next interrupt Counts clock counts (at
+   DK_SCHEDULER_CLOCK_PRESCALER) after its last rollover.  The counts that
+   elapsed between the rollover and this call are taken from the new period, so
+   interrupt latency does not accumulate from one period to the next.  If the
+   scheduler was invoked by DK_InvokeScheduler, there was no rollover and the
+   period starts now.  Called by DK_Scheduler with interrupts disabled.
+
+   Parameters:
+   Counts    Length of the next period.  Must be no greater than
+             DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM.
+   pElapsed  The storage location for the number of counts the period just
+             ended lasted: the whole period after a rollover, or however much
+             of it had passed when the scheduler was invoked.  Kernel time is
+             advanced by this.
+
+   Result:
+   DK_SUCCESS if successful. */
+
+  /* After a rollover the whole period has passed.  An early end is measured
+     below, before the clock is restarted. */
+  *pElapsed = SchedulerPeriod;
+
+  #ifdef __18F4550
+  {
+    unsigned short Elapsed = 0;
+
+    if(SchedulerInvoked == FALSE)
+    {
+      /* TMR0 has counted on from zero since the rollover.  Reading TMR0L
+         latches TMR0H. */
+      Elapsed = TMR0L;
+      Elapsed |= (unsigned short)TMR0H << 8;
+    }
+    else
+    {
+      *pElapsed = DK_ReadSchedulerClock();
+    }
+
+    Elapsed += DK_SCHEDULER_CLOCK_RELOAD_LAG;
+
+    /* TMR0 interrupts on rolling over from 0xFFFF, so load it Counts short of
+       the rollover, less what has elapsed.  Writing TMR0L writes both. */
+    Elapsed -= (unsigned short)Counts;
+    TMR0H = (Elapsed >> 8) & 255;
+    TMR0L = Elapsed & 255;
+  }
+  #endif
+
+  #ifdef M52233DEMO
+  #ifndef DK_ONE_SHOT_SLICE
+  /* PIT0 reloads itself exactly on every rollover, so a period only needs
+     restarting after DK_InvokeScheduler.  OVW is set, so writing the modulo
+     restarts the count. */
+  if(SchedulerInvoked != FALSE)
+  {
+    *pElapsed = DK_ReadSchedulerClock();
+    MCF_PIT0_PMR = (unsigned short)(Counts - 1);
+  }
+  #else
+  {
+    unsigned short Elapsed = 0;
+
+    if(SchedulerInvoked == FALSE)
+    {
+      /* PIT0 has counted down from its modulo since it reloaded. */
+      Elapsed = MCF_PIT0_PMR - MCF_PIT0_PCNTR;
+    }
+    else
+    {
+      *pElapsed = DK_ReadSchedulerClock();
+    }
+
+    Elapsed += DK_SCHEDULER_CLOCK_RELOAD_LAG;
+
+    /* OVW is set, so the new modulo is loaded into the counter at once.  It is
+       reloaded again at the next rollover, but by then this function has been
+       called again. */
+    if(Counts > (unsigned long)Elapsed + 1)
+    {
+      MCF_PIT0_PMR = (unsigned short)(Counts - Elapsed - 1);
+    }
+    else
+    {
+      MCF_PIT0_PMR = 0;
+    }
+  }
+  #endif /* DK_ONE_SHOT_SLICE */
+  #endif
+
+  /* The host's periodic interval timer reloads itself exactly.  Restarting it
+     after DK_InvokeScheduler would cost two system calls per yield, so it is
+     only reprogrammed for one-shot slices. */
+  #if defined(DK_POSIX) && defined(DK_ONE_SHOT_SLICE)
+  {
+    struct timespec Now;
+    long Nanoseconds = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+
+    /* Start from the old deadline unless the scheduler was invoked early or
+       the clock was never started. */
+    if( SchedulerInvoked != FALSE || SchedulerDeadline.tv_sec == 0 )
+    {
+      if(SchedulerInvoked != FALSE)
+      {
+        *pElapsed = DK_ReadSchedulerClock();
+      }
+
+      SchedulerDeadline = Now;
+    }
+
+    SchedulerDeadline.tv_nsec += (long)(Counts << DK_SCHEDULER_CLOCK_PRESCALER)
+                                 * 1000;
+    SchedulerDeadline.tv_sec += SchedulerDeadline.tv_nsec / 1000000000;
+    SchedulerDeadline.tv_nsec %= 1000000000;
+
+    Nanoseconds = (SchedulerDeadline.tv_sec - Now.tv_sec) * 1000000000
+                  + (SchedulerDeadline.tv_nsec - Now.tv_nsec);
+
+    /* If the deadline has already passed, the clock was stopped or the
+       process was not run for a whole period.  Start over from now rather than
+       interrupting repeatedly to catch up. */
+    if(Nanoseconds <= 0)
+    {
+      Nanoseconds = (long)(Counts << DK_SCHEDULER_CLOCK_PRESCALER) * 1000;
+
+      SchedulerDeadline.tv_sec = Now.tv_sec + Nanoseconds / 1000000000;
+      SchedulerDeadline.tv_nsec = Now.tv_nsec + Nanoseconds % 1000000000;
+      SchedulerDeadline.tv_sec += SchedulerDeadline.tv_nsec / 1000000000;
+      SchedulerDeadline.tv_nsec %= 1000000000;
+    }
+
+    /* Each period is armed individually; the interval is left zero. */
+    SchedulerClock.it_interval.tv_sec = 0;
+    SchedulerClock.it_interval.tv_usec = 0;
+    SchedulerClock.it_value.tv_sec = Nanoseconds / 1000000000;
+    SchedulerClock.it_value.tv_usec = (Nanoseconds % 1000000000) / 1000;
+    setitimer(ITIMER_REAL, &SchedulerClock, 0);
+  }
+  #endif
+
+  #if defined(DK_POSIX) && !defined(DK_ONE_SHOT_SLICE)
+  /* The period carries on through an early invocation, so none of it has
+     ended. */
+  if(SchedulerInvoked != FALSE)
+  {
+    *pElapsed = 0;
+  }
+  #endif
+
+  SchedulerPeriod = Counts;
+  SchedulerInvoked = FALSE;
+
+  return DK_SUCCESS;
+}
+
+
+unsigned long DK_ReadSchedulerClock(void)
+{
+/* Reads how far the scheduler clock has counted into its current period.
+   A rollover that has not been handled yet is included, so the result only
+   grows until DK_ReloadSchedulerClock starts the next period.  Call with
+   interrupts disabled.  Within the scheduler clock interrupt itself the
+   rollover may already have been acknowledged, so the result is only
+   meaningful once DK_ReloadSchedulerClock has returned.
+
+   Result:
+   Scheduler clock counts, at DK_SCHEDULER_CLOCK_PRESCALER, since the period
+   began. */
+
+  unsigned long Elapsed = 0;
+
+  #ifdef __18F4550
+  {
+    /* TMR0 was loaded the length of the period short of rolling over, so the
+       counts since the period began are its distance from that start.  Past a
+       rollover the subtraction wraps, which adds the period back in.  Reading
+       TMR0L latches TMR0H. */
+    unsigned short Count = TMR0L;
+    Count |= (unsigned short)TMR0H << 8;
+
+    Elapsed = (unsigned short)(Count + (unsigned short)SchedulerPeriod);
+  }
+  #endif
+
+  #ifdef M52233DEMO
+  {
+    unsigned short Count = MCF_PIT0_PCNTR;
+
+    if( (MCF_PIT0_PCSR & DK_MCF_PCSR_PIF) != 0 )
+    {
+      /* PIT0 has rolled over and counts down from its modulo again.  Read the
+         counter again in case it rolled over after the first read. */
+      Count = MCF_PIT0_PCNTR;
+      Elapsed = SchedulerPeriod + (unsigned short)(MCF_PIT0_PMR - Count);
+    }
+    else
+    {
+      /* The modulo may have been shortened to compensate for latency, but the
+         period always ends at zero. */
+      Elapsed = SchedulerPeriod - 1 - Count;
+    }
+  }
+  #endif
+
+  #ifdef DK_POSIX
+  {
+    long Microseconds = 0;
+
+    #ifdef DK_ONE_SHOT_SLICE
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+
+    /* Counted back from the deadline, which may have passed.  There is no
+       deadline until the first slice has been programmed. */
+    if(SchedulerDeadline.tv_sec != 0)
+    {
+      Microseconds = (long)(SchedulerPeriod << DK_SCHEDULER_CLOCK_PRESCALER)
+                     - (SchedulerDeadline.tv_sec - Now.tv_sec) * 1000000
+                     - (SchedulerDeadline.tv_nsec - Now.tv_nsec) / 1000;
+    }
+    #else
+    struct itimerval Remaining;
+
+    /* Linux only rearms the interval timer when its signal is delivered, so
+       while the signal is held off the timer reads zero and the period reads
+       as complete. */
+    getitimer(ITIMER_REAL, &Remaining);
+
+    Microseconds = (SchedulerClock.it_interval.tv_sec
+                    - Remaining.it_value.tv_sec) * 1000000
+                   + (SchedulerClock.it_interval.tv_usec
+                      - Remaining.it_value.tv_usec);
+    #endif
+
+    if(Microseconds > 0)
+    {
+      Elapsed = (unsigned long)Microseconds >> DK_SCHEDULER_CLOCK_PRESCALER;
+    }
+  }
+  #endif
+
+  return Elapsed;
+}
+
+
 signed DK_InvokeScheduler(void)
 {
 /* Invokes the scheduler immediately and resets the scheduler clock.  The
@@ -234,14 +492,23 @@ signed DK_InvokeScheduler(void)
    Result:
    DK_SUCCESS if successful. */
 
+  /* The scheduler clock is restarted rather than compensated. */
+  SchedulerInvoked = TRUE;
+
   #ifdef __18F4550
   /* Set the interrupt flag. */
   INTCONbits.TMR0IF = 1;
   #endif
 
   #ifdef M52233DEMO
-   /* Force interrupt. */
-   MCF_INTC0_INTFRCH |= MCF_INTC_INTFRCH_INTFRC55;
+   /* Force interrupt.  DK_ISR_SchedulerClock withdraws the request. */
+   DK_MCF_PIT0_INTFRC |= DK_MCF_PIT0_BIT;
+  #endif
+
+  #ifdef DK_POSIX
+  /* Force interrupt.  If interrupts are disabled, the signal is held pending
+     just as TMR0IF would be. */
+  raise(SIGALRM);
   #endif
   
   return DK_SUCCESS;
@@ -249,6 +516,40 @@ signed DK_InvokeScheduler(void)
 
 
 
+unsigned char DK_InterruptsEnabled(void)
+{
+/* Result:
+   TRUE if interrupts are enabled, FALSE if they are disabled, as they are in
+   an interrupt handler, DK_QuantumTrigger, or a critical section. */
+
+  #ifdef __18F4550
+  return INTCONbits.GIE;
+  #endif
+
+  #ifdef M52233DEMO
+  {
+    unsigned short Status = 0;
+
+    __asm__ volatile ( "move.w %%sr,%0" : "=d" (Status) );
+
+    /* Tasks run with the interrupt priority mask at zero.  Anything higher is
+       an interrupt handler or a critical section. */
+    return (Status & 0x0700) == 0;
+  }
+  #endif
+
+  #ifdef DK_POSIX
+  {
+    sigset_t Mask;
+
+    sigprocmask(SIG_BLOCK, 0, &Mask);
+
+    return sigismember(&Mask, SIGALRM) == 0;
+  }
+  #endif
+}
+
+
 signed DK_StartScheduler(void)
 {
 /* Enables the scheduler, allowing it to assert itself once the current time
@@ -267,6 +568,11 @@ signed DK_StartScheduler(void)
   MCF_PIT0_PCSR |= 1;
   #endif 
 
+  #ifdef DK_POSIX
+  /* Resume counting from wherever the clock was stopped. */
+  setitimer(ITIMER_REAL, &SchedulerClock, 0);
+  #endif
+
   return DK_SUCCESS;
 }
 
@@ -288,6 +594,21 @@ signed DK_StopScheduler(void)
   /* Clear scheduler clock enable bit. */
   MCF_PIT0_PCSR &= ~0x00000001;
   #endif
+
+  #ifdef DK_POSIX
+  {
+    struct itimerval Stopped = {{0, 0}, {0, 0}},
+                     Remaining;
+
+    /* Disarm the clock, keeping whatever remains of the current period. */
+    setitimer(ITIMER_REAL, &Stopped, &Remaining);
+
+    if( Remaining.it_value.tv_sec != 0 || Remaining.it_value.tv_usec != 0 )
+    {
+      SchedulerClock.it_value = Remaining.it_value;
+    }
+  }
+  #endif
   
   return DK_SUCCESS;
 }
@@ -297,7 +618,11 @@ signed DK_InitializeTask( DK_TaskAddress Task,
                           DK_TaskState State,
                           unsigned QuantumShare )
 {
-/* Initializes a task.  This function contains a critical section.
+/* Initializes a task.  The scheduler is locked while a free task control block
+   is found and the task's first context is built, but interrupts stay enabled
+   until the task is made visible to the scheduler.  For tasks, and main before
+   DK_StartKernel, only; the watchdogs' restarts call it from the scheduler
+   clock, but never while the scheduler is locked.
 
    Parameters:
    Task     The task address.
@@ -314,13 +639,15 @@ signed DK_InitializeTask( DK_TaskAddress Task,
   /* The size of an individual task's stack space. */
   const unsigned TaskStackSize = (DK_MASTER_STACK_SIZE / DK_MAXIMUM_TASKS);
   
-  /* Enter critical section. */
-  DK_DisableInterrupts();
+  /* Keep other tasks from claiming the same task control block. */
+  DK_SchedulerLock();
   
   /* Find the next available task control block in memory.*/
   while(Count < (unsigned)DK_MAXIMUM_TASKS)
   {
-    if(TCBSegment[Count].State == DEAD)
+    /* A task killed by its watchdog keeps its block until it is restarted. */
+    if( TCBSegment[Count].State == DEAD &&
+        DK_WatchdogIsRestartPending(Count) == FALSE )
     {
       /* If dead, then TCB is free to use.  Initialize to safe values for new
          task. */
@@ -328,20 +655,25 @@ signed DK_InitializeTask( DK_TaskAddress Task,
       /* Update TaskIdentity to the current TCB number. */
       TaskIdentity = Count;
       
+      #ifdef __18F4550
       TCBSegment[TaskIdentity].StackPointer
       = DK_MASTER_STACK_START /* The beginning. */
-        + 41 /*  Number of bytes to offset to leave room for
+        + DK_CONTEXT_DATA_OFFSET /*  Number of bytes to offset to leave room for
                                     context data.*/
         + Count * TaskStackSize; /* Account for the other task's stacks. */
 
+      /* The saved frame pointer, FSR2, starts at the bottom of the task's
+         stack.  It follows WREG, STATUS, and BSR in the frame. */
       *((unsigned *)(  TCBSegment[TaskIdentity].StackPointer
-                      - 37)) = TCBSegment[TaskIdentity].StackPointer - 41;
+                      - (DK_CONTEXT_DATA_OFFSET - 4)))
+        = TCBSegment[TaskIdentity].StackPointer - DK_CONTEXT_DATA_OFFSET;
 
       
       /*  Load the task address into the program counter in the context space. */
       *((unsigned char *)(  TCBSegment[TaskIdentity].StackPointer - 1)) = 1;
       *((DK_TaskAddress *)(  TCBSegment[TaskIdentity].StackPointer
                       - 4)) = Task;
+      #endif
 
 
       #ifdef M52233DEMO
@@ -359,24 +691,70 @@ signed DK_InitializeTask( DK_TaskAddress Task,
       
       /* Load the top four bytes of the exception frame context space with a
       bonine value. */
-      *((unsigned *)(TCBSegment[TaskIdentity].StackPointer + 15 * 4 )) = 0x40002000; /* 0x41DC2004*/
+      *((unsigned *)(  TCBSegment[TaskIdentity].StackPointer
+                      + DK_STATUS_OFFSET)) = DK_INITIAL_STATUS;
+
+      /* Should the task ever return, it returns into DK_TaskExit rather than
+         into the next task's stack. */
+      *((unsigned *)(  TCBSegment[TaskIdentity].StackPointer
+                      + DK_RETURN_ADDRESS_OFFSET)) = (unsigned)DK_TaskExit;
+      #endif
+
+      #ifdef DK_POSIX
+      TCBSegment[TaskIdentity].StackPointer = Count * TaskStackSize;
+
+      /* Build a fresh context on this task's slice of the master stack.  The
+         context is restored with interrupts still disabled, since
+         swapcontext restores the signal mask before it changes stacks;
+         DK_TaskEntry enables them, as the retfie ending DK_RestoreContext
+         would. */
+      getcontext(&DK_ContextSegment[TaskIdentity]);
+      DK_ContextSegment[TaskIdentity].uc_stack.ss_sp
+        = &DK_MasterStack[Count * TaskStackSize];
+      DK_ContextSegment[TaskIdentity].uc_stack.ss_size = TaskStackSize;
+      DK_ContextSegment[TaskIdentity].uc_link = 0;
+      DK_ContextSegment[TaskIdentity].uc_sigmask = DK_InterruptSignals;
+
+      DK_TaskEntryPoint[TaskIdentity] = Task;
+      makecontext(&DK_ContextSegment[TaskIdentity], DK_TaskEntry, 0);
       #endif
 
       TCBSegment[TaskIdentity].Next = 0;
       TCBSegment[TaskIdentity].Prev = 0;
 
+      /* The time share must be in place before the task becomes visible to
+         the scheduler. */
+      TCBSegment[TaskIdentity].QuantumShare = QuantumShare;
+
+      DK_WatchdogReset(Count, Task, QuantumShare);
+
       DK_ConfigureTaskState( Count,
                              State);
-      
-      TCBSegment[TaskIdentity].QuantumShare = QuantumShare;
 
       break;
     }
     ++Count;
   }
 
-  /* Exit critical section. */
-  DK_EnableInterrupts();
+  DK_SchedulerUnlock();
   
   return TaskIdentity;
 }
+
+
+#ifdef M52233DEMO
+static void DK_TaskExit(void)
+{
+/* Entered when a task returns.  Kills the task rather than letting it run off
+   the top of its stack. */
+
+  DK_ConfigureTaskState(DK_GetRunningTaskIdentity(), DEAD);
+
+  while(1)
+  {
+    /* The task forfeits one quantum per invocation until the scheduler moves
+       on; it is never selected again. */
+    DK_InvokeScheduler();
+  }
+}
+#endif /* M52233DEMO */
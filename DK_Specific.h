@@ -11,12 +11,16 @@ dependent.
 
 
 signed DK_InitializeSchedulerClock(void);
-signed DK_CalculatePrescaleAndModulo( double Duration,
+signed DK_CalculatePrescaleAndModulo( unsigned long Microseconds,
                                       unsigned char * pPrescaler,
                                       unsigned short * pModulo );
 signed DK_ConfigureSchedulerClock( unsigned char Prescaler,
                                      unsigned short Modulo );
+signed DK_ReloadSchedulerClock( unsigned long Counts,
+                                unsigned long * pElapsed );
+unsigned long DK_ReadSchedulerClock(void);
 signed DK_InvokeScheduler(void);
+unsigned char DK_InterruptsEnabled(void);
 signed DK_StartScheduler(void);
 signed DK_StopScheduler(void);
 signed DK_InitializeTask( DK_TaskAddress Task,
@@ -26,7 +30,7 @@ void DK_QuantumTrigger(unsigned QuantumCount);
 void DK_IdleTaskHook(void);
 
 
-#ifndef __18F4550 | M52233DEMO
+#if !defined(__18F4550) && !defined(M52233DEMO) && !defined(DK_POSIX)
   #error Error: Dreamcatcher Kernel does not support this device.
 #endif
 
@@ -34,7 +38,6 @@ void DK_IdleTaskHook(void);
 #ifdef __18F4550
   #include <stdio.h>
   #include <p18f4550.h>
-  #include <usart.h>
 
 /* Dreamcatcher Kernel expects the configuration bits to be as follows:
   
@@ -54,21 +57,6 @@ void DK_IdleTaskHook(void);
 #endif
 
 
-/* Allows for a pointer that may point anywhere, hence even more dangerous than
-   the typical pointers you normally find in these parts.  I wonder what will I
-   call one of these anywhere pointers that points to type void... */
-typedef struct
-{
-  union
-  {
-    far rom unsigned char * pROM;
-    near ram unsigned char * pRAM;
-  } Anywhere;
-
-  unsigned char IsROMPointer;
-} DK_DangerousPointer;
-
-
 /* User definable.  Specifies the maximum number of tasks that will be in
    existence at any point in time.  Used to determine TCB allocation quantity
    and individual task stack size.  Must be greater than or equal to 1.  This
@@ -77,19 +65,69 @@ typedef struct
 #define DK_MAXIMUM_TASKS  (5)
 
 
-/* Master stack start.  Used to calculate stack position for each task. */
-#define DK_MASTER_STACK_START 0x100
+/* "make stacks" builds the image with DK_STACKS defined, each task's stack
+   cut to the worst case DK_Stack.py finds, and the master stack moved to the
+   top of what the data leaves below the USB banks. */
+#ifdef DK_STACKS
+  #include "DK_Stacks.h"
+#endif
+
+/* Master stack start.  Used to calculate stack position for each task.  Below
+   it is gpr0, the kernel's and drivers' first data bank; see
+   DK_LinkerScript.lkr. */
+#ifndef DK_MASTER_STACK_START
+  #define DK_MASTER_STACK_START 0x100
+#endif
 
 /* Size of the master stack. */
-#define DK_MASTER_STACK_SIZE  0x300
+#ifdef DK_STACKS
+  #define DK_MASTER_STACK_SIZE  (DK_MAXIMUM_TASKS * DK_TASK_STACK_SIZE)
+#else
+  #define DK_MASTER_STACK_SIZE  0x300
+#endif
 
 /* User definable.  A quantum is the minimum amount of time between scheduler
-   assertions. */
-#define DK_QUANTUM (0.001)
+   assertions, in microseconds. */
+#ifndef DK_QUANTUM_US
+  #define DK_QUANTUM_US (1000)
+#endif
 
 /* System clock speed in hertz. */
 #define DK_SYSTEM_CLOCK_HZ 20000000
 
+/* Scheduler clock.  TMR0 counts instruction cycles, a quarter of the system
+   clock, through a prescaler of 2^(Prescaler + 1), and interrupts when it
+   rolls over from 0xFFFF.  Reloads are short by eight counts to make up for
+   the counts lost while the interrupt is serviced and TMR0 is written. */
+#define DK_SCHEDULER_CLOCK_COUNTS_PER_MS      (DK_SYSTEM_CLOCK_HZ / 8000)
+#define DK_SCHEDULER_CLOCK_PRESCALER_MAXIMUM  7
+#define DK_SCHEDULER_CLOCK_COUNTS_MINIMUM     8
+#define DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM     65543
+#define DK_SchedulerClockModulo(Counts)       (65543 - (Counts))
+
+/* Instruction cycles between DK_ReloadSchedulerClock reading TMR0 and writing
+   it back, during which counts are lost.  Writing TMR0 also inhibits counting
+   for two more.  Measure with DK_Cycles.py if the compiler changes. */
+#define DK_SCHEDULER_CLOCK_RELOAD_CYCLES      20
+#define DK_SCHEDULER_CLOCK_RELOAD_LAG\
+  ((DK_SCHEDULER_CLOCK_RELOAD_CYCLES + 2) >> (DK_SCHEDULER_CLOCK_PRESCALER + 1))
+
+
+/* User definable.  The kernel does no floating point arithmetic, so by default
+   the math library's floating point registers (__AEXP, __BEXP, and __FPFLAGS)
+   are left out of the context frame.  If more than one task, or a task and
+   DK_QuantumTrigger, use floating point, define DK_FLOAT_CONTEXT for both the
+   compiler and the assembler. */
+#ifdef DK_FLOAT_CONTEXT
+  #define DK_CONTEXT_REGISTERS 36
+#else
+  #define DK_CONTEXT_REGISTERS 33
+#endif
+
+/* Size of a new task's context frame: the saved registers, one hardware stack
+   entry, and the hardware stack count (saved twice). */
+#define DK_CONTEXT_DATA_OFFSET (DK_CONTEXT_REGISTERS + 3 + 2)
+
 
 /* This macro is used to maximize resource use by eliminating any unneeded
    allocations between main and DK_IdleTask. */
@@ -100,31 +138,366 @@ typedef struct
                            _endasm
 
 
+/* Atomic macros for disabling or enabling interrupts in critical sections.
+   These macros do not affect the scheduler. */
+#define DK_EnableInterrupts();  _asm\
+                                  bsf INTCON, 7, 0\
+                                _endasm
+
+#define DK_DisableInterrupts(); _asm\
+                                  bcf INTCON, 7, 0\
+                                _endasm
+
+/* Macros for saving the interrupt state and disabling interrupts, then
+   restoring the state saved, used by DK_EnterCriticalSection and
+   DK_ExitCriticalSection.  Unlike the macros above, these may be used in an
+   interrupt handler. */
+typedef unsigned char DK_InterruptState;
+
+#define DK_SaveInterrupts( State ); State = INTCONbits.GIE;\
+                                    DK_DisableInterrupts();
+
+#define DK_RestoreInterrupts( State ); INTCONbits.GIE = State;
+
+#endif /* __18F4550 */
+
+
+#ifdef M52233DEMO
+  #include "DK_MCF.h"
+
+/* The ColdFire port.  Defining DK_QEMU as well retargets the peripherals to
+   QEMU's mcf5208evb machine; see DK_MCF.h. */
+
+
+/* The MCC18 storage qualifiers mean nothing on the ColdFire. */
+#define rom
+#define ram
+#define near
+#define far
+
+
+/* User definable.  Specifies the maximum number of tasks that will be in
+   existence at any point in time.  Used to determine TCB allocation quantity
+   and individual task stack size.  Must be greater than or equal to 1.  This
+   number should be made to include the idle task, so an application with one
+   task should set DK_MAXIMUM_TASKS to two. */
+#ifndef DK_MAXIMUM_TASKS
+  #define DK_MAXIMUM_TASKS  (5)
+#endif
+
+
+/* Size of the master stack.  Each task receives an equal share, which must be
+   a multiple of four. */
+#define DK_MASTER_STACK_SIZE  (DK_MAXIMUM_TASKS * 0x400)
+
+/* Master stack start.  The ColdFire stack grows down, so this is the top of
+   DK_MasterStack and each task's stack is carved out below the last. */
+#define DK_MASTER_STACK_START ((unsigned)DK_MasterStack + DK_MASTER_STACK_SIZE)
+
+/* User definable.  A quantum is the minimum amount of time between scheduler
+   assertions, in microseconds. */
+#ifndef DK_QUANTUM_US
+  #define DK_QUANTUM_US (1000)
+#endif
+
+/* System clock speed in hertz.  The PIT counts at half this rate.  On the
+   M52233DEMO, the PLL is configured for 60 MHz by the debugger before the
+   image is loaded; QEMU's mcf5208evb runs at a fixed 166.67 MHz. */
+#ifdef DK_QEMU
+  #define DK_SYSTEM_CLOCK_HZ 166666666
+#else
+  #define DK_SYSTEM_CLOCK_HZ 60000000
+#endif
+
+/* Scheduler clock.  PIT0 counts through a prescaler of 2^Prescaler and
+   interrupts after counting down through zero from its modulo. */
+#define DK_SCHEDULER_CLOCK_COUNTS_PER_MS      (DK_SYSTEM_CLOCK_HZ / 2000)
+#define DK_SCHEDULER_CLOCK_PRESCALER_MAXIMUM  15
+#define DK_SCHEDULER_CLOCK_COUNTS_MINIMUM     1
+#define DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM     65536
+#define DK_SchedulerClockModulo(Counts)       ((Counts) - 1)
+
+/* PIT counts lost between DK_ReloadSchedulerClock reading PCNTR and writing
+   PMR. */
+#define DK_SCHEDULER_CLOCK_RELOAD_LAG         (8 >> DK_SCHEDULER_CLOCK_PRESCALER)
+
+
+/* Layout of a saved context, relative to the task's stack pointer: D0-D7/A0-A6,
+   the exception frame's format/vector/status register and program counter, and
+   the address a task returns to should it ever return. */
+#define DK_STATUS_OFFSET          (15 * 4)
+#define DK_PROGRAM_COUNTER_OFFSET (15 * 4 + 4)
+#define DK_RETURN_ADDRESS_OFFSET  (15 * 4 + 8)
+#define DK_CONTEXT_DATA_OFFSET    (15 * 4 + 12)
+
+/* The exception frame a new task is started with: format four (the stack is
+   long aligned), supervisor mode, and all interrupt levels unmasked. */
+#define DK_INITIAL_STATUS 0x40002000
+
+
+/* This macro is used to maximize resource use by eliminating any unneeded
+   allocations between main and DK_IdleTask. */
+#define DK_DiscardStack();  __asm__ volatile ( "move.l %0,%%sp"\
+                                               :\
+                                               : "r" (DK_MASTER_STACK_START) );
+
+
+/* Atomic macros for disabling or enabling interrupts in critical sections.
+   These macros do not affect the scheduler. */
+#define DK_EnableInterrupts();  __asm__ volatile ( "move.w #0x2000,%%sr"\
+                                                   : : : "memory" );
+
+#define DK_DisableInterrupts(); __asm__ volatile ( "move.w #0x2700,%%sr"\
+                                                   : : : "memory" );
+
+/* Macros for saving the interrupt state and disabling interrupts, then
+   restoring the state saved, used by DK_EnterCriticalSection and
+   DK_ExitCriticalSection.  The state is the whole status register, so an
+   interrupt handler's own priority level is restored. */
+typedef unsigned short DK_InterruptState;
+
+#define DK_SaveInterrupts( State ); __asm__ volatile ( "move.w %%sr,%0\n\t"\
+                                                       "move.w #0x2700,%%sr"\
+                                                       : "=d" (State)\
+                                                       : : "memory" );
+
+#define DK_RestoreInterrupts( State ); __asm__ volatile ( "move.w %0,%%sr"\
+                                                          : : "d" (State)\
+                                                          : "memory" );
+
+
+/* Backing storage for every task stack. */
+extern unsigned char DK_MasterStack[];
+
+void DK_ISR_SchedulerClock(void);
+#endif /* M52233DEMO */
+
+
+#ifdef DK_POSIX
+  #include <signal.h>
+  #include <stdio.h>
+  #include <string.h>
+  #include <sys/time.h>
+  #include <time.h>
+  #include <ucontext.h>
+
+  #ifdef DK_USB_MODEL
+    #include "DK_USB_Model.h"
+  #endif
+
+/* The POSIX host target runs the kernel as an ordinary Linux process so that
+   the core may be exercised under a debugger, perf, or the sanitizers.  Each
+   task runs on a ucontext carved from the master stack, SIGALRM from an
+   interval timer stands in for the TMR0 rollover, SIGUSR1 stands in for all
+   other (user) interrupts, and masking those signals stands in for GIE. */
+
+
+/* The MCC18 storage qualifiers mean nothing to a host compiler. */
+#define rom
+#define ram
+#define near
+#define far
+
+
+/* User definable.  Specifies the maximum number of tasks that will be in
+   existence at any point in time, including the idle task.  May be given on
+   the command line, as the benchmarks do. */
+#ifndef DK_MAXIMUM_TASKS
+  #define DK_MAXIMUM_TASKS  (5)
+#endif
+
+
+/* Master stack start.  Host task contexts are kept in DK_ContextSegment, so
+   the TCB stack pointer is unused and only needs a value. */
+#define DK_MASTER_STACK_START 0
+
+/* Size of the master stack.  Host functions need far more stack than their
+   PIC18 counterparts, so each task receives 64 KiB. */
+#define DK_MASTER_STACK_SIZE  (DK_MAXIMUM_TASKS * 0x10000L)
+
+/* User definable.  A quantum is the minimum amount of time between scheduler
+   assertions, in microseconds. */
+#ifndef DK_QUANTUM_US
+  #define DK_QUANTUM_US (1000)
+#endif
+
+/* Scheduler clock speed in hertz.  The interval timer counts microseconds. */
+#define DK_SYSTEM_CLOCK_HZ 1000000
+
+/* Scheduler clock.  The interval timer is given 2^Prescaler * Modulo
+   microseconds, mirroring the PIT on the MCF52233. */
+#define DK_SCHEDULER_CLOCK_COUNTS_PER_MS      (DK_SYSTEM_CLOCK_HZ / 1000)
+#define DK_SCHEDULER_CLOCK_PRESCALER_MAXIMUM  15
+#define DK_SCHEDULER_CLOCK_COUNTS_MINIMUM     1
+#define DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM     65535
+#define DK_SchedulerClockModulo(Counts)       (Counts)
+
+/* The host reloads against an absolute deadline, so nothing is lost. */
+#define DK_SCHEDULER_CLOCK_RELOAD_LAG         0
+
+
+/* The host stack is managed by the C library; nothing can be discarded. */
+#define DK_DiscardStack(); /* */
+
+
+/* Atomic macros for disabling or enabling interrupts in critical sections.
+   These macros do not affect the scheduler. */
+#define DK_EnableInterrupts();  sigprocmask( SIG_UNBLOCK,\
+                                             &DK_InterruptSignals,\
+                                             0 );
+
+#define DK_DisableInterrupts(); sigprocmask( SIG_BLOCK,\
+                                             &DK_InterruptSignals,\
+                                             0 );
+
+/* Macros for saving the interrupt state and disabling interrupts, then
+   restoring the state saved, used by DK_EnterCriticalSection and
+   DK_ExitCriticalSection.  The state is the signal mask. */
+typedef sigset_t DK_InterruptState;
+
+#define DK_SaveInterrupts( State ); sigprocmask( SIG_BLOCK,\
+                                                 &DK_InterruptSignals,\
+                                                 &(State) );
+
+#define DK_RestoreInterrupts( State ); sigprocmask( SIG_SETMASK,\
+                                                    &(State),\
+                                                    0 );
+
+
+/* The set of signals treated as interrupts. */
+extern sigset_t DK_InterruptSignals;
+
+/* Saved context of each task, indexed by identity. */
+extern ucontext_t DK_ContextSegment[];
+
+/* Entry point of each task, indexed by identity. */
+extern DK_TaskAddress DK_TaskEntryPoint[];
+
+/* Backing storage for every task stack. */
+extern unsigned char DK_MasterStack[];
+
+void DK_ISR_SchedulerClock(int Signal);
+void DK_TaskEntry(void);
+#endif /* DK_POSIX */
+
+
+/* The quantum in seconds, for reference.  The kernel itself only uses
+   DK_QUANTUM_US. */
+#define DK_QUANTUM (DK_QUANTUM_US / 1000000.0)
+
+/* Number of scheduler clock counts in DK_QUANTUM_US at the smallest
+   prescaler.  Split at the millisecond so that the preprocessor's long
+   arithmetic does not overflow. */
+#define DK_QUANTUM_COUNTS\
+  ( (DK_QUANTUM_US / 1000) * DK_SCHEDULER_CLOCK_COUNTS_PER_MS\
+    + (DK_QUANTUM_US % 1000) * DK_SCHEDULER_CLOCK_COUNTS_PER_MS / 1000 )
+
+/* User definable.  If defined, the scheduler clock is programmed once per
+   time slice, for the incoming task's entire QuantumShare, instead of
+   interrupting every quantum.  DK_QuantumTrigger is then called once per slice,
+   after kernel time has been advanced, and QuantumCount advances by the whole
+   quanta the slice lasted, which is less than the share if the task yielded or
+   blocked.  Shares are limited to DK_MAXIMUM_QUANTUM_SHARE quanta, which must
+   fit in the scheduler clock at a single prescaler. */
+/* #define DK_ONE_SHOT_SLICE */
+
+#ifdef DK_ONE_SHOT_SLICE
+  #ifndef DK_MAXIMUM_QUANTUM_SHARE
+    #define DK_MAXIMUM_QUANTUM_SHARE 16
+  #endif
+
+  #define DK_SCHEDULER_CLOCK_SPAN (DK_QUANTUM_COUNTS * DK_MAXIMUM_QUANTUM_SHARE)
+#else
+  #define DK_SCHEDULER_CLOCK_SPAN DK_QUANTUM_COUNTS
+#endif
+
+/* The prescaler and modulo for DK_QUANTUM_US, chosen at compile time as
+   DK_CalculatePrescaleAndModulo would at run time: the smallest prescaler that
+   fits the longest span the clock is programmed for in the modulo register. */
+#if DK_SCHEDULER_CLOCK_SPAN <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 0
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 1) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 1
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 2) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 2
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 3) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 3
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 4) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 4
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 5) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 5
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 6) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 6
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 7) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 7
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 8) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 8
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 9) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 9
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 10) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 10
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 11) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 11
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 12) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 12
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 13) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 13
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 14) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 14
+#elif (DK_SCHEDULER_CLOCK_SPAN >> 15) <= DK_SCHEDULER_CLOCK_COUNTS_MAXIMUM
+  #define DK_SCHEDULER_CLOCK_PRESCALER 15
+#else
+  #define DK_SCHEDULER_CLOCK_PRESCALER 16
+#endif
+
+#if DK_SCHEDULER_CLOCK_PRESCALER > DK_SCHEDULER_CLOCK_PRESCALER_MAXIMUM
+  #error Error: DK_QUANTUM_US (times DK_MAXIMUM_QUANTUM_SHARE with \
+         DK_ONE_SHOT_SLICE) is too long for the scheduler clock at \
+         DK_SYSTEM_CLOCK_HZ.
+#endif
+
+#if (DK_QUANTUM_COUNTS >> DK_SCHEDULER_CLOCK_PRESCALER)\
+    < DK_SCHEDULER_CLOCK_COUNTS_MINIMUM
+  #error Error: DK_QUANTUM_US is too short for the scheduler clock at \
+         DK_SYSTEM_CLOCK_HZ.
+#endif
+
+/* Scheduler clock counts in one quantum at DK_SCHEDULER_CLOCK_PRESCALER. */
+#define DK_SCHEDULER_CLOCK_QUANTUM\
+  (DK_QUANTUM_COUNTS >> DK_SCHEDULER_CLOCK_PRESCALER)
+
+#define DK_SCHEDULER_CLOCK_MODULO\
+  DK_SchedulerClockModulo(DK_SCHEDULER_CLOCK_QUANTUM)
+
+
+/* Allows for a pointer that may point anywhere, hence even more dangerous than
+   the typical pointers you normally find in these parts.  I wonder what will I
+   call one of these anywhere pointers that points to type void... */
+typedef struct
+{
+  union
+  {
+    far rom unsigned char * pROM;
+    near ram unsigned char * pRAM;
+  } Anywhere;
+
+  unsigned char IsROMPointer;
+} DK_DangerousPointer;
+
+
 /* If this macro is zero, debugging features are disabled, such as DK_Assert. */
 #define DK_DEBUG_MODE 0
 
 #if DK_DEBUG_MODE
+  /* The assertion is logged by its identity alone; DK_Log.py recovers the
+     file, line, and condition from the source. */
   #define DK_Assert( a ); \
     if( (a) != 0 )\
       {\
-        DK_DisableInterrupts();\
-        printf( "\7 Assertion occured: (" #a ")\n\rFile: " __FILE__ " ["\
-                __TIME__ "]\n\rLine: %lu \n\r", (long unsigned)__LINE__);\
-        DK_EnableInterrupts();\
+        DK_Log0("Assertion occured: (" #a ")");\
       }
 #else
   #define DK_Assert( a ); /* */
 #endif
 
-
-/* Atomic macros for disabling or enabling interrupts in critical sections.
-   These macros do not affect the scheduler. */
-#define DK_EnableInterrupts();  _asm\
-                                  bsf INTCON, 7, 0\
-                                _endasm
-
-#define DK_DisableInterrupts(); _asm\
-                                  bcf INTCON, 7, 0\
-                                _endasm
-
-#endif DK_SPECIFIC_H
+#endif /* DK_SPECIFIC_H */
@@ -0,0 +1,659 @@
+#!/usr/bin/env python3
+"""
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+Worst case stack depth of every task in the PIC18F4550 image, and a stack
+layout sized to it.  The image's map file gives the address of every function,
+and its hex file gives the code, which is followed instruction by instruction.
+MCC18 keeps a software stack through FSR1: arguments and the caller's frame
+pointer are pushed through POSTINC1, locals are made room for by adding to
+FSR1L, and all of it is taken back through POSTDEC1 and by subtracting from
+FSR1L.  Tracking those gives each function's own depth at its deepest and at
+every call, and the call graph gives the rest.  CALL and RCALL are counted
+against the 31 entry hardware return stack.
+
+A task is any function whose address is passed to DK_InitializeTask in the
+sources, plus the idle task from its DK_DiscardStack on.  An interrupt may come
+at any point in a task, so each task also needs:
+
+  the frame DK_SaveContext pushes: its registers, as counted in the image,
+  three bytes for each hardware return stack entry the task holds at its
+  deepest plus the interrupt's own, and two for the entry count; and
+
+  the deepest of the handlers called from DK_SaveContext_Dispatch, which run
+  on the task's stack with the hardware return stack emptied.
+
+Every task's stack is the same size, since identities are handed out as tasks
+are created, so the size is the worst of them, and of main, which runs in the
+idle task's stack before the kernel starts.  Calls through function pointers
+are followed to the functions passed to the calls in INDIRECT, or to those
+given with -i; any other is an error.  So is recursion, but for a basic task
+preempting one of lower priority, where each basic task may be on the stack
+once.
+
+The stacks share RAM with the kernel's and drivers' data: DK_Master_Stack and
+the unprotected data banks next to it.  The map file gives the size of each
+data section, and the stacks and the data are checked against that RAM and the
+linker script's other unprotected data banks together.  The DK_MAXIMUM_TASKS
+stacks go at the top of the shared RAM, and what they leave is split into 256
+byte data banks.  Each data section must fit whole in one of those or of the
+other data banks, largest first.
+
+Results are printed as "<name> <value> <unit>", the same format as
+DK_Benchmark.  With -o, prefix.h defines DK_TASK_STACK_SIZE and
+DK_MASTER_STACK_START for a build with DK_STACKS defined, and prefix.lkr is the
+linker script with that layout.  The program exits non-zero if a task's stack
+or the data does not fit.
+
+Usage: DK_Stack.py [-m tasks] [-i function=target,...] [-o prefix] image source ...
+where image is the path to the linker output without an extension.
+"""
+
+import bisect
+import re
+import sys
+
+from DK_Cycles import ReadHex
+from DK_Log import Balanced, StripComments
+
+
+# DK_MAXIMUM_TASKS for the PIC18F4550; see DK_Specific.h.
+TASKS = 5
+
+# The linker script the stack layout is cut from.
+SCRIPT = "DK_LinkerScript.lkr"
+
+# Entries in the PIC18's hardware return stack.
+RETURN_STACK_ENTRIES = 31
+
+# The functions whose first argument is run from somewhere else: a task entry
+# point, or a function called through a pointer by the function given.
+INDIRECT = {
+  "DK_InitializeTask":      None,
+  "DK_InitializeBasicTask": "DK_BasicDispatch",
+  "DK_JobSubmit":           "DK_JobWorker",
+  "DK_LogDrain":            "DK_LogDrain",
+}
+
+# A function that may call itself again through a pointer, at most once for
+# each of its targets.
+NESTING = "DK_BasicDispatch"
+
+CONTEXT_SAVE = "DK_SaveContext"
+DISPATCH = "DK_SaveContext_Dispatch"
+IDLE_TASK = "DK_IdleTask"
+MAIN = "main"
+
+# Special function registers, as a MOVFF addresses them.
+FSR1L = 0xFE1
+POSTDEC1 = 0xFE5
+PREINC1 = 0xFE4
+POSTINC1 = 0xFE6
+PCL = 0xFF9
+
+
+def ReadCode(Path):
+  """Returns a dictionary of symbol name to address from an MPLINK map file,
+  for program memory only."""
+
+  Symbols = {}
+
+  with open(Path) as Map:
+    for Line in Map:
+      Match = re.match(r"\s*(\S+)\s+0x([0-9a-fA-F]+)\s+program\s", Line)
+
+      if Match:
+        Symbols[Match.group(1)] = int(Match.group(2), 16)
+
+  return Symbols
+
+
+def ReadData(Path, Ranges):
+  """Returns a dictionary of section name to size from an MPLINK map file, for
+  the data sections placed in one of Ranges, (start, end) pairs, but for the
+  stack."""
+
+  Sections = {}
+
+  with open(Path) as Map:
+    for Line in Map:
+      Match = re.match(r"\s*(\S+)\s+[iu]data\s+0x([0-9a-fA-F]+)\s+data\s+"
+                       r"0x([0-9a-fA-F]+)\s*$", Line)
+
+      if Match and Match.group(1) != ".stack" and int(Match.group(3), 16) and \
+         any(Start <= int(Match.group(2), 16) <= End
+             for Start, End in Ranges):
+        Sections[Match.group(1)] = int(Match.group(3), 16)
+
+  return Sections
+
+
+def ReadBanks(Script):
+  """Returns the linker script's text, the start, end, and line span of each
+  bank the stacks and data share, and the start and end of every other data
+  bank.  The shared banks are DK_Master_Stack and the unprotected data banks
+  that run on from it, in RAM and on consecutive lines; the others are the rest
+  of the unprotected data banks, and may not cross a 256 byte bank."""
+
+  with open(Script) as Original:
+    Text = Original.read()
+
+  Banks = []
+
+  for Match in re.finditer(r"^DATABANK\s+NAME=(\S+)\s+START=0x([0-9A-Fa-f]+)"
+                           r"\s+END=0x([0-9A-Fa-f]+)([^\n]*)\n", Text, re.M):
+    if Match.group(1) == "DK_Master_Stack" or \
+       "PROTECTED" not in Match.group(4):
+      Banks.append((int(Match.group(2), 16), int(Match.group(3), 16),
+                    Match.start(), Match.end(), Match.group(1)))
+
+  if "DK_Master_Stack" not in [Bank[4] for Bank in Banks]:
+    raise ValueError("%s has no DK_Master_Stack bank" % Script)
+
+  Banks.sort()
+  First = Last = [Bank[4] for Bank in Banks].index("DK_Master_Stack")
+
+  while First > 0 and Banks[First][0] == Banks[First - 1][1] + 1 and \
+        Banks[First][2] == Banks[First - 1][3]:
+    First -= 1
+
+  while Last + 1 < len(Banks) and Banks[Last + 1][0] == Banks[Last][1] + 1 and \
+        Banks[Last + 1][2] == Banks[Last][3]:
+    Last += 1
+
+  Others = [(Bank[0], Bank[1]) for Bank in Banks[:First] + Banks[Last + 1:]]
+
+  for Low, High in Others:
+    if Low >> 8 != High >> 8:
+      raise ValueError("%s's data bank at 0x%X crosses a 256 byte bank"
+                       % (Script, Low))
+
+  return Text, Banks[First:Last + 1], Others
+
+
+def Layout(Banks, Others, Size, Sections):
+  """Returns the stacks' start, with Size bytes of them at the top of the
+  shared banks, and the data banks below them.  Raises ValueError if a data
+  section fits in none of those or of the Others."""
+
+  Start, End = Banks[0][0], Banks[-1][1]
+  Stacks = End + 1 - Size
+
+  if Stacks < Start:
+    raise ValueError("the stacks need %d bytes, but the data banks and "
+                     "DK_Master_Stack hold %d" % (Size, End + 1 - Start))
+
+  # Data banks may not cross a 256 byte bank.
+  Data = [[Low, High, High + 1 - Low] for Low, High in Others]
+  Free = Start
+
+  while Free < Stacks:
+    Last = min(Stacks - 1, Free | 0xFF)
+    Data.append([Free, Last, Last + 1 - Free])
+    Free = Last + 1
+
+  for Name in sorted(Sections, key=lambda Name: (-Sections[Name], Name)):
+    for Bank in Data:
+      if Bank[2] >= Sections[Name]:
+        Bank[2] -= Sections[Name]
+        break
+    else:
+      raise ValueError("data section %s, %d bytes, does not fit beside %d "
+                       "bytes of stacks" % (Name, Sections[Name], Size))
+
+  return Stacks, [(Low, High) for Low, High, _ in Data[len(Others):]]
+
+
+def Registers(Word, Second):
+  """Returns the special function registers an instruction addresses, as
+  (register, written) pairs."""
+
+  if Word & 0xF000 == 0xC000:
+    # MOVFF source, destination.
+    return [(Word & 0xFFF, False), (Second & 0xFFF, True)]
+
+  # Byte and bit oriented instructions, less the literal ones.  Only the
+  # access bank's upper part holds special function registers.
+  if 0x0200 <= Word < 0x0800 or 0x1000 <= Word < 0xC000:
+    if Word & 0x100 == 0 and Word & 0xFF >= 0x60:
+      Written = Word & 0xFE00 in (0x6E00, 0x6A00, 0x6800) or \
+                (Word < 0x7000 and Word & 0x200 != 0)
+      return [(0xF00 | (Word & 0xFF), Written)]
+
+  return []
+
+
+def Scan(Image, Start, End, Name):
+  """Follows a function's code from Start to End, returning a dictionary of:
+
+    Peak      Its own deepest use of the software stack, in bytes.
+    Calls     (depth, target address, return stack entries) for every call,
+              jump, or fall through out of the function.
+    Indirect  The depth at every call through a pointer.
+    Reset     If the function moves FSR1 to the stack's start, as
+              DK_DiscardStack does, the same for what follows.
+
+  Raises ValueError if the stack pointer moves by an unknown amount."""
+
+  Result = Summary = {"Peak": 0, "Calls": [], "Indirect": [], "Reset": None}
+  Depth = 0
+  Literal = None
+  Released = None
+  Transfer = False
+  Address = Start
+
+  while Address < End and Address in Image:
+    Word = Image[Address] | (Image.get(Address + 1, 0) << 8)
+    Second = None
+    Size = 2
+
+    # MOVFF, CALL, LFSR, and GOTO take two words.
+    if Word & 0xF000 == 0xC000 or Word & 0xFE00 == 0xEC00 or \
+       Word & 0xFF00 in (0xEE00, 0xEF00):
+      Second = Image.get(Address + 2, 0) | (Image.get(Address + 3, 0) << 8)
+      Size = 4
+
+    Target = None
+    Entries = 0
+    Transfer = False
+
+    if Word & 0xF800 == 0xD000 or Word & 0xF800 == 0xD800:
+      # BRA or RCALL n: PC + 2 + 2n, n signed eleven bits.
+      Offset = Word & 0x7FF
+
+      if Offset & 0x400:
+        Offset -= 0x800
+
+      Target = Address + 2 + 2 * Offset
+      Entries = 1 if Word & 0x0800 else 0
+      Transfer = not Entries
+    elif Word & 0xF800 == 0xE000:
+      # Conditional branches: PC + 2 + 2n, n signed eight bits.
+      Offset = Word & 0xFF
+
+      if Offset & 0x80:
+        Offset -= 0x100
+
+      Target = Address + 2 + 2 * Offset
+    elif Word & 0xFE00 == 0xEC00 or Word & 0xFF00 == 0xEF00:
+      # CALL or GOTO k: the second word holds the upper twelve bits of k.
+      Target = ((Word & 0xFF) | ((Second & 0xFFF) << 8)) * 2
+      Entries = 1 if Word & 0xFE00 == 0xEC00 else 0
+      Transfer = not Entries
+    elif Word & 0xFFF0 == 0xEE10:
+      # LFSR 1: the stack starts over.
+      Summary = {"Peak": 0, "Calls": [], "Indirect": [], "Reset": None}
+      Result["Reset"] = Summary
+      Depth = 0
+    elif Word & 0xFFFE in (0x0010, 0x0012):
+      # RETFIE or RETURN.
+      Transfer = True
+    else:
+      for Register, Written in Registers(Word, Second):
+        if Register in (POSTINC1, PREINC1):
+          Depth += 1
+        elif Register == POSTDEC1:
+          Depth -= 1
+        elif Register == FSR1L and Word & 0xFE00 == 0x5C00 and \
+             Literal is not None:
+          # SUBWF FSR1L,W: a frame's release, completed by the MOVWF below.
+          Released = Literal
+        elif Register == FSR1L and Written and Second is None:
+          Step = {0x2400: 1, 0x5C00: -1}.get(Word & 0xFC00)
+
+          if Word & 0xFC00 in (0x2800, 0x0400):
+            # INCF and DECF.
+            Depth += 1 if Word & 0xFC00 == 0x2800 else -1
+          elif Word & 0xFE00 == 0x6E00 and Released is not None:
+            Depth -= Released
+            Released = None
+          elif Word & 0xFE00 == 0x6A00:
+            # CLRF, where the release borrows from FSR1H.
+            pass
+          elif Step is None or Literal is None:
+            raise ValueError("%s: FSR1 moves by an unknown amount at 0x%x"
+                             % (Name, Address))
+          else:
+            Depth += Step * Literal
+        elif Register == PCL and Written:
+          Summary["Indirect"].append(Depth)
+
+    if Target is not None and not Start <= Target < End:
+      Summary["Calls"].append((Depth, Target, Entries))
+
+    Summary["Peak"] = max(Summary["Peak"], Depth)
+    Literal = Word & 0xFF if Word & 0xFF00 == 0x0E00 else None
+    Address += Size
+
+  if not Transfer and Address == End:
+    # Falls through into the next symbol, as the assembly's labels do.
+    Summary["Calls"].append((Depth, End, 0))
+
+  return Result
+
+
+def ScanSources(Paths):
+  """Returns the task entry points named in the sources, and a dictionary of
+  function to the functions it calls through pointers."""
+
+  Tasks = []
+  Targets = {}
+
+  for Path in Paths:
+    with open(Path, newline="") as Source:
+      Text = StripComments(Source.read().replace("\r\n", "\n"))
+
+    for Call in re.finditer(r"\b(%s)\s*\(" % "|".join(INDIRECT), Text):
+      Arguments = Balanced(Text, Call.end() - 1) or ""
+      First = re.sub(r"^\s*(\(\s*\w+\s*\)\s*)?", "",
+                     Arguments.split(",")[0]).strip()
+
+      # Declarations, definitions, and pointers held in variables name no
+      # function here.
+      if not re.match(r"^[A-Za-z_]\w*$", First):
+        continue
+
+      Caller = INDIRECT[Call.group(1)]
+
+      if Caller is None:
+        Tasks.append(First)
+      else:
+        Targets.setdefault(Caller, []).append(First)
+
+  return Tasks, Targets
+
+
+class Graph:
+  """The image's functions, and the depth of each call tree."""
+
+  def __init__(self, Symbols, Image, Targets):
+    Addresses = sorted(set(Address for Address in Symbols.values()
+                           if Address < 0x200000))
+    self.Addresses = Addresses
+    self.Names = {}
+    self.Summaries = {}
+    self.Targets = Targets
+    self.Known = {}
+
+    for Name, Address in sorted(Symbols.items()):
+      if Address not in Addresses:
+        continue
+
+      Index = Addresses.index(Address)
+      End = Addresses[Index + 1] if Index + 1 < len(Addresses) \
+            else max(Image) + 1
+      self.Names.setdefault(Address, Name)
+
+      # Constant data is scanned too, but only complains if it is called.
+      try:
+        self.Summaries[Name] = Scan(Image, Address, End, Name)
+      except ValueError as Error:
+        self.Summaries[Name] = Error
+
+  def Name(self, Address):
+    """Returns the function an address is in.  Code that jumps into the
+    middle of a function is charged with the whole of it."""
+
+    Index = bisect.bisect_right(self.Addresses, Address) - 1
+
+    return self.Names[self.Addresses[Index]] if Index >= 0 else None
+
+  def Nests(self, Path, Target):
+    """Returns whether a call back to Target, since it was last on the path,
+    went through a basic task run by the dispatcher.  Each basic task is run
+    at most once on a path, so such a loop ends."""
+
+    Index = len(Path) - 1 - Path[::-1].index(Target)
+
+    return any(Path[Step] == NESTING and
+               Path[Step + 1] in self.Targets.get(NESTING, [])
+               for Step in range(Index, len(Path) - 1))
+
+  def Depth(self, Name, Summary=None, Path=(), Kinds=()):
+    """Returns the deepest software stack, in bytes, and hardware return stack,
+    in entries, of a function and everything it calls."""
+
+    return self.Follow(Name, Summary, Path, Kinds)[:2]
+
+  def Follow(self, Name, Summary, Path, Kinds):
+    """Depth, for a function reached along Path, whose edges in pushed return
+    stack entries are Kinds.  A loop of jumps back along the path, such as the
+    assembly's labels make, is cut; the third result names the functions cut
+    at, whose depth is not yet all known."""
+
+    Nested = frozenset(Target for Target in Path
+                       if Target in self.Targets.get(NESTING, []))
+
+    if Summary is None and (Name, Nested) in self.Known:
+      return self.Known[(Name, Nested)] + (frozenset(),)
+
+    if Summary is None:
+      Summary = self.Summaries[Name]
+
+    if isinstance(Summary, ValueError):
+      raise Summary
+
+    Path = Path + (Name,)
+    Software = Summary["Peak"]
+    Return = 0
+    Cuts = frozenset()
+    Calls = [(Depth, self.Name(Target), Entries)
+             for Depth, Target, Entries in Summary["Calls"]]
+
+    if Summary["Indirect"]:
+      if Name not in self.Targets:
+        raise ValueError("%s calls through a pointer; name what it calls "
+                         "with -i %s=function" % (Name, Name))
+
+      for Target in self.Targets[Name]:
+        if Name == NESTING and Target in Path:
+          continue
+
+        Calls += [(Depth, Target, 1) for Depth in Summary["Indirect"]]
+
+    for Depth, Target, Entries in Calls:
+      if Target is None:
+        raise ValueError("%s leaves for an address before any symbol" % Name)
+
+      if Target not in self.Summaries:
+        raise ValueError("%s calls %s, which is not in the image"
+                         % (Name, Target))
+
+      if Target in Path and not self.Nests(Path, Target):
+        Index = Path.index(Target)
+
+        if any(Kinds[Index:]) or Entries:
+          raise ValueError("recursion through %s"
+                           % " -> ".join(Path[Index:] + (Target,)))
+
+        Cuts |= frozenset([Target])
+        continue
+
+      Below, Deeper, Cut = self.Follow(Target, None, Path, Kinds + (Entries,))
+      Software = max(Software, Depth + Below)
+      Return = max(Return, Entries + Deeper)
+      Cuts |= Cut
+
+    Cuts -= frozenset([Name])
+
+    if Summary is self.Summaries.get(Name) and not Cuts:
+      self.Known[(Name, Nested)] = (Software, Return)
+
+    return Software, Return, Cuts
+
+
+def WriteHeader(Path, Image, Tasks, Stacks, Size, Count, Start):
+  """Writes the header giving DK_TASK_STACK_SIZE and DK_MASTER_STACK_START."""
+
+  Lines = [
+    "/" + "*" * 79,
+    "Dreamcatcher Kernel",
+    "",
+    "This file was generated by DK_Stack.py from %s." % Image,
+    "Do not edit it; run \"make stacks\" again after changing the kernel or the",
+    "tasks.",
+    "*" * 79 + "/",
+    "",
+    "#ifndef DK_STACKS_H",
+    "#define DK_STACKS_H",
+    "",
+    "",
+    "#if DK_MAXIMUM_TASKS != %d" % Count,
+    "  #error The stack layout was generated for %d tasks." % Count,
+    "#endif",
+    "",
+    "/* Worst case bytes of stack each task uses, with an interrupt's frame and",
+    "   handlers on top. */",
+  ]
+
+  for Task in Tasks:
+    Lines.append("#define DK_STACK_%s  %d" % (Task, Stacks[Task]))
+
+  Lines += [
+    "",
+    "/* Every task's stack is the largest of them. */",
+    "#define DK_TASK_STACK_SIZE  %d" % Size,
+    "",
+    "/* They are at the top of the RAM below the USB banks, above the data. */",
+    "#define DK_MASTER_STACK_START  0x%X" % Start,
+    "",
+    "",
+    "#endif /* DK_STACKS_H */",
+  ]
+
+  with open(Path, "w", newline="\r\n") as Header:
+    Header.write("\n".join(Lines) + "\n")
+
+
+def WriteLinkerScript(Path, Text, Banks, Size, Start, Data):
+  """Writes a copy of the linker script with the shared banks replaced by
+  DK_Master_Stack, cut to Size bytes from Start, and the data banks below
+  it."""
+
+  Lines = ["DATABANK   NAME=gpr%d       START=0x%X  END=0x%X"
+           % (Low >> 8, Low, High) for Low, High in Data]
+  Lines.append("DATABANK   NAME=DK_Master_Stack START=0x%X  END=0x%X  PROTECTED"
+               % (Start, Start + Size - 1))
+
+  Text = Text[:Banks[0][2]] + "\n".join(Lines) + "\n" + Text[Banks[-1][3]:]
+  Text = re.sub(r"^STACK\s+SIZE=0x[0-9A-Fa-f]+",
+                "STACK SIZE=0x%X" % Size, Text, flags=re.M)
+
+  with open(Path, "w", newline="\r\n") as Copy:
+    Copy.write(Text)
+
+
+def main(Arguments):
+  Count = TASKS
+  Prefix = None
+  Image = None
+  Sources = []
+  Named = {}
+
+  while Arguments:
+    Argument = Arguments.pop(0)
+
+    if Argument == "-m" and Arguments:
+      Count = int(Arguments.pop(0))
+    elif Argument == "-o" and Arguments:
+      Prefix = Arguments.pop(0)
+    elif Argument == "-i" and Arguments:
+      Name, _, Value = Arguments.pop(0).partition("=")
+      Named.setdefault(Name, []).extend(Target for Target in Value.split(",")
+                                        if Target)
+    elif not Argument.startswith("-"):
+      Sources.append(Argument)
+    else:
+      Sources = []
+      break
+
+  if len(Sources) < 2:
+    sys.stderr.write(__doc__.strip().splitlines()[-2] + "\n")
+    return 1
+
+  Image = Sources.pop(0)
+  Tasks, Targets = ScanSources(Sources)
+
+  for Name, Functions in Named.items():
+    Targets.setdefault(Name, []).extend(Functions)
+
+  Result = 0
+
+  try:
+    Symbols = ReadCode(Image + ".map")
+
+    for Name in [CONTEXT_SAVE, DISPATCH, IDLE_TASK, MAIN] + Tasks:
+      if Name not in Symbols:
+        raise ValueError("%s is not in %s.map" % (Name, Image))
+
+    Calls = Graph(Symbols, ReadHex(Image + ".hex"), Targets)
+
+    # The frame's registers, and its two bytes of entry count.
+    Registers = Calls.Summaries[CONTEXT_SAVE]["Peak"]
+    Handlers, HandlerEntries = Calls.Depth(DISPATCH)
+
+    Tasks = [IDLE_TASK] + sorted(set(Tasks) - set([IDLE_TASK]))
+    Stacks = {}
+
+    print("# Dreamcatcher Kernel PIC18F4550 stacks, %s" % Image)
+    print("interrupt_frame %d bytes" % Registers)
+    print("interrupt_handlers %d bytes" % Handlers)
+    print("interrupt_return_stack %d entries" % HandlerEntries)
+
+    for Task in Tasks:
+      Summary = Calls.Summaries[Task]
+
+      if Task == IDLE_TASK and Summary["Reset"] is None:
+        raise ValueError("%s does not discard its stack" % IDLE_TASK)
+
+      Software, Entries = Calls.Depth(Task, Summary["Reset"]
+                                      if Task == IDLE_TASK else None)
+
+      # The interrupt's own return address.
+      Entries += 1
+      Stacks[Task] = Software + Registers + 3 * Entries + 2 + Handlers
+
+      print("stack_%s %d bytes" % (Task, Stacks[Task]))
+      print("return_stack_%s %d entries" % (Task, Entries))
+
+      if Entries > RETURN_STACK_ENTRIES:
+        print("# %s overflows the hardware return stack" % Task)
+        Result = 1
+
+    # main runs with interrupts disabled, before the idle task discards its
+    # stack.
+    Main, _ = Calls.Depth(MAIN)
+    print("stack_%s %d bytes" % (MAIN, Main))
+
+    if HandlerEntries > RETURN_STACK_ENTRIES:
+      print("# the interrupt handlers overflow the hardware return stack")
+      Result = 1
+
+    Size = max(list(Stacks.values()) + [Main])
+    print("task_stack_size %d bytes" % Size)
+    print("master_stack_size %d bytes" % (Size * Count))
+
+    Text, Banks, Others = ReadBanks(SCRIPT)
+    Ranges = [(Banks[0][0], Banks[-1][1])] + Others
+    Sections = ReadData(Image + ".map", Ranges)
+    Used = sum(Sections.values())
+    print("data_size %d bytes" % Used)
+
+    Start, Data = Layout(Banks, Others, Size * Count, Sections)
+    print("ram_free %d bytes"
+          % (sum(High + 1 - Low for Low, High in Ranges) - Size * Count - Used))
+
+    if Prefix is not None and Result == 0:
+      WriteLinkerScript(Prefix + ".lkr", Text, Banks, Size * Count, Start,
+                        Data)
+      WriteHeader(Prefix + ".h", Image, Tasks, Stacks, Size, Count, Start)
+  except ValueError as Error:
+    sys.stderr.write("DK_Stack.py: %s\n" % Error)
+    return 1
+
+  return Result
+
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv[1:]))
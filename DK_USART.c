@@ -0,0 +1,441 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the interrupt driven USART driver for the PIC18F4550.
+Characters are queued on a transmit ring and sent from the transmit interrupt,
+and received characters are queued on a receive ring from the receive
+interrupt, so no caller waits on the line and interrupts are never masked for
+longer than it takes to move a character.  A task that finds the transmit ring
+full or the receive ring empty sleeps until the interrupt wakes it.  Once
+initialized, the driver is also stdout: printf and friends write through
+_user_putc to the transmit ring.
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  5
+
+#include "DK_Global.h"
+
+
+#ifdef __18F4550
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+/* The transmit ring.  DK_USART_SendCharacter and DK_USART_Write add at TxHead,
+   and DK_USART_ISR takes from TxTail.  Both count freely and are masked into
+   the ring, so their difference is the number of characters queued.  Each
+   ring is a section of its own, which the linker places in whichever data
+   bank has room. */
+#pragma udata USART_TxRing /* Begin relocatable uninitialized data region. */
+  static unsigned char TxRing[DK_USART_TX_RING_SIZE];
+#pragma udata  /* Return to default data region. */
+
+static volatile unsigned char TxHead = 0,
+                              TxTail = 0;
+
+/* The receive ring.  DK_USART_ISR adds at RxHead, and DK_USART_Read and
+   DK_USART_ReceiveCharacter take from RxTail, in the same way as the transmit
+   ring. */
+#pragma udata USART_RxRing /* Begin relocatable uninitialized data region. */
+  static unsigned char RxRing[DK_USART_RX_RING_SIZE];
+#pragma udata  /* Return to default data region. */
+
+static volatile unsigned char RxHead = 0,
+                              RxTail = 0;
+
+/* The tasks asleep in DK_USART_WaitForTx and DK_USART_WaitForRx, or zero.
+   DK_USART_ISR wakes them. */
+static volatile unsigned char TxWaiter = 0,
+                              RxWaiter = 0;
+
+/* Characters that found the transmit ring full where waiting was not
+   possible, and characters received with the receive ring full or lost to a
+   hardware overrun. */
+static volatile unsigned long TxDrops = 0,
+                              RxOverruns = 0;
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+static void DK_USART_WaitForTx(void);
+static void DK_USART_WaitForRx(void);
+static void DK_USART_Wake( volatile unsigned char * pWaiter );
+
+signed DK_USART_Initialize(void)
+{
+/* This function sets the USART up for asynchronous operation at
+   DK_USART_BAUD, with the receive interrupt enabled, and makes it stdout.  The
+   transmit interrupt is enabled only while there is something to send.
+
+   Result:
+   DK_SUCCESS if successful. */
+
+  /* 16 bit baud rate generator with BRGH, PIC18F2455/2550/4455/4550 Data
+     Sheet, January, 2007, table 20-1: Fosc / (4 (n + 1)). */
+  const unsigned Divider = (DK_SYSTEM_CLOCK_HZ / 4 + DK_USART_BAUD / 2)
+                           / DK_USART_BAUD - 1;
+
+  /* TX is an output and RX an input. */
+  TRISCbits.TRISC6 = 0;
+  TRISCbits.TRISC7 = 1;
+
+  BAUDCON = 0x08; /* BRG16 = 1. */
+  SPBRGH = (unsigned char)(Divider >> 8);
+  SPBRG = (unsigned char)Divider;
+
+  TXSTA = 0x24; /* TXEN = 1, BRGH = 1. */
+  RCSTA = 0x90; /* SPEN = 1, CREN = 1. */
+
+  PIE1bits.TXIE = 0;
+  PIE1bits.RCIE = 1;
+
+  /* Enable peripheral interrupts. */
+  INTCONbits.PEIE = 1;
+
+  /* Route the standard library's output to _user_putc. */
+  stdout = _H_USER;
+
+  return DK_SUCCESS;
+}
+
+
+signed DK_USART_SendCharacter( unsigned char Character )
+{
+/* This function queues a single character on the transmit ring.  Unlike
+   DK_USART_Write it never waits, so it may be called from DK_QuantumTrigger or
+   an interrupt handler.  The slot is claimed and filled with interrupts held
+   off, so those callers may interrupt a task that is queueing too.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if the transmit ring is full. */
+
+  DK_EnterCriticalSection();
+
+  if( (unsigned char)(TxHead - TxTail) >= (unsigned)DK_USART_TX_RING_SIZE )
+  {
+    DK_ExitCriticalSection();
+    return DK_FAILURE;
+  }
+
+  TxRing[TxHead & (DK_USART_TX_RING_SIZE - 1)] = Character;
+  ++TxHead;
+
+  DK_ExitCriticalSection();
+
+  /* The interrupt sends it as soon as the transmit register is free. */
+  PIE1bits.TXIE = 1;
+
+  return DK_SUCCESS;
+}
+
+
+signed DK_USART_ReceiveCharacter( unsigned char * pCharacter )
+{
+/* This function takes a single character from the receive ring.  It never
+   waits, so it may be called from DK_QuantumTrigger or an interrupt handler.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if nothing has been received. */
+
+  if(RxHead == RxTail)
+  {
+    return DK_FAILURE;
+  }
+
+  *pCharacter = RxRing[RxTail & (DK_USART_RX_RING_SIZE - 1)];
+  ++RxTail;
+
+  return DK_SUCCESS;
+}
+
+
+signed DK_USART_Write( const unsigned char * pData,
+                       unsigned short Length )
+{
+/* This function sends Length bytes.  The data is copied to the transmit ring
+   and sent from the transmit interrupt.  While the ring is full the calling
+   task sleeps rather than dropping data, so this must be called from a task
+   other than the idle task, and from only one task at a time.
+
+   Parameters:
+   pData   The data to send.
+   Length  The number of bytes to send.
+
+   Result:
+   DK_SUCCESS once all of the data is queued. */
+
+  while(Length != 0)
+  {
+    if(DK_USART_SendCharacter(*pData) != DK_SUCCESS)
+    {
+      DK_USART_WaitForTx();
+      continue;
+    }
+
+    ++pData;
+    --Length;
+  }
+
+  return DK_SUCCESS;
+}
+
+
+signed DK_USART_Read( unsigned char * pData,
+                      unsigned short Length )
+{
+/* This function reads Length bytes.  The calling task sleeps until they have
+   all arrived, so this must be called from a task other than the idle task,
+   and from only one task at a time.
+
+   Parameters:
+   pData   The storage location for the data.
+   Length  The number of bytes to read.
+
+   Result:
+   DK_SUCCESS once all of the data is read. */
+
+  while(Length != 0)
+  {
+    if(DK_USART_ReceiveCharacter(pData) != DK_SUCCESS)
+    {
+      DK_USART_WaitForRx();
+      continue;
+    }
+
+    ++pData;
+    --Length;
+  }
+
+  return DK_SUCCESS;
+}
+
+
+unsigned long DK_USART_GetTxDrops(void)
+{
+/* Result:
+   The number of characters written through _user_putc that were dropped
+   because the transmit ring was full and the writer could not wait. */
+
+  return TxDrops;
+}
+
+
+unsigned long DK_USART_GetRxOverruns(void)
+{
+/* Result:
+   The number of received characters lost, to a full receive ring or to the
+   USART's own overrun. */
+
+  return RxOverruns;
+}
+
+
+int _user_putc( char Character )
+{
+/* The MCC18 standard library's hook for stdout.  A task sleeps until there is
+   room, like DK_USART_Write.  With interrupts disabled, as in an interrupt
+   handler or DK_Assert, waiting is impossible, so the character is dropped and
+   counted instead of blocking the kernel until the line catches up.
+
+   Result:
+   The character written, or EOF if it was dropped. */
+
+  while(DK_USART_SendCharacter(Character) != DK_SUCCESS)
+  {
+    if(INTCONbits.GIE == (unsigned)0)
+    {
+      ++TxDrops;
+      return EOF;
+    }
+
+    DK_USART_WaitForTx();
+  }
+
+  return (unsigned char)Character;
+}
+
+
+static void DK_USART_WaitForTx(void)
+{
+/* This function puts the calling task to sleep until DK_USART_ISR has drained
+   the transmit ring by half.  The idle task may not sleep, and only one task
+   at a time can be woken, so any other caller only yields. */
+
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+
+  DK_EnterCriticalSection();
+
+  /* As in DK_JobWait, finding the ring full and going to sleep happen
+     together, so the interrupt cannot drain it in between and leave the task
+     asleep. */
+  if( Identity != (unsigned)0 && TxWaiter == (unsigned)0 &&
+      (unsigned char)(TxHead - TxTail) >= (unsigned)DK_USART_TX_RING_SIZE )
+  {
+    TxWaiter = Identity;
+    DK_ConfigureTaskState(Identity, WAITING);
+  }
+
+  DK_ExitCriticalSection();
+
+  DK_InvokeScheduler();
+}
+
+
+static void DK_USART_WaitForRx(void)
+{
+/* This function puts the calling task to sleep until DK_USART_ISR receives a
+   character, in the same way as DK_USART_WaitForTx. */
+
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+
+  DK_EnterCriticalSection();
+
+  if( Identity != (unsigned)0 && RxWaiter == (unsigned)0 &&
+      RxHead == RxTail )
+  {
+    RxWaiter = Identity;
+    DK_ConfigureTaskState(Identity, WAITING);
+  }
+
+  DK_ExitCriticalSection();
+
+  DK_InvokeScheduler();
+}
+
+
+static void DK_USART_Wake( volatile unsigned char * pWaiter )
+{
+/* This function wakes a task put to sleep by DK_USART_WaitForTx or
+   DK_USART_WaitForRx, unless it has been suspended or killed since.  Called
+   from DK_USART_ISR. */
+
+  if( *pWaiter != (unsigned)0 &&
+      TCBSegment[*pWaiter].State == WAITING )
+  {
+    DK_ConfigureTaskState(*pWaiter, READY);
+  }
+
+  *pWaiter = 0;
+}
+
+
+void DK_USART_ISR(void)
+{
+/* Called by the PIC's interrupt handler when a character has been received,
+   or when the transmit register is free while the transmit interrupt is
+   enabled.  Each is serviced until there is nothing more to do, and a task
+   waiting on either ring is woken once it can go on. */
+
+  unsigned char Character = 0;
+
+  while(PIR1bits.RCIF == (unsigned)1)
+  {
+    /* Reading RCREG clears RCIF. */
+    Character = RCREG;
+
+    if( (unsigned char)(RxHead - RxTail) < (unsigned)DK_USART_RX_RING_SIZE )
+    {
+      RxRing[RxHead & (DK_USART_RX_RING_SIZE - 1)] = Character;
+      ++RxHead;
+    }
+    else
+    {
+      ++RxOverruns;
+    }
+  }
+
+  if(RxHead != RxTail)
+  {
+    DK_USART_Wake(&RxWaiter);
+  }
+
+  /* An overrun stops reception until the receiver is reset. */
+  if(RCSTAbits.OERR == (unsigned)1)
+  {
+    RCSTAbits.CREN = 0;
+    RCSTAbits.CREN = 1;
+    ++RxOverruns;
+  }
+
+  if(PIE1bits.TXIE == (unsigned)1)
+  {
+    while(PIR1bits.TXIF == (unsigned)1 && TxHead != TxTail)
+    {
+      TXREG = TxRing[TxTail & (DK_USART_TX_RING_SIZE - 1)];
+      ++TxTail;
+    }
+
+    /* The transmit register stays free, so its interrupt would never clear.
+       Turn it off until there is more to send. */
+    if(TxHead == TxTail)
+    {
+      PIE1bits.TXIE = 0;
+    }
+
+    /* A writer is only woken once it can queue a good run of characters,
+       rather than once for each one sent. */
+    if( (unsigned char)(TxHead - TxTail)
+        <= (unsigned)(DK_USART_TX_RING_SIZE / 2) )
+    {
+      DK_USART_Wake(&TxWaiter);
+    }
+  }
+}
+
+#else
+/*******************************************************************************
+The other targets do not use this driver; the MCF52233 console is written by
+WriteUART in main.c.  These stand-ins discard all output and never receive, so
+that the kernel and application run unchanged.
+*******************************************************************************/
+signed DK_USART_Initialize(void)
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USART_SendCharacter( unsigned char Character )
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USART_ReceiveCharacter( unsigned char * pCharacter )
+{
+  return DK_FAILURE;
+}
+
+
+signed DK_USART_Write( const unsigned char * pData,
+                       unsigned short Length )
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USART_Read( unsigned char * pData,
+                      unsigned short Length )
+{
+  /* Nothing is ever received. */
+  return DK_FAILURE;
+}
+
+
+unsigned long DK_USART_GetTxDrops(void)
+{
+  return 0;
+}
+
+
+unsigned long DK_USART_GetRxOverruns(void)
+{
+  return 0;
+}
+
+
+void DK_USART_ISR(void)
+{
+}
+#endif /* __18F4550. */
@@ -0,0 +1,47 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the declarations for DK_USART.c, the interrupt driven
+USART driver.
+*******************************************************************************/
+
+#ifndef DK_USART_H
+#define DK_USART_H
+
+
+/* The line rate, in bits per second.  Eight data bits, no parity, and one stop
+   bit. */
+#ifndef DK_USART_BAUD
+  #define DK_USART_BAUD  115200
+#endif
+
+/* Size in bytes of the transmit ring.  Must be a power of two no larger than
+   128.  Writers sleep until there is room rather than losing data, so a larger
+   ring only lets them run ahead of the line for longer, and RAM outside the
+   USB banks is short. */
+#ifndef DK_USART_TX_RING_SIZE
+  #define DK_USART_TX_RING_SIZE  16
+#endif
+
+/* Size in bytes of the receive ring.  Must be a power of two no larger than
+   128.  Received characters are lost once it is full, so it is kept at a
+   scheduler quantum's worth at the line rate. */
+#ifndef DK_USART_RX_RING_SIZE
+  #define DK_USART_RX_RING_SIZE  16
+#endif
+
+
+signed DK_USART_Initialize(void);
+signed DK_USART_SendCharacter( unsigned char Character );
+signed DK_USART_ReceiveCharacter( unsigned char * pCharacter );
+signed DK_USART_Write( const unsigned char * pData,
+                       unsigned short Length );
+signed DK_USART_Read( unsigned char * pData,
+                      unsigned short Length );
+unsigned long DK_USART_GetTxDrops(void);
+unsigned long DK_USART_GetRxOverruns(void);
+void DK_USART_ISR(void);
+
+
+#endif /* DK_USART_H */
@@ -2,13 +2,19 @@
 Dreamcatcher Kernel
 Stephen Niedzielski
 
-This file contains all USB source for the PIC18F4550.
+This file contains all USB source for the PIC18F4550.  With DK_USB_MODEL, the
+same source is built for the POSIX host target and runs against DK_USB_Model.c.
 *******************************************************************************/
 
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  4
+
 #include "DK_Global.h"
 #include <string.h> /* memset, memcpy, memcpypgm2ram */
 
 
+#if defined(__18F4550) || defined(DK_USB_MODEL)
+
 /*******************************************************************************
 USB packet definitions.
 *******************************************************************************/
@@ -17,9 +23,9 @@ static const rom USB_SD_Device DeviceDescriptor =
     sizeof(USB_SD_Device),  /* Size of the descriptor in bytes. */
     USB_SD_DEVICE,          /* Device descriptor type. */
     0x0200,                 /* USB 2.0 protocol. */
-    USB_CDC_CC_CDC,         /* CDC class code. */
-    0,                      /* No subclass. */
-    0,                      /* No class protocol. */
+    USB_MISC_CC_MISC,       /* Functions are grouped by interface */
+    USB_MISC_SC_COMMON,     /* association descriptors, so the CDC */
+    USB_MISC_PR_IAD,        /* and HID functions each get their own driver. */
     64,                     /* Size of endpoint zero in bytes. */
     USB_IDVENDOR,           /* Vendor identity. */
     USB_IDPRODUCT,          /* Product identity. */
@@ -31,9 +37,50 @@ static const rom USB_SD_Device DeviceDescriptor =
   };
 
 
+/* Device Class Definition for Human Interface Devices (HID), Version 1.11,
+   June 27, 2001, 6.2.2 Report Descriptor, and HID Usage Tables, Version 1.12,
+   October 28, 2004.  A game pad with four buttons (A, B, Select, and Start)
+   and a two axis direction pad, followed by eight vendor defined bytes of
+   timing; see USB_HID_REPORT_SIZE. */
+static const rom unsigned char HidReportDescriptor[] =
+  {
+    0x05, 0x01,   /* Usage page: generic desktop. */
+    0x09, 0x05,   /* Usage: game pad. */
+    0xA1, 0x01,   /* Collection: application. */
+    0x05, 0x09,   /*   Usage page: button. */
+    0x19, 0x01,   /*   Usage minimum: button one. */
+    0x29, 0x04,   /*   Usage maximum: button four. */
+    0x15, 0x00,   /*   Logical minimum: 0. */
+    0x25, 0x01,   /*   Logical maximum: 1. */
+    0x75, 0x01,   /*   Report size: one bit, */
+    0x95, 0x04,   /*   report count: four. */
+    0x81, 0x02,   /*   Input: data, variable, absolute. */
+    0x05, 0x01,   /*   Usage page: generic desktop. */
+    0x09, 0x30,   /*   Usage: X. */
+    0x09, 0x31,   /*   Usage: Y. */
+    0x15, 0xFF,   /*   Logical minimum: -1. */
+    0x25, 0x01,   /*   Logical maximum: 1. */
+    0x75, 0x02,   /*   Report size: two bits, */
+    0x95, 0x02,   /*   report count: two. */
+    0x81, 0x02,   /*   Input: data, variable, absolute. */
+    0x06, 0x00,
+    0xFF,         /*   Usage page: vendor defined. */
+    0x09, 0x01,   /*   Usage: vendor usage one. */
+    0x15, 0x00,   /*   Logical minimum: 0. */
+    0x26, 0xFF,
+    0x00,         /*   Logical maximum: 255. */
+    0x75, 0x08,   /*   Report size: eight bits, */
+    0x95, 0x08,   /*   report count: eight. */
+    0x81, 0x02,   /*   Input: data, variable, absolute. */
+    0xC0          /* End collection. */
+  };
+
+
 static const rom struct
 {
   USB_SD_Configuration                 Configuration;
+
+  USB_SD_InterfaceAssociation          Association0;
   
   USB_SD_Interface                     Interface0;
   
@@ -47,18 +94,39 @@ static const rom struct
   USB_SD_Interface                     Interface1;
   
   USB_SD_Endpoint                      Endpoint1;
+  USB_SD_Endpoint                      Endpoint1O;
+
+  USB_SD_Interface                     Interface2;
+
+  USB_SD_Endpoint                      Endpoint2;
+
+  USB_SD_Interface                     Interface3;
+
+  USB_HID_Descriptor                   Hid3;
+
+  USB_SD_Endpoint                      Endpoint3;
 } SetupPacket =
   {
     /* Configuration0. */
     sizeof(USB_SD_Configuration),    /* Size of the descriptor in bytes. */
     USB_SD_CONFIGURATION,            /* Configuration descriptor type. */
     sizeof(SetupPacket),             /* Total length of data returned for this configuration. */
-    2,                               /* Number of interfaces in this configuration. */
+    4,                               /* Number of interfaces in this configuration. */
     1,                               /* Configuration index of this configuration. */
     0,                               /* Configuration string index. */
     128,                             /* Configuration characteristics: not self powered and no remote wakeup. */
     50,                              /* 100 mA consumption (2 mA units). */
 
+    /* Association0. */
+    sizeof(USB_SD_InterfaceAssociation), /* Size of the descriptor in bytes. */
+    USB_SD_INTERFACE_ASSOCIATION,    /* Interface association descriptor type. */
+    0,                               /* First interface of the CDC function. */
+    2,                               /* Communication and data interfaces. */
+    USB_CDC_CC_CDC,                  /* CDC class code. */
+    2,                               /* Abstract control model subclass code. */
+    1,                               /* Common AT commands protocol. */
+    0,                               /* Function string index. */
+
     /* Interface0. */
     sizeof(USB_SD_Interface),        /* Size of the descriptor in bytes. */
     USB_SD_INTERFACE,                /* Interface descriptor type. */
@@ -113,7 +181,7 @@ static const rom struct
     USB_SD_INTERFACE,                /* Interface descriptor type. */
     1,
     0,
-    1,                               /* Two endpoints. */
+    2,                               /* Two endpoints. */
     0x0A,                            /* Data interface class. */
     0,
     0,
@@ -125,7 +193,62 @@ static const rom struct
     USB_ENDPOINT_ADDRESS_1I,         /* Endpoint address. */
     2,                               /* Bulk. */
     64,
-    0
+    0,
+
+    /* Endpoint1O. */
+    sizeof(USB_SD_Endpoint),
+    USB_SD_ENDPOINT,                 /* Endpoint descriptor type. */
+    USB_ENDPOINT_ADDRESS_1O,         /* Endpoint address. */
+    2,                               /* Bulk. */
+    64,
+    0,
+
+    /* Interface2. */
+    sizeof(USB_SD_Interface),
+    USB_SD_INTERFACE,                /* Interface descriptor type. */
+    2,
+    0,
+    1,                               /* One endpoint. */
+    0xFF,                            /* Vendor specific class. */
+    0,
+    0,
+    0,
+
+    /* Endpoint2. */
+    sizeof(USB_SD_Endpoint),
+    USB_SD_ENDPOINT,                 /* Endpoint descriptor type. */
+    USB_ISO_ENDPOINT_ADDRESS,        /* Endpoint address. */
+    0x05,                            /* Isochronous, asynchronous, data. */
+    DK_USB_ISO_PACKET_SIZE,
+    1,                               /* One packet every frame. */
+
+    /* Interface3. */
+    sizeof(USB_SD_Interface),
+    USB_SD_INTERFACE,                /* Interface descriptor type. */
+    USB_HID_INTERFACE,
+    0,
+    1,                               /* One endpoint. */
+    USB_HID_CC_HID,                  /* HID class code. */
+    0,                               /* No boot interface. */
+    0,
+    0,
+
+    /* Hid3. */
+    sizeof(USB_HID_Descriptor),      /* Size of the descriptor in bytes. */
+    USB_HID_SD_HID,                  /* HID descriptor type. */
+    0x0111,                          /* HID 1.11. */
+    0,                               /* Not localized. */
+    1,                               /* One class descriptor, */
+    USB_HID_SD_REPORT,               /* the report descriptor. */
+    sizeof(HidReportDescriptor),
+
+    /* Endpoint3. */
+    sizeof(USB_SD_Endpoint),
+    USB_SD_ENDPOINT,                 /* Endpoint descriptor type. */
+    USB_HID_ENDPOINT_ADDRESS,        /* Endpoint address. */
+    3,                               /* Interrupt. */
+    USB_HID_REPORT_SIZE,
+    1                                /* Polled every frame. */
   };
 
 
@@ -162,20 +285,106 @@ Global variables.
 *******************************************************************************/
 #pragma idata USB_BufferDescriptors = 0x400 /* Begin specific initialized data
                                                region. */
-  /* Table is defined as [Buffer Number][Output/Input], where the output buffer
-     is zero, and input buffer is one. */
-  static volatile USB_BufferDescriptor BufferDescriptorTable[16][2] = {0};
+  /* Table is laid out for ping pong buffering on every endpoint but zero; see
+     USB_BD. */
+  static volatile USB_BufferDescriptor BufferDescriptorTable[USB_BD_COUNT] = {0};
+#pragma udata  /* Return to default data region. */
+
+/* The game controller's reports are small enough to share the table's bank.
+   They follow it directly, so the rest of the bank is left whole for data;
+   see DK_LinkerScript.lkr. */
+#pragma udata USB_ReportBuffers = 0x438 /* Begin specific uninitialized data
+                                           region. */
+  static volatile unsigned char Buffer_EP3IE[USB_HID_REPORT_SIZE]; /* Reports,
+                                                                   even. */
+  static volatile unsigned char Buffer_EP3IO[USB_HID_REPORT_SIZE]; /* Reports,
+                                                                   odd. */
 #pragma udata  /* Return to default data region. */
 
+#ifdef DK_USB_MODEL
+  /* The model's SIE finds the table here rather than at 0x400. */
+  volatile USB_BufferDescriptor * const DK_USB_ModelTable =
+    BufferDescriptorTable;
+#endif
+
 /* The following data region is an unitialized one, as MPLAB does not like to
    initialize across banks, which these endpoint buffers may very well be. */
 #pragma udata USB_EndpointBuffers = 0x500 /* Begin specific uninitialized data
                                              region. */
   static volatile USB_ENDPOINT(64) Buffer_EP0O; /* Setup output. */
   static volatile USB_ENDPOINT(64) Buffer_EP0I; /* Setup input. */
-  static volatile USB_ENDPOINT(64) Buffer_EP1I; /* CDC input. */
+  static volatile USB_ENDPOINT(64) Buffer_EP1IE; /* CDC input, even. */
+  static volatile USB_ENDPOINT(64) Buffer_EP1IO; /* CDC input, odd. */
+#pragma udata  /* Return to default data region. */
+
+#pragma udata USB_OutputBuffers = 0x600 /* Begin specific uninitialized data
+                                           region. */
+  static volatile USB_ENDPOINT(64) Buffer_EP1OE; /* CDC output, even. */
+  static volatile USB_ENDPOINT(64) Buffer_EP1OO; /* CDC output, odd. */
+  static volatile unsigned char Buffer_EP2IE[DK_USB_ISO_PACKET_SIZE]; /* Samples,
+                                                                      even. */
+  static volatile unsigned char Buffer_EP2IO[DK_USB_ISO_PACKET_SIZE]; /* Samples,
+                                                                      odd. */
+#pragma udata  /* Return to default data region. */
+
+/* The CDC data rings start the last USB bank.  On the PIC18F4550 they leave
+   the rest of it to kernel and driver data; see DK_LinkerScript.lkr. */
+#pragma udata USB_Rings = 0x700 /* Begin specific uninitialized data region. */
+  static unsigned char TxRing[DK_USB_TX_RING_SIZE];
+  static unsigned char RxRing[DK_USB_RX_RING_SIZE];
 #pragma udata  /* Return to default data region. */
 
+/* The input side of each ping pong endpoint: which of its buffer descriptors is
+   to be filled next, and the data toggle of the packet that goes in it.  The
+   SIE sends from the even and odd descriptors alternately, so one can be
+   filled while the other is on the wire. */
+static struct
+{
+  unsigned char Odd,
+                DataToggle;
+} InputState[USB_ENDPOINTS] = {0};
+
+
+/* The output side of each ping pong endpoint: which of its buffer descriptors
+   the SIE fills next.  Packets are taken out in the same order. */
+static unsigned char OutputOdd[USB_ENDPOINTS] = {0};
+
+/* The transmit ring.  DK_USB_Write and DK_USB_SendCharacter add at TxHead, and
+   DK_USB_Transmit takes from TxTail.  Both count freely and are masked into
+   the ring, so their difference is the number of bytes queued. */
+static volatile unsigned char TxHead = 0,
+                              TxTail = 0;
+
+/* Set when the last packet sent was full, so a zero length packet is owed if
+   no more data follows. */
+static volatile unsigned char TxZeroLengthPending = FALSE;
+
+/* The receive ring.  DK_USB_Receive adds at RxHead, and DK_USB_Read takes from
+   RxTail, in the same way as the transmit ring. */
+static volatile unsigned char RxHead = 0,
+                              RxTail = 0;
+
+/* The rest of a control read longer than one packet, sent a packet at a time
+   as the host collects each. */
+static DK_DangerousPointer ControlData = {0, 0};
+static unsigned char ControlRemaining = 0,
+                     ControlZeroLengthPending = FALSE;
+
+/* The isochronous endpoint.  A frame committed by the producer waits in its
+   ping pong buffer for the next start of frame, while the other buffer is on
+   the wire. */
+static struct
+{
+  unsigned char Committed,
+                Length;
+
+  unsigned long Underruns,
+                Overruns;
+} IsoState = {0};
+
+/* The game controller's latest input report, also returned by GET_REPORT. */
+static unsigned char HidReport[USB_HID_REPORT_SIZE] = {0};
+
 
 static const rom void * const rom DeviceStringTable[] = { &DeviceString0,
                                                           &DeviceString1,
@@ -189,6 +398,21 @@ static signed DK_USB_Reset(void);
 static signed DK_USB_GetDescriptor( DK_DangerousPointer * pdPacketData,
                                     unsigned char * Length );
 static signed DK_USB_StandardRequestHandler(void);
+static volatile USB_BufferDescriptor * DK_USB_GetInputBuffer(
+  unsigned char Endpoint );
+static void DK_USB_QueueInputBuffer( unsigned char Endpoint,
+                                     volatile USB_BufferDescriptor *
+                                       BufferDescriptor,
+                                     unsigned char bLength );
+static void DK_USB_Transmit(void);
+static void DK_USB_ArmOutputBuffer( unsigned char Endpoint,
+                                    unsigned char Odd );
+static void DK_USB_Receive(void);
+static void DK_USB_StartReceive(void);
+static void DK_USB_ContinueControlRead(void);
+static void DK_USB_ScheduleIso(void);
+static signed DK_USB_GetReport( DK_DangerousPointer * pdPacketData,
+                                unsigned char * Length );
                                     
 signed DK_USB_Start(void)
 {
@@ -244,6 +468,46 @@ static signed DK_USB_Reset(void)
   /* Enable endpoint one input. */
   UEP1bits.EPINEN = 1;
 
+  /* Enable endpoint two input.  It is isochronous, so it does no
+     handshakes. */
+  UEP2bits.EPINEN = 1;
+
+  /* Enable endpoint three handshakes and input. */
+  UEP3bits.EPHSHK = 1;
+  UEP3bits.EPINEN = 1;
+
+  /* Point the SIE back at the even buffer descriptors, and forget any packets
+     queued on them. */
+  UCONbits.PPBRST = 1;
+
+  memset( (void *)InputState,
+          0,
+          sizeof(InputState) );
+
+  BufferDescriptorTable[USB_BD(1, 1, 0)].STAT = USB_BD_DTSEN;
+  BufferDescriptorTable[USB_BD(1, 1, 1)].STAT = USB_BD_DTSEN;
+  BufferDescriptorTable[USB_BD(USB_HID_ENDPOINT, 1, 0)].STAT = USB_BD_DTSEN;
+  BufferDescriptorTable[USB_BD(USB_HID_ENDPOINT, 1, 1)].STAT = USB_BD_DTSEN;
+
+  /* Isochronous packets are always DATA0 at full speed and are never
+     synchronized. */
+  BufferDescriptorTable[USB_BD(USB_ISO_ENDPOINT, 1, 0)].STAT = 0;
+  BufferDescriptorTable[USB_BD(USB_ISO_ENDPOINT, 1, 1)].STAT = 0;
+  IsoState.Committed = FALSE;
+
+  ControlRemaining = 0;
+  ControlZeroLengthPending = FALSE;
+
+  /* Ready endpoint one for the host's first two packets. */
+  memset( (void *)OutputOdd,
+          0,
+          sizeof(OutputOdd) );
+
+  DK_USB_ArmOutputBuffer(1, 0);
+  DK_USB_ArmOutputBuffer(1, 1);
+
+  UCONbits.PPBRST = 0;
+
   /* Clear assigned USB address. */
   UADDR = 0;
 
@@ -262,6 +526,23 @@ signed DK_USB_Initialize(void)
    Result:
    DK_SUCCESS if successful. */ 
    
+  /* Assign the buffer locations.  DK_USB_Reset arms the output buffers, so
+     this comes first. */
+  BufferDescriptorTable[USB_BD_EP0O].ADR = (unsigned char *)(&Buffer_EP0O);
+  BufferDescriptorTable[USB_BD_EP0I].ADR = (unsigned char *)(&Buffer_EP0I);
+  BufferDescriptorTable[USB_BD(1, 0, 0)].ADR = (unsigned char *)(&Buffer_EP1OE);
+  BufferDescriptorTable[USB_BD(1, 0, 1)].ADR = (unsigned char *)(&Buffer_EP1OO);
+  BufferDescriptorTable[USB_BD(1, 1, 0)].ADR = (unsigned char *)(&Buffer_EP1IE);
+  BufferDescriptorTable[USB_BD(1, 1, 1)].ADR = (unsigned char *)(&Buffer_EP1IO);
+  BufferDescriptorTable[USB_BD(USB_ISO_ENDPOINT, 1, 0)].ADR
+    = (unsigned char *)Buffer_EP2IE;
+  BufferDescriptorTable[USB_BD(USB_ISO_ENDPOINT, 1, 1)].ADR
+    = (unsigned char *)Buffer_EP2IO;
+  BufferDescriptorTable[USB_BD(USB_HID_ENDPOINT, 1, 0)].ADR
+    = (unsigned char *)Buffer_EP3IE;
+  BufferDescriptorTable[USB_BD(USB_HID_ENDPOINT, 1, 1)].ADR
+    = (unsigned char *)Buffer_EP3IO;
+
   DK_USB_Reset();
 
   /* Eye pattern test disabled.  Only enable this when debugging and not
@@ -280,9 +561,10 @@ signed DK_USB_Initialize(void)
   /* Enable full-speed mode. */
   UCFGbits.FSEN   = 1;
 
-  /* No ping pong buffering. */
-  UCFGbits.PPB1    = 0;
-  UCFGbits.PPB0    = 0;
+  /* Ping pong buffering on every endpoint but zero, whose control transfers
+     are lockstep anyway. */
+  UCFGbits.PPB1    = 1;
+  UCFGbits.PPB0    = 1;
   
   /* Clear out single ended zero flag. */
   UCONbits.SE0 = 0;
@@ -296,21 +578,18 @@ signed DK_USB_Initialize(void)
   /* Device is awake, exit suspend mode. */
   UCONbits.SUSPND = 0;
   
-  /* Assign the buffer locations. */
-  BufferDescriptorTable[0][0].ADR = (unsigned char *)(&Buffer_EP0O);
-  BufferDescriptorTable[0][1].ADR = (unsigned char *)(&Buffer_EP0I);
-  BufferDescriptorTable[1][1].ADR = (unsigned char *)(&Buffer_EP1I);
-  
   /* SIE owns the output buffer; data toggle synchronization enabled. */
-  BufferDescriptorTable[0][0].STAT = 0x88;
+  BufferDescriptorTable[USB_BD_EP0O].STAT = 0x88;
 
   /* MCU owns the buffer; data toggle synchronization enabled. */
-  BufferDescriptorTable[0][1].STAT = 0x08;  
-  BufferDescriptorTable[1][1].STAT = 0x08;
+  BufferDescriptorTable[USB_BD_EP0I].STAT = 0x08;  
+  BufferDescriptorTable[USB_BD(1, 1, 0)].STAT = 0x08;
+  BufferDescriptorTable[USB_BD(1, 1, 1)].STAT = 0x08;
 
-  BufferDescriptorTable[0][0].CNT = 64;  
-  BufferDescriptorTable[0][1].CNT = 0;
-  BufferDescriptorTable[1][1].CNT = 0;
+  BufferDescriptorTable[USB_BD_EP0O].CNT = 64;  
+  BufferDescriptorTable[USB_BD_EP0I].CNT = 0;
+  BufferDescriptorTable[USB_BD(1, 1, 0)].CNT = 0;
+  BufferDescriptorTable[USB_BD(1, 1, 1)].CNT = 0;
 
   /*  Disable all USB interrupts. */
   UIE = 0;
@@ -321,6 +600,9 @@ signed DK_USB_Initialize(void)
 
   /* Enable reset interrupts. */
   UIEbits.URSTIE = 1;
+
+  /* Enable start of frame interrupts, for DK_USB_FrameTrigger. */
+  UIEbits.SOFIE = 1;
   
   /* Clear out global USB interrupt flag. */
   PIR2bits.USBIF = 0;
@@ -337,230 +619,944 @@ signed DK_USB_Initialize(void)
 
 signed DK_USB_SendCharacter( unsigned char Character )
 {
-/* This function transmits a single character.  This function should not be used
-   in a loop as a means to transmit an array, as this function makes an entire
-   packet of one character.
+/* This function queues a single character on the transmit ring.  Unlike
+   DK_USB_Write it never waits, so it may be called from DK_QuantumTrigger or
+   an interrupt handler.  The slot is claimed and filled with the global
+   interrupt enable held off, so those callers may interrupt a task that is
+   queueing too.  It is restored rather than set, so interrupts are not
+   enabled early inside a handler.
    
    Result:
-   DK_SUCCESS if successful, DK_FAILURE if USB buffer is unavailable. */
+   DK_SUCCESS if successful, DK_FAILURE if the transmit ring is full. */
   
-  unsigned Result = 0;
-  
-  /* Make a dangerous pointer. */
-  DK_DangerousPointer pdCharacter;
-  pdCharacter.IsROMPointer = FALSE;
-  pdCharacter.Anywhere.pRAM = (near ram unsigned char *)&Character;
+  signed Result = DK_FAILURE;
+  unsigned char InterruptsEnabled = INTCONbits.GIE;
 
-  Result = DK_USB_SendPacket( (USB_BufferDescriptor *)
-                                &BufferDescriptorTable[1][1],
-                              pdCharacter,
-                              1 );
+  INTCONbits.GIE = 0;
+
+  if( (unsigned char)(TxHead - TxTail) < (unsigned)DK_USB_TX_RING_SIZE )
+  {
+    Result = DK_SUCCESS;
+
+    TxRing[TxHead & (DK_USB_TX_RING_SIZE - 1)] = Character;
+    ++TxHead;
+
+    DK_USB_Transmit();
+  }
+
+  INTCONbits.GIE = InterruptsEnabled;
 
   return Result;
 }
 
 
-signed DK_USB_SendPacket( USB_BufferDescriptor * BufferDescriptor,
-                          DK_DangerousPointer pdPacketData,
-                          unsigned char bLength )
+signed DK_USB_Write( const unsigned char * pData,
+                     unsigned short Length )
 {
-/* This function transmits the contents of the array pointed to by pdPacketData
-   in packets up to 64 bytes in size.  Assuming the buffer is free, transmission
-   is guaranteed, allowing zero length packets to be sent.
+/* This function streams Length bytes to the host on endpoint one.  The data is
+   copied to the transmit ring and sent from there in full sized packets, as
+   fast as the host collects them.  While the ring is full the calling task
+   yields rather than dropping data, so this must be called from a task other
+   than the idle task.  Space is claimed and filled with the global interrupt
+   enable held off, so DK_USB_SendCharacter may be called meanwhile from an
+   interrupt handler, but the data of two tasks writing at once interleaves.
    
    Parameters:
-   BufferDescriptor     A pointer to the buffer descriptor for the endpoint
-                        buffer to be used.
-   pdPacketData         A ROM / RAM contstruct containing a pointer to the data
-                        to be sent, as well as a boolean for the pointer type.
-   bLength              The size in bytes of the data from zero to 64.
+   pData   The data to send.
+   Length  The number of bytes to send.
 
    Result:
-   DK_SUCCESS if successful, DK_FAILURE if USB buffer is unavailable. */
+   DK_SUCCESS once all of the data is queued. */
 
-  signed Result = DK_FAILURE;
+  unsigned char Free = 0;
+  unsigned char InterruptsEnabled = 0;
 
-  if((BufferDescriptor->STAT & 128) == 0)
+  while(Length != 0)
   {
-    /* MCU owns the buffer, so it is safe to write to. */
-    Result = DK_SUCCESS;
-    
-    /* Copy from ROM / RAM to the USB buffer. */
-    if(pdPacketData.IsROMPointer == (unsigned)TRUE)
+    InterruptsEnabled = INTCONbits.GIE;
+    INTCONbits.GIE = 0;
+
+    Free = DK_USB_TX_RING_SIZE - (unsigned char)(TxHead - TxTail);
+
+    if(Free == (unsigned)0)
     {
-      memcpypgm2ram( BufferDescriptor->ADR,
-                     (const far rom void *)pdPacketData.Anywhere.pROM,
-                     bLength);
+      INTCONbits.GIE = InterruptsEnabled;
+
+      /* Let the other tasks run while the host drains the ring. */
+      DK_InvokeScheduler();
+      continue;
     }
-    else
+
+    if(Length < Free)
     {
-      memcpy( (void *)BufferDescriptor->ADR,
-              (const void *)pdPacketData.Anywhere.pRAM,
-              bLength);
+      Free = (unsigned char)Length;
     }
 
-    /* Update the packet size. */
-    BufferDescriptor->CNT = bLength;
-    
-    /* Give control to the USB SIE, but preserve the DTS bit. */
-    BufferDescriptor->STAT &= 0x40;
+    Length -= Free;
 
-    /* Toggle the DTS bit. */
-    BufferDescriptor->STAT ^= 0x40;
+    /* No more than the ring holds is copied with interrupts held off. */
+    while(Free != (unsigned)0)
+    {
+      TxRing[TxHead & (DK_USB_TX_RING_SIZE - 1)] = *pData;
+      ++pData;
+      ++TxHead;
+      --Free;
+    }
+
+    DK_USB_Transmit();
 
-    /* SIE owns the buffer; data toggle synchronization enabled. */
-    BufferDescriptor->STAT |= 0x88;
+    INTCONbits.GIE = InterruptsEnabled;
   }
 
-  return Result;
+  return DK_SUCCESS;
 }
 
 
-static signed DK_USB_GetDescriptor( DK_DangerousPointer * pdPacketData,
-                                    unsigned char * Length )
+signed DK_USB_Read( unsigned char * pData,
+                    unsigned short Length )
 {
-/* This function examines the descriptor request and assigns a data pointer and
-   data length to the passed in parameters.
+/* This function reads Length bytes sent by the host on endpoint one.  The
+   calling task yields until they have all arrived, so this must be called from
+   a task other than the idle task, and from only one task at a time.
    
    Parameters:
-   pdPacketData   A pointer to a DK_DangerousPointer to store a pointer to the
-                  appropriate packet data.
-   Length         A pointer to store the length of the packet data in.
-   
-   Result:
-   TRUE if the request is supported, FALSE if the request is not supported. */
-
-  signed Result = DK_FAILURE;
-  
-  if(Buffer_EP0O.bmRequestType == 0x80)
-  {
-    /* The request is from the host. */
-    
-    switch(Buffer_EP0O.DescriptorType)
-    {
-      case USB_SD_DEVICE:
-      {
-        pdPacketData->IsROMPointer = TRUE;
-        pdPacketData->Anywhere.pROM
-          = (far rom unsigned char *)&DeviceDescriptor;
+   pData   The storage location for the data.
+   Length  The number of bytes to read.
 
-        *Length = sizeof(DeviceDescriptor);
-        
-        /* The request is supported. */
-        Result = TRUE;
-      }
-      break;
+   Result:
+   DK_SUCCESS once all of the data is read. */
 
-      case USB_SD_CONFIGURATION:
-      {
-        pdPacketData->IsROMPointer = TRUE;
-        pdPacketData->Anywhere.pROM = (far rom unsigned char *)&SetupPacket;
+  unsigned char Count = 0;
 
-        *Length = sizeof(SetupPacket);
+  while(Length != 0)
+  {
+    /* Only the USB interrupt moves RxHead, and it only ever adds data. */
+    Count = RxHead - RxTail;
 
-        /* The request is supported. */
-        Result = TRUE;
-      }
-      break;
+    if(Count == (unsigned)0)
+    {
+      /* Let the other tasks run while the host sends more. */
+      DK_InvokeScheduler();
+      continue;
+    }
 
-      case USB_SD_STRING:
-      {
-        pdPacketData->IsROMPointer = TRUE;
-        pdPacketData->Anywhere.pROM =
-          (far rom unsigned char *)
-            (DeviceStringTable[Buffer_EP0O.DescriptorIndex]);
+    if(Length < Count)
+    {
+      Count = (unsigned char)Length;
+    }
 
-        /* Access the bLength member of the DeviceString (each device string is
-        an anonymous struct and cannot be accessed with ->). */
-        *Length = *(pdPacketData->Anywhere.pROM);
+    Length -= Count;
 
-        /* The request is supported. */
-        Result = TRUE;
-      }
-      break;
-      
-      default:
-      {
-        /* The request is not supported. */
-        Result = FALSE;
-      }
-      break;
+    while(Count != (unsigned)0)
+    {
+      *pData = RxRing[RxTail & (DK_USB_RX_RING_SIZE - 1)];
+      ++pData;
+      ++RxTail;
+      --Count;
     }
+
+    /* There is room in the ring again, so take any packet the host was being
+       held off with. */
+    DK_USB_StartReceive();
   }
-  
-  return Result;
+
+  return DK_SUCCESS;
 }
 
 
-void DK_USB_ISR(void)
+static volatile USB_BufferDescriptor * DK_USB_GetInputBuffer(
+  unsigned char Endpoint )
 {
-/* This function checks each of the flags in the USB interrupt register and
-   calls the appropriate functions for each flag. */
+/* This function finds the buffer descriptor the next packet on an input
+   endpoint goes in.
 
-  if(UIRbits.SOFIF == (unsigned)1)
+   Parameters:
+   Endpoint  The input endpoint.
+
+   Result:
+   The buffer descriptor, or zero if the SIE still owns it. */
+
+  volatile USB_BufferDescriptor * BufferDescriptor = 0;
+
+  if(Endpoint == (unsigned)0)
   {
-    /* Clear out the SOF flag. */
-    UIRbits.SOFIF = 0;
+    BufferDescriptor = &BufferDescriptorTable[USB_BD_EP0I];
   }
-  
-  if(UIRbits.STALLIF == (unsigned)1)
+  else if(Endpoint < (unsigned)USB_ENDPOINTS)
   {
-    /*  Stall handshake (unsupported control request, control request failed,
-        or endpoint failed). */
-
-    /* Clear out stall flag. */
-    UIRbits.STALLIF = 0;
+    BufferDescriptor
+      = &BufferDescriptorTable[USB_BD(Endpoint, 1, InputState[Endpoint].Odd)];
   }
-  
-  if(UIRbits.IDLEIF == (unsigned)1)
+
+  if( BufferDescriptor != 0 && (BufferDescriptor->STAT & USB_BD_UOWN) != 0 )
   {
-    /* Idle condition detected. */
-        
-    /* Clear out the idle flag. */
-    UIRbits.IDLEIF = 0;
+    BufferDescriptor = 0;
   }
+
+  return BufferDescriptor;
+}
+
+
+static void DK_USB_QueueInputBuffer( unsigned char Endpoint,
+                                     volatile USB_BufferDescriptor *
+                                       BufferDescriptor,
+                                     unsigned char bLength )
+{
+/* This function hands a filled buffer from DK_USB_GetInputBuffer to the SIE.
+
+   Parameters:
+   Endpoint          The input endpoint.
+   BufferDescriptor  The buffer descriptor, holding the packet.
+   bLength           The size in bytes of the packet from zero to 64. */
+
+  /* Update the packet size. */
+  BufferDescriptor->CNT = bLength;
   
-  if(UIRbits.TRNIF == (unsigned)1)
+  if(Endpoint == (unsigned)0)
   {
-    /* Transaction complete. */
+    /* Give control to the USB SIE, but preserve the DTS bit. */
+    BufferDescriptor->STAT &= 0x40;
 
-    if(USTAT == (unsigned)0x04)
+    /* Toggle the DTS bit. */
+    BufferDescriptor->STAT ^= 0x40;
+  }
+  else
+  {
+    /* The even and odd descriptors each hold only every other packet's DTS
+       bit, so the toggle is kept here. */
+    if(InputState[Endpoint].DataToggle != 0)
     {
-      /* Last transaction was an IN token to endpoint zero. */
-  
-      if(UADDR == (unsigned)0) 
-      {
-        /* No address has been assigned yet, set the address. */
-        UADDR = Buffer_EP0O.Address;
-      }
-
-      /* Reset the output buffer. */
-      BufferDescriptorTable[0][0].CNT = 64;
-      
-      /* SIE owns the buffer. */
-      BufferDescriptorTable[0][0].STAT |= 0x80;
+      BufferDescriptor->STAT = USB_BD_DTS;
     }
-    else if(USTAT == (unsigned)0x00)
+    else
     {
-      /* Last transaction was an OUT or SETUP token to endpoint zero. */
-  
-      if( ((BufferDescriptorTable[0][0].STAT << 2) >> 4)
-          == (unsigned)USB_PID_TOKEN_SETUP )
-      {
-        DK_USB_StandardRequestHandler();
-      }
+      BufferDescriptor->STAT = 0;
     }
 
-    /* Clear transaction complete flag. */
-    UIRbits.TRNIF = 0;  
+    InputState[Endpoint].DataToggle ^= 1;
+
+    /* The SIE takes the other descriptor next. */
+    InputState[Endpoint].Odd ^= 1;
   }
 
-  if(UIRbits.ACTVIF == (unsigned)1)
-  {
-    /* Bus activity detected. */
-    
-    /* Kick out of suspend mode. */
-    UCONbits.SUSPND = 0;
+  /* SIE owns the buffer; data toggle synchronization enabled.  UOWN is set
+     last, once the rest of the descriptor is in place. */
+  BufferDescriptor->STAT |= 0x88;
+}
+
+
+unsigned char * DK_USB_AcquireTxBuffer( unsigned char Endpoint )
+{
+/* This function lends out the endpoint buffer the next packet on an input
+   endpoint goes in, so that the packet can be built in place rather than
+   copied there.  Finish with DK_USB_CommitTxBuffer.  The transmit ring owns
+   endpoint one while it has data, so do not mix this with DK_USB_Write or
+   DK_USB_SendCharacter.
+   
+   Parameters:
+   Endpoint  The input endpoint to send on.
+
+   Result:
+   A pointer to 64 bytes of USB RAM, or zero if the SIE still owns the
+   buffer. */
+
+  unsigned char * pBuffer = 0;
+  volatile USB_BufferDescriptor * BufferDescriptor
+    = DK_USB_GetInputBuffer(Endpoint);
+
+  if(BufferDescriptor != 0)
+  {
+    pBuffer = BufferDescriptor->ADR;
+  }
+
+  return pBuffer;
+}
+
+
+signed DK_USB_CommitTxBuffer( unsigned char Endpoint,
+                              unsigned char bLength )
+{
+/* This function sends the packet built in the buffer returned by
+   DK_USB_AcquireTxBuffer.
+   
+   Parameters:
+   Endpoint  The input endpoint to send on.
+   bLength   The size in bytes of the packet from zero to 64.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if no buffer was acquired. */
+
+  signed Result = DK_FAILURE;
+  volatile USB_BufferDescriptor * BufferDescriptor = 0;
+  unsigned char InterruptsEnabled = INTCONbits.GIE;
+
+  /* The buffer descriptor and the ping pong state must change together. */
+  INTCONbits.GIE = 0;
+
+  BufferDescriptor = DK_USB_GetInputBuffer(Endpoint);
+
+  if(BufferDescriptor != 0)
+  {
+    Result = DK_SUCCESS;
+    DK_USB_QueueInputBuffer(Endpoint, BufferDescriptor, bLength);
+  }
+
+  INTCONbits.GIE = InterruptsEnabled;
+
+  return Result;
+}
+
+
+signed DK_USB_SendPacket( unsigned char Endpoint,
+                          DK_DangerousPointer pdPacketData,
+                          unsigned char bLength )
+{
+/* This function transmits the contents of the array pointed to by pdPacketData
+   in packets up to 64 bytes in size.  Assuming the buffer is free, transmission
+   is guaranteed, allowing zero length packets to be sent.  Endpoints other
+   than zero are ping pong buffered, so a second packet may be queued while the
+   first is still waiting for the host.
+   
+   Parameters:
+   Endpoint             The input endpoint to send on.
+   pdPacketData         A ROM / RAM contstruct containing a pointer to the data
+                        to be sent, as well as a boolean for the pointer type.
+   bLength              The size in bytes of the data from zero to 64.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if USB buffer is unavailable. */
+
+  signed Result = DK_FAILURE;
+  volatile USB_BufferDescriptor * BufferDescriptor
+    = DK_USB_GetInputBuffer(Endpoint);
+
+  if(BufferDescriptor != 0)
+  {
+    /* MCU owns the buffer, so it is safe to write to. */
+    Result = DK_SUCCESS;
+    
+    /* Copy from ROM / RAM to the USB buffer. */
+    if(pdPacketData.IsROMPointer == (unsigned)TRUE)
+    {
+      memcpypgm2ram( BufferDescriptor->ADR,
+                     (const far rom void *)pdPacketData.Anywhere.pROM,
+                     bLength);
+    }
+    else
+    {
+      memcpy( (void *)BufferDescriptor->ADR,
+              (const void *)pdPacketData.Anywhere.pRAM,
+              bLength);
+    }
+
+    DK_USB_QueueInputBuffer(Endpoint, BufferDescriptor, bLength);
+  }
+
+  return Result;
+}
+
+
+signed DK_USB_SendReport( const unsigned char * pReport )
+{
+/* This function sends an input report from the game controller's HID
+   interface.  The host polls for it every frame.  The report is also kept for
+   GET_REPORT, even if it could not be queued.
+
+   Parameters:
+   pReport  The report, USB_HID_REPORT_SIZE bytes laid out as described at
+            USB_HID_REPORT_SIZE.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if both of the endpoint's buffers are
+   still waiting for the host. */
+
+  signed Result = DK_FAILURE;
+  DK_DangerousPointer pdReport = {0, 0};
+  unsigned char InterruptsEnabled = INTCONbits.GIE;
+
+  /* GET_REPORT may read the report from the USB interrupt. */
+  INTCONbits.GIE = 0;
+
+  memcpy( (void *)HidReport,
+          (const void *)pReport,
+          USB_HID_REPORT_SIZE );
+
+  pdReport.Anywhere.pRAM = HidReport;
+  pdReport.IsROMPointer = FALSE;
+
+  Result = DK_USB_SendPacket( USB_HID_ENDPOINT,
+                              pdReport,
+                              USB_HID_REPORT_SIZE );
+
+  INTCONbits.GIE = InterruptsEnabled;
+
+  return Result;
+}
+
+
+static void DK_USB_Transmit(void)
+{
+/* This function moves data from the transmit ring into whichever of endpoint
+   one's input buffers are free, up to a full packet each.  A transfer ends
+   with a short packet, so if the ring runs dry right after a full one, a zero
+   length packet follows once it is collected.  Called with interrupts
+   disabled. */
+
+  volatile USB_BufferDescriptor * BufferDescriptor = 0;
+  unsigned char Count = 0,
+                Index = 0;
+
+  while(1)
+  {
+    Count = TxHead - TxTail;
+
+    if(Count == (unsigned)0)
+    {
+      /* Only end the transfer once nothing else is on the wire, in case more
+         data arrives in the meantime. */
+      if( TxZeroLengthPending == FALSE ||
+          (BufferDescriptorTable[USB_BD(1, 1, 0)].STAT & USB_BD_UOWN) != 0 ||
+          (BufferDescriptorTable[USB_BD(1, 1, 1)].STAT & USB_BD_UOWN) != 0 )
+      {
+        break;
+      }
+    }
+
+    BufferDescriptor = DK_USB_GetInputBuffer(1);
+
+    if(BufferDescriptor == 0)
+    {
+      break;
+    }
+
+    if(Count > (unsigned)64)
+    {
+      Count = 64;
+    }
+
+    for(Index = 0; Index < Count; ++Index)
+    {
+      BufferDescriptor->ADR[Index]
+        = TxRing[(unsigned char)(TxTail + Index) & (DK_USB_TX_RING_SIZE - 1)];
+    }
+
+    TxTail += Count;
+    TxZeroLengthPending = (Count == (unsigned)64);
+
+    DK_USB_QueueInputBuffer(1, BufferDescriptor, Count);
+  }
+}
+
+
+static void DK_USB_ArmOutputBuffer( unsigned char Endpoint,
+                                    unsigned char Odd )
+{
+/* This function hands an empty output buffer to the SIE.  The even and odd
+   descriptors take alternate packets, so the even one always expects DATA0
+   and the odd one DATA1.
+
+   Parameters:
+   Endpoint  The output endpoint.
+   Odd       One for the odd buffer descriptor, zero for the even. */
+
+  volatile USB_BufferDescriptor * BufferDescriptor
+    = &BufferDescriptorTable[USB_BD(Endpoint, 0, Odd)];
+
+  BufferDescriptor->CNT = 64;
+
+  if(Odd != 0)
+  {
+    BufferDescriptor->STAT = USB_BD_DTS | USB_BD_DTSEN;
+  }
+  else
+  {
+    BufferDescriptor->STAT = USB_BD_DTSEN;
+  }
+
+  /* UOWN is set last, once the rest of the descriptor is in place. */
+  BufferDescriptor->STAT |= USB_BD_UOWN;
+}
+
+
+static void DK_USB_Receive(void)
+{
+/* This function moves packets the host has sent on endpoint one into the
+   receive ring, and re-arms their buffers.  A packet that does not fit is
+   left where it is.  Its buffer stays with the MCU, so once both have filled
+   the SIE NAKs the host until DK_USB_Read makes room.  Called with interrupts
+   disabled. */
+
+  volatile USB_BufferDescriptor * BufferDescriptor = 0;
+  unsigned char Count = 0,
+                Index = 0;
+
+  while(1)
+  {
+    BufferDescriptor = &BufferDescriptorTable[USB_BD(1, 0, OutputOdd[1])];
+
+    if( (BufferDescriptor->STAT & USB_BD_UOWN) != 0 )
+    {
+      /* The SIE has not filled this buffer yet. */
+      break;
+    }
+
+    Count = BufferDescriptor->CNT;
+
+    if( Count > DK_USB_RX_RING_SIZE - (unsigned char)(RxHead - RxTail) )
+    {
+      break;
+    }
+
+    for(Index = 0; Index < Count; ++Index)
+    {
+      RxRing[(unsigned char)(RxHead + Index) & (DK_USB_RX_RING_SIZE - 1)]
+        = BufferDescriptor->ADR[Index];
+    }
+
+    RxHead += Count;
+
+    DK_USB_ArmOutputBuffer(1, OutputOdd[1]);
+    OutputOdd[1] ^= 1;
+  }
+}
+
+
+static void DK_USB_StartReceive(void)
+{
+/* This function runs DK_USB_Receive from a task.  The global interrupt enable
+   is restored rather than set, as DK_USB_SendCharacter does. */
+
+  unsigned char InterruptsEnabled = INTCONbits.GIE;
+
+  INTCONbits.GIE = 0;
+  DK_USB_Receive();
+  INTCONbits.GIE = InterruptsEnabled;
+}
+
+
+static void DK_USB_ContinueControlRead(void)
+{
+/* This function sends the next packet of a control read that did not fit in
+   one, once the host has collected the last.  Called from DK_USB_ISR. */
+
+  unsigned char bLength = 0;
+
+  if(ControlRemaining != (unsigned)0)
+  {
+    bLength = ControlRemaining;
+
+    if(bLength > (unsigned)64)
+    {
+      bLength = 64;
+    }
+
+    if(DK_USB_SendPacket(0, ControlData, bLength) == DK_SUCCESS)
+    {
+      ControlRemaining -= bLength;
+
+      if(ControlData.IsROMPointer == (unsigned)TRUE)
+      {
+        ControlData.Anywhere.pROM += bLength;
+      }
+      else
+      {
+        ControlData.Anywhere.pRAM += bLength;
+      }
+    }
+  }
+  else if(ControlZeroLengthPending != FALSE)
+  {
+    if(DK_USB_SendPacket(0, ControlData, 0) == DK_SUCCESS)
+    {
+      ControlZeroLengthPending = FALSE;
+    }
+  }
+}
+
+
+unsigned char * DK_USB_AcquireIsoFrame(void)
+{
+/* This function lends out the buffer for the next frame of samples on the
+   isochronous endpoint.  Fill up to DK_USB_ISO_PACKET_SIZE bytes and pass the
+   length to DK_USB_CommitIsoFrame; the frame goes out during the USB frame
+   after the next start of frame.  Producers usually do this from
+   DK_USB_FrameTrigger, once per frame.
+
+   Result:
+   A pointer to DK_USB_ISO_PACKET_SIZE bytes of USB RAM, or zero if a frame is
+   already committed and waiting, or the host has not yet collected the one
+   that was last in this buffer. */
+
+  unsigned char * pBuffer = 0;
+  volatile USB_BufferDescriptor * BufferDescriptor
+    = &BufferDescriptorTable[ USB_BD(USB_ISO_ENDPOINT, 1,
+                                     InputState[USB_ISO_ENDPOINT].Odd) ];
+
+  if( IsoState.Committed == FALSE &&
+      (BufferDescriptor->STAT & USB_BD_UOWN) == 0 )
+  {
+    pBuffer = BufferDescriptor->ADR;
+  }
+
+  return pBuffer;
+}
+
+
+signed DK_USB_CommitIsoFrame( unsigned char Length )
+{
+/* This function queues the frame built in the buffer returned by
+   DK_USB_AcquireIsoFrame for the next start of frame.  Committing a second
+   frame before then counts as an overrun and the second frame is dropped.
+
+   Parameters:
+   Length  The size in bytes of the frame, up to DK_USB_ISO_PACKET_SIZE.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if the frame was dropped. */
+
+  signed Result = DK_FAILURE;
+  unsigned char InterruptsEnabled = INTCONbits.GIE;
+
+  INTCONbits.GIE = 0;
+
+  if( IsoState.Committed == FALSE &&
+      Length <= (unsigned)DK_USB_ISO_PACKET_SIZE )
+  {
+    Result = DK_SUCCESS;
+
+    IsoState.Length = Length;
+    IsoState.Committed = TRUE;
+  }
+  else
+  {
+    ++IsoState.Overruns;
+  }
+
+  INTCONbits.GIE = InterruptsEnabled;
+
+  return Result;
+}
+
+
+static void DK_USB_ScheduleIso(void)
+{
+/* This function hands the committed frame, if there is one, to the SIE at the
+   start of a frame.  Each frame carries exactly one packet, so the isochronous
+   bandwidth reserved by the descriptor is used deterministically.  Called from
+   DK_USB_ISR. */
+
+  volatile USB_BufferDescriptor * BufferDescriptor
+    = &BufferDescriptorTable[ USB_BD(USB_ISO_ENDPOINT, 1,
+                                     InputState[USB_ISO_ENDPOINT].Odd) ];
+
+  if(IsoState.Committed == FALSE)
+  {
+    /* The producer has nothing for this frame. */
+    ++IsoState.Underruns;
+  }
+  else if( (BufferDescriptor->STAT & USB_BD_UOWN) != 0 )
+  {
+    /* The host has not collected the frame before last, so there is nowhere
+       to put this one. */
+    ++IsoState.Overruns;
+    IsoState.Committed = FALSE;
+  }
+  else
+  {
+    BufferDescriptor->CNT = IsoState.Length;
+
+    /* DATA0, no synchronization; UOWN last. */
+    BufferDescriptor->STAT = 0;
+    BufferDescriptor->STAT |= USB_BD_UOWN;
+
+    InputState[USB_ISO_ENDPOINT].Odd ^= 1;
+    IsoState.Committed = FALSE;
+  }
+}
+
+
+unsigned DK_USB_GetFrameNumber(void)
+{
+/* Result:
+   The number of the current USB frame, from the host's last start of frame
+   token; eleven bits, wrapping every 2.048 seconds. */
+
+  unsigned char High = 0,
+                Low = 0;
+
+  /* The number may roll over between the two reads.  Read the high byte again
+     to catch it. */
+  do
+  {
+    High = UFRMH;
+    Low = UFRML;
+  }
+  while(High != UFRMH);
+
+  return ((unsigned)(High & 0x07) << 8) | Low;
+}
+
+
+unsigned long DK_USB_GetIsoUnderruns(void)
+{
+/* Result:
+   The number of frames the isochronous endpoint had nothing to send in. */
+
+  return IsoState.Underruns;
+}
+
+
+unsigned long DK_USB_GetIsoOverruns(void)
+{
+/* Result:
+   The number of frames of samples the isochronous endpoint dropped. */
+
+  return IsoState.Overruns;
+}
+
+
+static signed DK_USB_GetDescriptor( DK_DangerousPointer * pdPacketData,
+                                    unsigned char * Length )
+{
+/* This function examines the descriptor request and assigns a data pointer and
+   data length to the passed in parameters.
+   
+   Parameters:
+   pdPacketData   A pointer to a DK_DangerousPointer to store a pointer to the
+                  appropriate packet data.
+   Length         A pointer to store the length of the packet data in.
+   
+   Result:
+   TRUE if the request is supported, FALSE if the request is not supported. */
+
+  signed Result = DK_FAILURE;
+  
+  if(Buffer_EP0O.bmRequestType == 0x80)
+  {
+    /* The request is from the host. */
+    
+    switch(Buffer_EP0O.DescriptorType)
+    {
+      case USB_SD_DEVICE:
+      {
+        pdPacketData->IsROMPointer = TRUE;
+        pdPacketData->Anywhere.pROM
+          = (far rom unsigned char *)&DeviceDescriptor;
+
+        *Length = sizeof(DeviceDescriptor);
+        
+        /* The request is supported. */
+        Result = TRUE;
+      }
+      break;
+
+      case USB_SD_CONFIGURATION:
+      {
+        pdPacketData->IsROMPointer = TRUE;
+        pdPacketData->Anywhere.pROM = (far rom unsigned char *)&SetupPacket;
+
+        *Length = sizeof(SetupPacket);
+
+        /* The request is supported. */
+        Result = TRUE;
+      }
+      break;
+
+      case USB_SD_STRING:
+      {
+        pdPacketData->IsROMPointer = TRUE;
+        pdPacketData->Anywhere.pROM =
+          (far rom unsigned char *)
+            (DeviceStringTable[Buffer_EP0O.DescriptorIndex]);
+
+        /* Access the bLength member of the DeviceString (each device string is
+        an anonymous struct and cannot be accessed with ->). */
+        *Length = *(pdPacketData->Anywhere.pROM);
+
+        /* The request is supported. */
+        Result = TRUE;
+      }
+      break;
+      
+      default:
+      {
+        /* The request is not supported. */
+        Result = FALSE;
+      }
+      break;
+    }
+  }
+  else if( Buffer_EP0O.bmRequestType == 0x81 &&
+           Buffer_EP0O.wIndex == (unsigned)USB_HID_INTERFACE )
+  {
+    /* The request is from the host, for the HID interface's class
+       descriptors. */
+
+    switch(Buffer_EP0O.DescriptorType)
+    {
+      case USB_HID_SD_HID:
+      {
+        pdPacketData->IsROMPointer = TRUE;
+        pdPacketData->Anywhere.pROM
+          = (far rom unsigned char *)&SetupPacket.Hid3;
+
+        *Length = sizeof(USB_HID_Descriptor);
+
+        /* The request is supported. */
+        Result = TRUE;
+      }
+      break;
+
+      case USB_HID_SD_REPORT:
+      {
+        pdPacketData->IsROMPointer = TRUE;
+        pdPacketData->Anywhere.pROM
+          = (far rom unsigned char *)HidReportDescriptor;
+
+        *Length = sizeof(HidReportDescriptor);
+
+        /* The request is supported. */
+        Result = TRUE;
+      }
+      break;
+
+      default:
+      {
+        /* The request is not supported. */
+        Result = FALSE;
+      }
+      break;
+    }
+  }
+  
+  return Result;
+}
+
+
+static signed DK_USB_GetReport( DK_DangerousPointer * pdPacketData,
+                                unsigned char * Length )
+{
+/* This function answers the HID class GET_REPORT request with the game
+   controller's latest input report.  Hosts use it to read the controller's
+   state before the first report arrives on the interrupt endpoint.
+
+   Parameters:
+   pdPacketData   A pointer to a DK_DangerousPointer to store a pointer to the
+                  report in.
+   Length         A pointer to store the length of the report in.
+
+   Result:
+   TRUE if the request is supported, FALSE if the request is not supported. */
+
+  signed Result = FALSE;
+
+  if( Buffer_EP0O.bmRequestType == 0xA1 &&
+      Buffer_EP0O.wIndex == (unsigned)USB_HID_INTERFACE &&
+      (Buffer_EP0O.wValue >> 8) == (unsigned)USB_HID_REPORT_INPUT )
+  {
+    pdPacketData->IsROMPointer = FALSE;
+    pdPacketData->Anywhere.pRAM = HidReport;
+
+    *Length = USB_HID_REPORT_SIZE;
+
+    /* The request is supported. */
+    Result = TRUE;
+  }
+
+  return Result;
+}
+
+
+void DK_USB_ISR(void)
+{
+/* This function checks each of the flags in the USB interrupt register and
+   calls the appropriate functions for each flag. */
+
+  if(UIRbits.SOFIF == (unsigned)1)
+  {
+    /* Start of frame, once every millisecond. */
+
+    /* Clear out the SOF flag. */
+    UIRbits.SOFIF = 0;
+
+    /* Hand the frame committed during the last one to the SIE. */
+    DK_USB_ScheduleIso();
+
+    /* Anything queued now goes out in this frame. */
+    DK_USB_FrameTrigger();
+  }
+  
+  if(UIRbits.STALLIF == (unsigned)1)
+  {
+    /*  Stall handshake (unsupported control request, control request failed,
+        or endpoint failed). */
+
+    /* Clear out stall flag. */
+    UIRbits.STALLIF = 0;
+  }
+  
+  if(UIRbits.IDLEIF == (unsigned)1)
+  {
+    /* Idle condition detected. */
+        
+    /* Clear out the idle flag. */
+    UIRbits.IDLEIF = 0;
+  }
+  
+  if(UIRbits.TRNIF == (unsigned)1)
+  {
+    /* Transaction complete. */
+
+    if(USTAT == (unsigned)0x04)
+    {
+      /* Last transaction was an IN token to endpoint zero. */
+  
+      if(UADDR == (unsigned)0) 
+      {
+        /* No address has been assigned yet, set the address. */
+        UADDR = Buffer_EP0O.Address;
+      }
+
+      /* Reset the output buffer. */
+      BufferDescriptorTable[USB_BD_EP0O].CNT = 64;
+      
+      /* SIE owns the buffer. */
+      BufferDescriptorTable[USB_BD_EP0O].STAT |= 0x80;
+
+      DK_USB_ContinueControlRead();
+    }
+    else if(USTAT == (unsigned)0x00)
+    {
+      /* Last transaction was an OUT or SETUP token to endpoint zero. */
+  
+      if( ((BufferDescriptorTable[USB_BD_EP0O].STAT >> 2) & 0x0F)
+          == (unsigned)USB_PID_TOKEN_SETUP )
+      {
+        DK_USB_StandardRequestHandler();
+      }
+    }
+    else if( (USTAT & 0x7C) == (unsigned)0x0C )
+    {
+      /* Last transaction was an IN token to endpoint one, even or odd.  Refill
+         the buffer the host just collected. */
+      DK_USB_Transmit();
+    }
+    else if( (USTAT & 0x7C) == (unsigned)0x08 )
+    {
+      /* Last transaction was an OUT token to endpoint one, even or odd. */
+      DK_USB_Receive();
+    }
+
+    /* Clear transaction complete flag. */
+    UIRbits.TRNIF = 0;  
+  }
+
+  if(UIRbits.ACTVIF == (unsigned)1)
+  {
+    /* Bus activity detected. */
+    
+    /* Kick out of suspend mode. */
+    UCONbits.SUSPND = 0;
 
     /* Clear out active flag. */
     UIRbits.ACTVIF = 0;
@@ -582,6 +1578,12 @@ void DK_USB_ISR(void)
     /* Reset. */
     
     DK_USB_Reset();
+
+    /* The host will not collect anything queued before the reset, and what
+       it sent before belongs to the old session. */
+    TxTail = TxHead;
+    TxZeroLengthPending = FALSE;
+    RxTail = RxHead;
   }
   
   /* Clear out global USB interrupt flag. */
@@ -610,6 +1612,15 @@ static signed DK_USB_StandardRequestHandler(void)
     }
     break;
 
+    case USB_HID_GET_REPORT:
+    {
+      /* CLEAR_FEATURE shares this code but goes the other way, and like
+         SET_IDLE it needs only the status stage given below. */
+      RequestIsSupported = DK_USB_GetReport( &pdPacketData,
+                                             &Length );
+    }
+    break;
+
     default:
     {
       RequestIsSupported = FALSE;
@@ -630,6 +1641,11 @@ static signed DK_USB_StandardRequestHandler(void)
         Length = Buffer_EP0O.wLength;
       }
   
+      /* A reply that ends on a full packet, short of what the host asked
+         for, needs a zero length packet to end it. */
+      ControlZeroLengthPending = ( Length < Buffer_EP0O.wLength &&
+                                   (Length & 63) == 0 );
+
       if(Length > (unsigned)64)
       {
         bLength = 64;
@@ -640,28 +1656,150 @@ static signed DK_USB_StandardRequestHandler(void)
       }
       Length -= bLength;
         
-      DK_USB_SendPacket( (USB_BufferDescriptor *)&BufferDescriptorTable[0][1],
+      DK_USB_SendPacket( 0,
                          pdPacketData,
                          bLength );
+
+      /* The rest follows from DK_USB_ContinueControlRead. */
+      ControlData = pdPacketData;
+
+      if(ControlData.IsROMPointer == (unsigned)TRUE)
+      {
+        ControlData.Anywhere.pROM += bLength;
+      }
+      else
+      {
+        ControlData.Anywhere.pRAM += bLength;
+      }
+
+      ControlRemaining = Length;
     }
   
     /* Reset endpoint zero. */
-    BufferDescriptorTable[0][0].STAT = 0x88;
+    BufferDescriptorTable[USB_BD_EP0O].STAT = 0x88;
   }
   else
   {
     /* Host is sending to device. */
 
-    BufferDescriptorTable[0][1].CNT = 0;
+    BufferDescriptorTable[USB_BD_EP0I].CNT = 0;
     
     /* SIE owns, no sync checking, and data one packet. */
-    BufferDescriptorTable[0][0].STAT = 0xC8;
+    BufferDescriptorTable[USB_BD_EP0O].STAT = 0xC8;
   }
   
-  BufferDescriptorTable[0][0].CNT = 64;
-  BufferDescriptorTable[0][1].STAT = 0xC8;
+  BufferDescriptorTable[USB_BD_EP0O].CNT = 64;
+  BufferDescriptorTable[USB_BD_EP0I].STAT = 0xC8;
   
   UCONbits.PKTDIS = 0;
   
   return DK_SUCCESS;
 }
+#endif /* __18F4550 || DK_USB_MODEL */
+
+
+#if (defined(DK_POSIX) && !defined(DK_USB_MODEL)) || defined(M52233DEMO)
+/*******************************************************************************
+Neither the host nor the MCF52233 has a USB module.  These stand-ins accept
+and discard all traffic so that the kernel and application run unchanged.
+*******************************************************************************/
+signed DK_USB_Start(void)
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USB_Initialize(void)
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USB_SendCharacter( unsigned char Character )
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USB_Write( const unsigned char * pData,
+                     unsigned short Length )
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USB_Read( unsigned char * pData,
+                    unsigned short Length )
+{
+  /* Nothing is ever received. */
+  return DK_FAILURE;
+}
+
+
+unsigned char * DK_USB_AcquireIsoFrame(void)
+{
+  /* Frames are built here and discarded. */
+  static unsigned char Buffer[DK_USB_ISO_PACKET_SIZE];
+
+  return Buffer;
+}
+
+
+signed DK_USB_CommitIsoFrame( unsigned char Length )
+{
+  return DK_SUCCESS;
+}
+
+
+unsigned DK_USB_GetFrameNumber(void)
+{
+  return 0;
+}
+
+
+unsigned long DK_USB_GetIsoUnderruns(void)
+{
+  return 0;
+}
+
+
+unsigned long DK_USB_GetIsoOverruns(void)
+{
+  return 0;
+}
+
+
+unsigned char * DK_USB_AcquireTxBuffer( unsigned char Endpoint )
+{
+  /* Packets are built here and discarded. */
+  static unsigned char Buffer[64];
+
+  return Buffer;
+}
+
+
+signed DK_USB_CommitTxBuffer( unsigned char Endpoint,
+                              unsigned char bLength )
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USB_SendReport( const unsigned char * pReport )
+{
+  return DK_SUCCESS;
+}
+
+
+signed DK_USB_SendPacket( unsigned char Endpoint,
+                          DK_DangerousPointer pdPacketData,
+                          unsigned char bLength )
+{
+  return DK_SUCCESS;
+}
+
+
+void DK_USB_ISR(void)
+{
+}
+#endif /* (DK_POSIX && !DK_USB_MODEL) || M52233DEMO */
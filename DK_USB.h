@@ -53,6 +53,29 @@ USB, CDC, and device magic number definitions.
    28. */
 #define USB_CDC_CC_INTERFACE  0x02
 
+/* USB Interface Association Descriptor Device Class Code and Use Model,
+   Revision 1.0, July 23, 2003, 2.0 Multi-interface Function Class Codes.  A
+   device whose functions span several interfaces, like CDC's, announces them
+   with this class so each function binds to its own class driver. */
+#define USB_SD_INTERFACE_ASSOCIATION  0x0B
+#define USB_MISC_CC_MISC              0xEF
+#define USB_MISC_SC_COMMON            0x02
+#define USB_MISC_PR_IAD               0x01
+
+/* Device Class Definition for Human Interface Devices (HID), Version 1.11,
+   June 27, 2001, class code, 4.1, page 8, class descriptor types, 7.1, page
+   49, and class-specific requests, table 7.2, page 50. */
+#define USB_HID_CC_HID          0x03
+#define USB_HID_SD_HID          0x21
+#define USB_HID_SD_REPORT       0x22
+#define USB_HID_GET_REPORT      0x01
+#define USB_HID_GET_IDLE        0x02
+#define USB_HID_GET_PROTOCOL    0x03
+#define USB_HID_SET_REPORT      0x09
+#define USB_HID_SET_IDLE        0x0A
+#define USB_HID_SET_PROTOCOL    0x0B
+#define USB_HID_REPORT_INPUT    0x01
+
 /* Universal Serial Bus Specification, Revision 2.0, April 27, 2000, Standard
    Endpoint Descriptor, table 9-13., page 269. */
 #define USB_ENDPOINT_ADDRESS_0O  0x00
@@ -92,6 +115,12 @@ USB, CDC, and device magic number definitions.
 /*******************************************************************************
 USB, CDC, and device data structure declarations.
 *******************************************************************************/
+#ifdef DK_USB_MODEL
+  /* Descriptors go out byte for byte, so the host compiler must not pad them
+     as MCC18 would not. */
+  #pragma pack(push, 1)
+#endif
+
 /* Universal Serial Bus Specification, Revision 2.0, April 27, 2000, Standard
    Device Descriptor, table 9-8, page 262. */
 typedef struct
@@ -221,6 +250,42 @@ typedef struct
                 bSlaveInterface0;
 } USB_CDC_FD_Union;
 
+/* USB Interface Association Descriptor Device Class Code and Use Model,
+   Revision 1.0, July 23, 2003, Standard Interface Association Descriptor,
+   table 9-Z. */
+typedef struct
+{
+  unsigned char bLength,
+                bDescriptorType,
+                bFirstInterface,
+                bInterfaceCount,
+                bFunctionClass,
+                bFunctionSubClass,
+                bFunctionProtocol,
+                iFunction;
+} USB_SD_InterfaceAssociation;
+
+/* Device Class Definition for Human Interface Devices (HID), Version 1.11,
+   June 27, 2001, HID Descriptor, 6.2.1, page 22, with its one report
+   descriptor. */
+typedef struct
+{
+  unsigned char  bLength,
+                 bDescriptorType;
+
+  unsigned short bcdHID;
+
+  unsigned char  bCountryCode,
+                 bNumDescriptors,
+                 bReportDescriptorType;
+
+  unsigned short wDescriptorLength;
+} USB_HID_Descriptor;
+
+#ifdef DK_USB_MODEL
+  #pragma pack(pop)
+#endif
+
 
 /* PIC18F2455/2550/4455/4550 Data Sheet, January, 2007, 17.4 Buffer Descriptors
    and the Buffer Descriptor Table. */
@@ -231,6 +296,82 @@ typedef struct
                 * ADR;
 } USB_BufferDescriptor;
 
+/* Buffer descriptor STAT bits, table 17-4. */
+#define USB_BD_UOWN   0x80  /* SIE owns the buffer. */
+#define USB_BD_DTS    0x40  /* DATA1 packet. */
+#define USB_BD_DTSEN  0x08  /* Data toggle synchronization enabled. */
+
+/* Size in bytes of the endpoint one transmit ring.  Must be a power of two no
+   larger than 128.  Smaller on the PIC18F4550, where the rest of the rings'
+   bank holds kernel and driver data; a packet is sent with whatever is
+   queued, so the ring need not hold a full one. */
+#ifndef DK_USB_TX_RING_SIZE
+  #ifdef __18F4550
+    #define DK_USB_TX_RING_SIZE  32
+  #else
+    #define DK_USB_TX_RING_SIZE  128
+  #endif
+#endif
+
+/* Size in bytes of the endpoint one receive ring.  Must be a power of two no
+   larger than 128, and at least 64 so a full packet fits, which is all the
+   PIC18F4550 has room for. */
+#ifndef DK_USB_RX_RING_SIZE
+  #ifdef __18F4550
+    #define DK_USB_RX_RING_SIZE  64
+  #else
+    #define DK_USB_RX_RING_SIZE  128
+  #endif
+#endif
+
+/* Size in bytes of each packet on the isochronous endpoint, one per frame.
+   Both of its buffers share a bank with endpoint one's output buffers, so no
+   more than 64. */
+#ifndef DK_USB_ISO_PACKET_SIZE
+  #define DK_USB_ISO_PACKET_SIZE  64
+#endif
+
+/* The isochronous input endpoint. */
+#define USB_ISO_ENDPOINT          2
+#define USB_ISO_ENDPOINT_ADDRESS  USB_ENDPOINT_ADDRESS_2I
+
+/* The game controller's HID interface and its interrupt input endpoint. */
+#define USB_HID_INTERFACE         3
+#define USB_HID_ENDPOINT          3
+#define USB_HID_ENDPOINT_ADDRESS  USB_ENDPOINT_ADDRESS_3I
+
+/* The game controller's input report, described by the report descriptor in
+   DK_USB.c.  The first byte holds buttons one through four in bits zero
+   through three, then the X and Y axes in bits four and five and bits six and
+   seven, each -1, 0, or 1 in two's complement.  Y increases downward.
+
+   The rest is vendor defined, for measuring latency, all little endian: a
+   sixteen bit sequence number, one more for each report sent; the kernel
+   time, in microseconds, at which the controller was latched; and the USB
+   frame number at that moment. */
+#define USB_HID_REPORT_SIZE  9
+#define USB_HID_REPORT_BUTTON( Number )  (1 << ((Number) - 1))
+#define USB_HID_REPORT_X( Value )        (((Value) & 0x03) << 4)
+#define USB_HID_REPORT_Y( Value )        (((Value) & 0x03) << 6)
+
+/* The offsets of the report's fields. */
+#define USB_HID_REPORT_SEQUENCE  1 /* Two bytes. */
+#define USB_HID_REPORT_TIME      3 /* Four bytes. */
+#define USB_HID_REPORT_FRAME     7 /* Two bytes, eleven bits. */
+
+/* The number of endpoints used, including endpoint zero. */
+#define USB_ENDPOINTS  4
+
+/* Buffer descriptor table indices for ping pong mode three (UCFG PPB1:PPB0 of
+   11, figure 17-7): endpoint zero has a single output and input descriptor,
+   and every other endpoint an even and odd descriptor in each direction.
+   Direction is zero for output and one for input. */
+#define USB_BD_EP0O  0
+#define USB_BD_EP0I  1
+#define USB_BD( Endpoint, Direction, Odd )\
+  ( 2 + ((Endpoint) - 1) * 4 + (Direction) * 2 + (Odd) )
+#define USB_BD_COUNT  USB_BD(USB_ENDPOINTS, 0, 0)
+
 #define USB_ENDPOINT( Length ) \
   union\
   {\
@@ -283,10 +424,24 @@ typedef struct
 signed DK_USB_Start(void);
 signed DK_USB_Initialize(void);
 signed DK_USB_SendCharacter( unsigned char Character );
-signed DK_USB_SendPacket( USB_BufferDescriptor * BufferDescriptor,
+signed DK_USB_Write( const unsigned char * pData,
+                     unsigned short Length );
+signed DK_USB_Read( unsigned char * pData,
+                    unsigned short Length );
+unsigned char * DK_USB_AcquireTxBuffer( unsigned char Endpoint );
+unsigned char * DK_USB_AcquireIsoFrame(void);
+signed DK_USB_CommitIsoFrame( unsigned char Length );
+unsigned long DK_USB_GetIsoUnderruns(void);
+unsigned long DK_USB_GetIsoOverruns(void);
+signed DK_USB_CommitTxBuffer( unsigned char Endpoint,
+                              unsigned char bLength );
+signed DK_USB_SendReport( const unsigned char * pReport );
+unsigned DK_USB_GetFrameNumber(void);
+signed DK_USB_SendPacket( unsigned char Endpoint,
                           DK_DangerousPointer pdPacketData,
                           unsigned char bLength );
 void DK_USB_ISR(void);
+void DK_USB_FrameTrigger(void);
 
 
 #endif /* DK_USB_H */
@@ -0,0 +1,806 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the USB driver benchmarks for the POSIX host target, built
+with DK_USB_MODEL so that DK_USB.c runs against the register level model of
+the SIE in DK_USB_Model.c.  Task_Benchmark plays the host: it enumerates the
+device, then streams through endpoint one in each direction, polls the game
+pad's HID endpoint, and collects the isochronous endpoint for a while, checking
+every byte.  Each HID report carries the frame number and kernel time at
+which it was made, so its age is measured on arrival.
+
+Throughput is measured in bus time.  The host issues at most
+BENCHMARK_SLOTS_PER_FRAME tokens between starts of frame, the most 64 byte bulk
+packets a full speed frame holds, and yields to the device's tasks whenever
+one is NAKed.  The time spent in DK_USB_ISR is host time, which tracks the
+PIC's instruction count only loosely; DK_Cycles.py gives the exact figure.
+
+Results are printed as "<name> <value> <unit>", the same format as
+DK_Benchmark.  The program exits non-zero if any transfer failed, any data was
+lost or corrupted, or the model saw a data toggle or ownership error.
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  10
+
+#include "DK_Global.h"
+#include <stdlib.h>
+#include <time.h>
+
+
+#ifndef DK_USB_MODEL
+  #error The USB benchmarks run against DK_USB_Model only.
+#endif
+
+
+/*******************************************************************************
+Benchmark parameters.
+*******************************************************************************/
+/* Bytes streamed through endpoint one in each direction. */
+#define BENCHMARK_BYTES            (65536L)
+
+/* Full speed bulk packets of 64 bytes that fit in one frame. */
+#define BENCHMARK_SLOTS_PER_FRAME  (19)
+
+/* Frames the isochronous endpoint is collected for. */
+#define BENCHMARK_ISO_FRAMES       (1000)
+
+/* Frames a stream may take before it is given up on. */
+#define BENCHMARK_FRAME_LIMIT      (100000L)
+
+
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+static unsigned Failures = 0;
+
+/* Set by the worker tasks once they have moved every byte. */
+static volatile unsigned char WriterDone = FALSE,
+                              ReaderDone = FALSE;
+
+/* Bytes Task_Reader found to differ from the pattern. */
+static volatile unsigned long ReaderMismatches = 0;
+
+/* The game pad's reports, sent by DK_USB_FrameTrigger. */
+static volatile unsigned char ReportStreaming = FALSE;
+static volatile unsigned short ReportSequence = 0;
+
+/* The isochronous producer, run by DK_USB_FrameTrigger. */
+static volatile unsigned char IsoStreaming = FALSE;
+static volatile unsigned long IsoSequence = 0;
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+static double Now(void)
+{
+/* Result:
+   The monotonic clock in seconds. */
+
+  struct timespec Time;
+
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+
+  return Time.tv_sec + Time.tv_nsec * 1e-9;
+}
+
+
+static void Record( const char * Name,
+                    double Value,
+                    const char * Unit )
+{
+/* Prints a result. */
+
+  printf("%s %.1f %s\n", Name, Value, Unit);
+  fflush(stdout);
+}
+
+
+static void Fail( const char * Reason )
+{
+/* Notes a failed check. */
+
+  printf("# %s FAILED\n", Reason);
+  fflush(stdout);
+
+  ++Failures;
+}
+
+
+static unsigned char Pattern( unsigned long Offset )
+{
+/* Result:
+   The byte expected at Offset of a stream.  Any dropped, repeated, or
+   reordered packet breaks the sequence. */
+
+  return (unsigned char)(Offset * 7 + (Offset >> 8));
+}
+
+
+static void Setup( unsigned char * pPacket,
+                   unsigned char bmRequestType,
+                   unsigned char bRequest,
+                   unsigned short wValue,
+                   unsigned short wIndex,
+                   unsigned short wLength )
+{
+/* Fills in a setup packet. */
+
+  pPacket[0] = bmRequestType;
+  pPacket[1] = bRequest;
+  pPacket[2] = (unsigned char)wValue;
+  pPacket[3] = (unsigned char)(wValue >> 8);
+  pPacket[4] = (unsigned char)wIndex;
+  pPacket[5] = (unsigned char)(wIndex >> 8);
+  pPacket[6] = (unsigned char)wLength;
+  pPacket[7] = (unsigned char)(wLength >> 8);
+}
+
+
+static void RecordInterrupts( const char * Name,
+                              const DK_USB_ModelStatistics * pBefore,
+                              unsigned long Packets )
+{
+/* Records the host time spent in DK_USB_ISR, and the number of interrupts
+   taken, per packet since pBefore. */
+
+  char Label[64];
+
+  if(Packets == 0)
+  {
+    return;
+  }
+
+  snprintf(Label, sizeof(Label), "%s_isr_per_packet", Name);
+  Record( Label,
+          (DK_USB_ModelStats.InterruptSeconds - pBefore->InterruptSeconds) /
+            Packets * 1e9,
+          "ns" );
+
+  snprintf(Label, sizeof(Label), "%s_interrupts_per_packet", Name);
+  Record( Label,
+          (double)(DK_USB_ModelStats.Interrupts - pBefore->Interrupts) /
+            Packets,
+          "interrupts" );
+}
+
+
+/*******************************************************************************
+Worker tasks.
+*******************************************************************************/
+void Task_Writer(void)
+{
+/* Writes BENCHMARK_BYTES of the pattern to endpoint one, then exits. */
+
+  unsigned char Block[256];
+  unsigned long Offset = 0;
+  unsigned Index = 0;
+
+  while(Offset < (unsigned long)BENCHMARK_BYTES)
+  {
+    for(Index = 0; Index < sizeof(Block); ++Index)
+    {
+      Block[Index] = Pattern(Offset + Index);
+    }
+
+    DK_USB_Write(Block, sizeof(Block));
+    Offset += sizeof(Block);
+  }
+
+  WriterDone = TRUE;
+
+  DK_ConfigureTaskState(DK_GetRunningTaskIdentity(), DEAD);
+  DK_InvokeScheduler();
+}
+
+
+void Task_Reader(void)
+{
+/* Reads BENCHMARK_BYTES from endpoint one and checks them against the
+   pattern, then exits. */
+
+  unsigned char Block[256];
+  unsigned long Offset = 0;
+  unsigned Index = 0;
+
+  while(Offset < (unsigned long)BENCHMARK_BYTES)
+  {
+    DK_USB_Read(Block, sizeof(Block));
+
+    for(Index = 0; Index < sizeof(Block); ++Index)
+    {
+      if(Block[Index] != Pattern(Offset + Index))
+      {
+        ++ReaderMismatches;
+      }
+    }
+
+    Offset += sizeof(Block);
+  }
+
+  ReaderDone = TRUE;
+
+  DK_ConfigureTaskState(DK_GetRunningTaskIdentity(), DEAD);
+  DK_InvokeScheduler();
+}
+
+
+/*******************************************************************************
+Benchmarks.
+*******************************************************************************/
+static void Benchmark_Enumerate(void)
+{
+/* Resets the bus and enumerates the device as a host would: the device
+   descriptor, SET_ADDRESS, the configuration descriptor's header and then the
+   whole of it, the strings, and SET_CONFIGURATION. */
+
+  DK_USB_ModelStatistics Before;
+  unsigned char Packet[8],
+                Data[512];
+  unsigned short Length = 0,
+                 TotalLength = 0,
+                 ReportLength = 0,
+                 Offset = 0;
+  unsigned char String = 0,
+                Endpoints = 0,
+                BulkOut = FALSE;
+  double Start = 0.0;
+
+  DK_USB_ModelBusReset();
+
+  Before = DK_USB_ModelStats;
+  Start = Now();
+
+  Setup(Packet, 0x80, USB_SR_GET_DESCRIPTOR, USB_SD_DEVICE << 8, 0, 64);
+
+  if( DK_USB_ModelControlRead(Packet, Data, &Length) != DK_SUCCESS ||
+      Length != 18 || Data[0] != 18 || Data[1] != USB_SD_DEVICE ||
+      (Data[8] | (Data[9] << 8)) != USB_IDVENDOR )
+  {
+    Fail("device descriptor");
+  }
+
+  Setup(Packet, 0x00, USB_SR_SET_ADDRESS, 7, 0, 0);
+
+  if( DK_USB_ModelControlWrite(Packet) != DK_SUCCESS || UADDR != 7 )
+  {
+    Fail("SET_ADDRESS");
+  }
+
+  Setup(Packet, 0x80, USB_SR_GET_DESCRIPTOR, USB_SD_CONFIGURATION << 8, 0, 9);
+
+  if( DK_USB_ModelControlRead(Packet, Data, &Length) != DK_SUCCESS ||
+      Length != 9 || Data[1] != USB_SD_CONFIGURATION )
+  {
+    Fail("configuration descriptor header");
+  }
+
+  TotalLength = Data[2] | (Data[3] << 8);
+
+  /* Exactly wTotalLength, and then more than it, which a short packet or a
+     zero length packet must end. */
+  Setup( Packet, 0x80, USB_SR_GET_DESCRIPTOR, USB_SD_CONFIGURATION << 8, 0,
+         TotalLength );
+
+  if( DK_USB_ModelControlRead(Packet, Data, &Length) != DK_SUCCESS ||
+      Length != TotalLength )
+  {
+    Fail("configuration descriptor");
+  }
+
+  Setup( Packet, 0x80, USB_SR_GET_DESCRIPTOR, USB_SD_CONFIGURATION << 8, 0,
+         sizeof(Data) );
+
+  if( DK_USB_ModelControlRead(Packet, Data, &Length) != DK_SUCCESS ||
+      Length != TotalLength )
+  {
+    Fail("configuration descriptor, long request");
+  }
+
+  /* Every interface must be followed by as many endpoints as it declares,
+     and the CDC data interface must have its bulk OUT endpoint, or a host
+     never sends it anything.  The HID descriptor gives the report
+     descriptor's length. */
+  for(Offset = 0; Offset + 1 < Length && Data[Offset] != 0;
+      Offset += Data[Offset])
+  {
+    if(Data[Offset + 1] == USB_SD_INTERFACE)
+    {
+      if(Endpoints != 0)
+      {
+        Fail("interface endpoint count");
+      }
+
+      Endpoints = Data[Offset + 4];
+    }
+    else if(Data[Offset + 1] == USB_SD_ENDPOINT)
+    {
+      if(Endpoints == 0)
+      {
+        Fail("interface endpoint count");
+      }
+      else
+      {
+        --Endpoints;
+      }
+
+      if( Data[Offset + 2] == USB_ENDPOINT_ADDRESS_1O &&
+          Data[Offset + 3] == 2 &&
+          (Data[Offset + 4] | (Data[Offset + 5] << 8)) == 64 )
+      {
+        BulkOut = TRUE;
+      }
+    }
+    else if(Data[Offset + 1] == USB_HID_SD_HID)
+    {
+      ReportLength = Data[Offset + 7] | (Data[Offset + 8] << 8);
+    }
+  }
+
+  if(Endpoints != 0)
+  {
+    Fail("interface endpoint count");
+  }
+
+  if(BulkOut == FALSE)
+  {
+    Fail("CDC bulk OUT endpoint descriptor");
+  }
+
+  Setup( Packet, 0x81, USB_SR_GET_DESCRIPTOR, USB_HID_SD_REPORT << 8,
+         USB_HID_INTERFACE, 255 );
+
+  if( DK_USB_ModelControlRead(Packet, Data, &Length) != DK_SUCCESS ||
+      ReportLength == 0 || Length != ReportLength )
+  {
+    Fail("HID report descriptor");
+  }
+
+  for(String = 0; String < 3; ++String)
+  {
+    Setup( Packet, 0x80, USB_SR_GET_DESCRIPTOR,
+           (USB_SD_STRING << 8) | String, 0, 255 );
+
+    if( DK_USB_ModelControlRead(Packet, Data, &Length) != DK_SUCCESS ||
+        Length < 2 || Data[0] != Length || Data[1] != USB_SD_STRING )
+    {
+      Fail("string descriptor");
+    }
+  }
+
+  Setup(Packet, 0x00, USB_SR_SET_CONFIGURATION, 1, 0, 0);
+
+  if(DK_USB_ModelControlWrite(Packet) != DK_SUCCESS)
+  {
+    Fail("SET_CONFIGURATION");
+  }
+
+  DK_USB_ModelConfigure();
+
+  Setup( Packet, 0xA1, USB_HID_GET_REPORT, USB_HID_REPORT_INPUT << 8,
+         USB_HID_INTERFACE, USB_HID_REPORT_SIZE );
+
+  if( DK_USB_ModelControlRead(Packet, Data, &Length) != DK_SUCCESS ||
+      Length != USB_HID_REPORT_SIZE )
+  {
+    Fail("GET_REPORT");
+  }
+
+  Record("usb_enumerate", (Now() - Start) * 1e6, "us");
+  RecordInterrupts( "usb_control",
+                    &Before,
+                    DK_USB_ModelStats.Transactions - Before.Transactions );
+}
+
+
+static void Benchmark_Transmit(void)
+{
+/* Task_Writer streams BENCHMARK_BYTES through DK_USB_Write while the host
+   collects them from endpoint one.  The stream is a whole number of packets,
+   so a zero length packet must end it. */
+
+  DK_USB_ModelStatistics Before = DK_USB_ModelStats;
+  unsigned char Data[64];
+  unsigned short Length = 0,
+                 Index = 0;
+  unsigned long Received = 0,
+                Packets = 0,
+                Frames = 0,
+                Mismatches = 0;
+  unsigned char Slot = 0,
+                Ended = FALSE;
+
+  WriterDone = FALSE;
+  DK_InitializeTask(Task_Writer, READY, 1);
+
+  while(Ended == FALSE && Frames < (unsigned long)BENCHMARK_FRAME_LIMIT)
+  {
+    DK_USB_ModelStartOfFrame();
+    ++Frames;
+
+    for(Slot = 0; Slot < BENCHMARK_SLOTS_PER_FRAME && Ended == FALSE; ++Slot)
+    {
+      switch( DK_USB_ModelIn(1, Data, &Length) )
+      {
+        case DK_USB_MODEL_ACK:
+        {
+          for(Index = 0; Index < Length; ++Index)
+          {
+            if(Data[Index] != Pattern(Received + Index))
+            {
+              ++Mismatches;
+            }
+          }
+
+          Received += Length;
+          ++Packets;
+
+          Ended = ( Length < sizeof(Data) &&
+                    Received >= (unsigned long)BENCHMARK_BYTES );
+        }
+        break;
+
+        case DK_USB_MODEL_NAK:
+        {
+          DK_InvokeScheduler();
+        }
+        break;
+
+        default:
+        {
+          Fail("endpoint one IN reply");
+          Ended = TRUE;
+        }
+        break;
+      }
+    }
+  }
+
+  if( Ended == FALSE || Received != (unsigned long)BENCHMARK_BYTES ||
+      WriterDone == FALSE )
+  {
+    Fail("transmit stream length");
+  }
+
+  if(Mismatches != 0)
+  {
+    Fail("transmit stream data");
+  }
+
+  Record("usb_tx_throughput", Received * 1000.0 / Frames, "bytes/s");
+  Record("usb_tx_naks", DK_USB_ModelStats.Naks - Before.Naks, "naks");
+  RecordInterrupts("usb_tx", &Before, Packets);
+}
+
+
+static void Benchmark_Receive(void)
+{
+/* The host sends BENCHMARK_BYTES to endpoint one in full packets while
+   Task_Reader takes them with DK_USB_Read.  A full receive ring NAKs the
+   host until the reader catches up. */
+
+  DK_USB_ModelStatistics Before = DK_USB_ModelStats;
+  unsigned char Data[64];
+  unsigned short Index = 0;
+  unsigned long Sent = 0,
+                Packets = 0,
+                Frames = 0;
+  unsigned char Slot = 0,
+                Ended = FALSE;
+  unsigned Tries = 0;
+
+  ReaderDone = FALSE;
+  ReaderMismatches = 0;
+  DK_InitializeTask(Task_Reader, READY, 1);
+
+  while(Ended == FALSE && Frames < (unsigned long)BENCHMARK_FRAME_LIMIT)
+  {
+    DK_USB_ModelStartOfFrame();
+    ++Frames;
+
+    for(Slot = 0; Slot < BENCHMARK_SLOTS_PER_FRAME && Ended == FALSE; ++Slot)
+    {
+      for(Index = 0; Index < sizeof(Data); ++Index)
+      {
+        Data[Index] = Pattern(Sent + Index);
+      }
+
+      switch( DK_USB_ModelOut(1, Data, sizeof(Data)) )
+      {
+        case DK_USB_MODEL_ACK:
+        {
+          Sent += sizeof(Data);
+          ++Packets;
+
+          Ended = Sent >= (unsigned long)BENCHMARK_BYTES;
+        }
+        break;
+
+        case DK_USB_MODEL_NAK:
+        {
+          DK_InvokeScheduler();
+        }
+        break;
+
+        default:
+        {
+          Fail("endpoint one OUT reply");
+          Ended = TRUE;
+        }
+        break;
+      }
+    }
+  }
+
+  /* Let the reader drain the ring. */
+  for(Tries = 0; ReaderDone == FALSE && Tries < DK_USB_MODEL_RETRIES; ++Tries)
+  {
+    DK_InvokeScheduler();
+  }
+
+  if(Sent != (unsigned long)BENCHMARK_BYTES || ReaderDone == FALSE)
+  {
+    Fail("receive stream length");
+  }
+
+  if( ReaderMismatches != 0 ||
+      DK_USB_ModelStats.IgnoredOuts != Before.IgnoredOuts ||
+      DK_USB_ModelStats.Overflows != Before.Overflows )
+  {
+    Fail("receive stream data");
+  }
+
+  Record("usb_rx_throughput", Sent * 1000.0 / Frames, "bytes/s");
+  Record("usb_rx_naks", DK_USB_ModelStats.Naks - Before.Naks, "naks");
+  RecordInterrupts("usb_rx", &Before, Packets);
+}
+
+
+static void Benchmark_Reports(void)
+{
+/* DK_USB_FrameTrigger sends a new input report at every start of frame, as
+   the game pad does while its buttons change, and the host polls the HID
+   endpoint once per frame.  Every report must arrive in the frame it was
+   sent, in sequence.  The kernel time between making each report and the
+   host receiving it is its latency. */
+
+  DK_USB_ModelStatistics Before = DK_USB_ModelStats;
+  unsigned char Report[USB_HID_REPORT_SIZE];
+  unsigned short Length = 0,
+                 Sequence = 0;
+  unsigned long Packets = 0,
+                Late = 0;
+  unsigned Frame = 0,
+           ReportFrame = 0;
+  DK_Time Made = 0,
+          Latency = 0,
+          MaximumLatency = 0;
+  double TotalLatency = 0;
+
+  ReportSequence = 0;
+  ReportStreaming = TRUE;
+
+  for(Frame = 0; Frame < (unsigned)BENCHMARK_ISO_FRAMES; ++Frame)
+  {
+    DK_USB_ModelStartOfFrame();
+
+    if( DK_USB_ModelIn(USB_HID_ENDPOINT, Report, &Length) != DK_USB_MODEL_ACK ||
+        Length != USB_HID_REPORT_SIZE )
+    {
+      ++Late;
+      continue;
+    }
+
+    Sequence = Report[USB_HID_REPORT_SEQUENCE]
+               | (Report[USB_HID_REPORT_SEQUENCE + 1] << 8);
+    Made = Report[USB_HID_REPORT_TIME]
+           | ((DK_Time)Report[USB_HID_REPORT_TIME + 1] << 8)
+           | ((DK_Time)Report[USB_HID_REPORT_TIME + 2] << 16)
+           | ((DK_Time)Report[USB_HID_REPORT_TIME + 3] << 24);
+    ReportFrame = Report[USB_HID_REPORT_FRAME]
+                  | (Report[USB_HID_REPORT_FRAME + 1] << 8);
+
+    if( Sequence != (unsigned short)(ReportSequence - 1) ||
+        ReportFrame != DK_USB_GetFrameNumber() )
+    {
+      ++Late;
+      continue;
+    }
+
+    Latency = DK_GetTimeMicroseconds() - Made;
+    TotalLatency += Latency;
+
+    if(Latency > MaximumLatency)
+    {
+      MaximumLatency = Latency;
+    }
+
+    ++Packets;
+  }
+
+  ReportStreaming = FALSE;
+
+  if(Late != 0 || Packets == 0)
+  {
+    Fail("HID reports");
+  }
+
+  Record("usb_hid_late", Late, "reports");
+  Record("usb_hid_latency_mean", Packets ? TotalLatency / Packets : 0, "us");
+  Record("usb_hid_latency_max", MaximumLatency, "us");
+  RecordInterrupts("usb_hid", &Before, Packets);
+}
+
+
+static void Benchmark_Isochronous(void)
+{
+/* DK_USB_FrameTrigger commits a numbered frame at every start of frame, and
+   the host collects one packet from the isochronous endpoint in every frame.
+   Each frame is collected one frame after it is committed, so only the very
+   first may be missing. */
+
+  DK_USB_ModelStatistics Before = DK_USB_ModelStats;
+  unsigned long Underruns = DK_USB_GetIsoUnderruns(),
+                Overruns = DK_USB_GetIsoOverruns(),
+                Expected = 0,
+                Sequence = 0,
+                Packets = 0,
+                Missed = 0;
+  unsigned char Data[DK_USB_ISO_PACKET_SIZE];
+  unsigned short Length = 0;
+  unsigned Frame = 0;
+  signed Reply = 0;
+
+  IsoSequence = 0;
+  IsoStreaming = TRUE;
+
+  for(Frame = 0; Frame < (unsigned)BENCHMARK_ISO_FRAMES; ++Frame)
+  {
+    DK_USB_ModelStartOfFrame();
+
+    Reply = DK_USB_ModelIn(USB_ISO_ENDPOINT, Data, &Length);
+
+    if(Reply == DK_USB_MODEL_NONE)
+    {
+      ++Missed;
+      continue;
+    }
+
+    Sequence = Data[0] | ((unsigned long)Data[1] << 8) |
+               ((unsigned long)Data[2] << 16) | ((unsigned long)Data[3] << 24);
+
+    if( Reply != DK_USB_MODEL_ACK || Length != sizeof(Data) ||
+        (Packets != 0 && Sequence != Expected) )
+    {
+      Fail("isochronous frame");
+    }
+
+    Expected = Sequence + 1;
+    ++Packets;
+  }
+
+  IsoStreaming = FALSE;
+
+  if(Missed > 1)
+  {
+    Fail("isochronous stream");
+  }
+
+  Record("usb_iso_missed", Missed, "frames");
+  Record("usb_iso_underruns", DK_USB_GetIsoUnderruns() - Underruns, "frames");
+  Record("usb_iso_overruns", DK_USB_GetIsoOverruns() - Overruns, "frames");
+  RecordInterrupts("usb_iso", &Before, Packets);
+}
+
+
+/*******************************************************************************
+User defined functions called by the kernel.
+*******************************************************************************/
+void DK_IdleTaskHook(void)
+{
+}
+
+
+void DK_ISR(void)
+{
+}
+
+
+void DK_QuantumTrigger(unsigned QuantumCount)
+{
+}
+
+
+void DK_USB_FrameTrigger(void)
+{
+/* Sends the next report while Benchmark_Reports is running, and commits the
+   next numbered frame while Benchmark_Isochronous is running. */
+
+  unsigned char * pFrame = 0;
+  unsigned char Index = 0,
+                Report[USB_HID_REPORT_SIZE] = {0};
+  unsigned Frame = 0;
+  DK_Time Made = 0;
+
+  if(ReportStreaming == TRUE)
+  {
+    Made = DK_GetTimeMicrosecondsFromISR();
+    Frame = DK_USB_GetFrameNumber();
+
+    Report[USB_HID_REPORT_SEQUENCE] = (unsigned char)ReportSequence;
+    Report[USB_HID_REPORT_SEQUENCE + 1] = (unsigned char)(ReportSequence >> 8);
+
+    for(Index = 0; Index < 4; ++Index)
+    {
+      Report[USB_HID_REPORT_TIME + Index] = (unsigned char)(Made >> (Index * 8));
+    }
+
+    Report[USB_HID_REPORT_FRAME] = (unsigned char)Frame;
+    Report[USB_HID_REPORT_FRAME + 1] = (unsigned char)(Frame >> 8);
+
+    if(DK_USB_SendReport(Report) == DK_SUCCESS)
+    {
+      ++ReportSequence;
+    }
+  }
+
+  if(IsoStreaming == FALSE)
+  {
+    return;
+  }
+
+  pFrame = DK_USB_AcquireIsoFrame();
+
+  if(pFrame == 0)
+  {
+    return;
+  }
+
+  for(Index = 0; Index < 4; ++Index)
+  {
+    pFrame[Index] = (unsigned char)(IsoSequence >> (Index * 8));
+  }
+
+  DK_USB_CommitIsoFrame(DK_USB_ISO_PACKET_SIZE);
+  ++IsoSequence;
+}
+
+
+void Task_Benchmark(void)
+{
+/* Runs every benchmark in turn, then exits the program. */
+
+  printf("# Dreamcatcher Kernel USB benchmarks, %ld bytes per stream\n",
+         (long)BENCHMARK_BYTES);
+
+  Benchmark_Enumerate();
+  Benchmark_Transmit();
+  Benchmark_Receive();
+  Benchmark_Reports();
+  Benchmark_Isochronous();
+
+  if(DK_USB_ModelStats.ToggleErrors != 0)
+  {
+    Fail("IN data toggles");
+  }
+
+  exit(Failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+/******************************************************************************/
+int main(void)
+{
+  signed Result = 0;
+
+  Result = DK_InitializeKernel();
+  DK_Assert(Result != DK_SUCCESS);
+
+  DK_InitializeTask(Task_Benchmark, READY, 1);
+
+  DK_StartKernel();
+
+  return EXIT_SUCCESS;
+}
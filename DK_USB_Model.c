@@ -0,0 +1,655 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the register level model of the PIC18F4550's serial
+interface engine and the scripted host that drives it.  See DK_USB_Model.h.
+
+The model follows PIC18F2455/2550/4455/4550 Data Sheet, January, 2007, chapter
+17.  A token to an endpoint whose buffer descriptor the MCU owns is NAKed, as
+is every token while PKTDIS is set or the USTAT FIFO is full.  IN data goes out
+with the PID in the descriptor's DTS bit, and the host checks it against the
+toggle it expects.  OUT data is written only if DTSEN is clear or DTS matches
+the host's toggle; otherwise it is acknowledged and dropped.  Endpoints without
+EPHSHK are isochronous: they never NAK and their toggles are not checked.
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  8
+
+#include "DK_Global.h"
+#include <string.h>
+#include <time.h>
+
+
+#ifdef DK_USB_MODEL
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+volatile unsigned char UCON = 0,
+                       UCFG = 0,
+                       UIR = 0,
+                       UIE = 0,
+                       UEIR = 0,
+                       UEIE = 0,
+                       USTAT = 0,
+                       UADDR = 0,
+                       UFRML = 0,
+                       UFRMH = 0,
+                       PIR2 = 0,
+                       PIE2 = 0,
+                       INTCON = DK_USB_MODEL_INTCON_GIE;
+
+volatile unsigned char DK_USB_ModelUEP[16] = {0};
+
+DK_USB_ModelStatistics DK_USB_ModelStats = {0};
+
+/* DK_USB.c's buffer descriptor table, which the SIE would find at 0x400. */
+extern volatile USB_BufferDescriptor * const DK_USB_ModelTable;
+
+/* The SIE's ping pong pointer for each endpoint and direction: whether the
+   next token uses the odd buffer descriptor.  Direction is zero for output and
+   one for input, as in USB_BD. */
+static unsigned char PingPongOdd[16][2] = {0};
+
+/* The data toggle the host sends next or expects next, for each endpoint and
+   direction. */
+static unsigned char HostToggle[16][2] = {0};
+
+/* The USTAT FIFO.  Entry zero is the one in USTAT while TRNIF is set. */
+static unsigned char UstatFifo[4] = {0},
+                     UstatCount = 0;
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+static volatile USB_BufferDescriptor * DK_USB_ModelBufferDescriptor(
+  unsigned char Endpoint,
+  unsigned char Direction,
+  unsigned char * pPingPong );
+static void DK_USB_ModelComplete( unsigned char Endpoint,
+                                  unsigned char Direction,
+                                  unsigned char PingPong );
+
+
+static volatile USB_BufferDescriptor * DK_USB_ModelBufferDescriptor(
+  unsigned char Endpoint,
+  unsigned char Direction,
+  unsigned char * pPingPong )
+{
+/* This function finds the buffer descriptor the SIE uses for the next token to
+   an endpoint, according to the ping pong mode in UCFG, figure 17-7.
+
+   Endpoint:  The endpoint number.
+   Direction: Zero for output, one for input.
+   pPingPong: Set to TRUE if the descriptor is one of a ping pong pair.
+
+   Result:
+   The buffer descriptor. */
+
+  unsigned char Odd = PingPongOdd[Endpoint][Direction],
+                Index;
+
+  *pPingPong = FALSE;
+
+  switch(UCFG & 0x03)
+  {
+    case 0:
+    {
+      /* No ping pong buffers. */
+      Index = Endpoint * 2 + Direction;
+    }
+    break;
+
+    case 1:
+    {
+      /* Ping pong buffers on endpoint zero's output only. */
+      if(Endpoint == 0 && Direction == 0)
+      {
+        Index = Odd;
+        *pPingPong = TRUE;
+      }
+      else
+      {
+        Index = Endpoint * 2 + Direction + 1;
+      }
+    }
+    break;
+
+    case 2:
+    {
+      /* Ping pong buffers on every endpoint. */
+      Index = Endpoint * 4 + Direction * 2 + Odd;
+      *pPingPong = TRUE;
+    }
+    break;
+
+    default:
+    {
+      /* Ping pong buffers on every endpoint but zero. */
+      if(Endpoint == 0)
+      {
+        Index = Direction;
+      }
+      else
+      {
+        Index = USB_BD(Endpoint, Direction, Odd);
+        *pPingPong = TRUE;
+      }
+    }
+    break;
+  }
+
+  return &DK_USB_ModelTable[Index];
+}
+
+
+static void DK_USB_ModelComplete( unsigned char Endpoint,
+                                  unsigned char Direction,
+                                  unsigned char PingPong )
+{
+/* This function finishes a transaction the way the SIE does: the ping pong
+   pointer advances, and the endpoint, direction, and buffer used go into the
+   USTAT FIFO.  TRNIF is raised if the FIFO was empty.
+
+   Endpoint:  The endpoint number.
+   Direction: Zero for output, one for input.
+   PingPong:  TRUE if the buffer descriptor was one of a ping pong pair. */
+
+  unsigned char Status = (Endpoint << 3) | (Direction << 2);
+
+  if(PingPong == TRUE)
+  {
+    Status |= PingPongOdd[Endpoint][Direction] << 1;
+    PingPongOdd[Endpoint][Direction] ^= 1;
+  }
+
+  UstatFifo[UstatCount++] = Status;
+
+  if(UstatCount == 1)
+  {
+    USTAT = Status;
+    UIR |= DK_USB_MODEL_UIR_TRNIF;
+  }
+
+  ++DK_USB_ModelStats.Transactions;
+}
+
+
+void DK_USB_ModelInterrupt(void)
+{
+/* This function delivers any pending USB interrupt to DK_USB_ISR, as the PIC
+   would: USBIF follows the enabled flags in UIR, and the interrupt is taken
+   only while GIE, PEIE, and USBIE are set.  A task that has cleared GIE holds
+   it off until it sets GIE again and the host next calls into the model.
+   Each time DK_USB_ISR clears TRNIF, the USTAT FIFO is popped. */
+
+  struct timespec Start,
+                  Stop;
+  sigset_t Signals;
+  unsigned char Passes,
+                Flags;
+
+  for(Passes = 0; Passes < 16; ++Passes)
+  {
+    if( (UIR & UIE) != 0 )
+    {
+      PIR2 |= DK_USB_MODEL_USBIF;
+    }
+
+    if( (INTCON & DK_USB_MODEL_INTCON_GIE) == 0 ||
+        (INTCON & DK_USB_MODEL_INTCON_PEIE) == 0 ||
+        (PIE2 & DK_USB_MODEL_USBIF) == 0 ||
+        (PIR2 & DK_USB_MODEL_USBIF) == 0 )
+    {
+      break;
+    }
+
+    /* Enter the interrupt the way the PIC does: GIE cleared, and nothing
+       else, the scheduler clock included, gets in. */
+    sigprocmask( SIG_BLOCK,
+                 &DK_InterruptSignals,
+                 &Signals );
+    INTCON &= ~DK_USB_MODEL_INTCON_GIE;
+
+    Flags = UIR;
+
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+    DK_USB_ISR();
+    clock_gettime(CLOCK_MONOTONIC, &Stop);
+
+    DK_USB_ModelStats.InterruptSeconds += (Stop.tv_sec - Start.tv_sec) +
+                                          (Stop.tv_nsec - Start.tv_nsec) / 1e9;
+    ++DK_USB_ModelStats.Interrupts;
+
+    if( (Flags & DK_USB_MODEL_UIR_URSTIF) != 0 &&
+        (UIR & DK_USB_MODEL_UIR_URSTIF) == 0 )
+    {
+      /* The reset handler cleared TRNIF until the FIFO was empty. */
+      UstatCount = 0;
+    }
+    else if( UstatCount != 0 && (UIR & DK_USB_MODEL_UIR_TRNIF) == 0 )
+    {
+      --UstatCount;
+      memmove( UstatFifo,
+               UstatFifo + 1,
+               UstatCount );
+
+      if(UstatCount != 0)
+      {
+        USTAT = UstatFifo[0];
+        UIR |= DK_USB_MODEL_UIR_TRNIF;
+      }
+    }
+
+    INTCON |= DK_USB_MODEL_INTCON_GIE;
+    sigprocmask( SIG_SETMASK,
+                 &Signals,
+                 0 );
+  }
+}
+
+
+void DK_USB_ModelBusReset(void)
+{
+/* This function signals a bus reset.  The SIE's ping pong pointers return to
+   the even buffers, every data toggle returns to DATA0, and the statistics
+   start over. */
+
+  memset( PingPongOdd,
+          0,
+          sizeof(PingPongOdd) );
+  memset( HostToggle,
+          0,
+          sizeof(HostToggle) );
+  memset( &DK_USB_ModelStats,
+          0,
+          sizeof(DK_USB_ModelStats) );
+
+  UIR |= DK_USB_MODEL_UIR_URSTIF;
+
+  DK_USB_ModelInterrupt();
+}
+
+
+void DK_USB_ModelStartOfFrame(void)
+{
+/* This function signals the start of a frame, advancing the eleven bit frame
+   number in UFRMH:UFRML. */
+
+  unsigned Frame = ((((unsigned)UFRMH << 8) | UFRML) + 1) & 0x07FF;
+
+  UFRMH = (unsigned char)(Frame >> 8);
+  UFRML = (unsigned char)Frame;
+
+  UIR |= DK_USB_MODEL_UIR_SOFIF;
+
+  DK_USB_ModelInterrupt();
+}
+
+
+void DK_USB_ModelConfigure(void)
+{
+/* This function returns the host's data toggles on every endpoint but zero to
+   DATA0, as a SET_CONFIGURATION does. */
+
+  memset( HostToggle + 1,
+          0,
+          sizeof(HostToggle) - sizeof(HostToggle[0]) );
+}
+
+
+signed DK_USB_ModelSetup( const unsigned char * pPacket )
+{
+/* This function sends a SETUP token and its eight byte packet to endpoint
+   zero.
+
+   pPacket: The setup packet.
+
+   Result:
+   The device's reply; see DK_USB_MODEL_ACK. */
+
+  volatile USB_BufferDescriptor * BufferDescriptor;
+  unsigned char PingPong;
+
+  DK_USB_ModelInterrupt();
+
+  if( (UCON & DK_USB_MODEL_UCON_USBEN) == 0 ||
+      (DK_USB_ModelUEP[0] & DK_USB_MODEL_UEP_EPOUTEN) == 0 )
+  {
+    return DK_USB_MODEL_NONE;
+  }
+
+  BufferDescriptor = DK_USB_ModelBufferDescriptor(0, 0, &PingPong);
+
+  if( UstatCount == sizeof(UstatFifo) ||
+      (BufferDescriptor->STAT & USB_BD_UOWN) == 0 )
+  {
+    ++DK_USB_ModelStats.Naks;
+    return DK_USB_MODEL_NAK;
+  }
+
+  memcpy( BufferDescriptor->ADR,
+          pPacket,
+          8 );
+  BufferDescriptor->CNT = 8;
+  BufferDescriptor->STAT = (BufferDescriptor->STAT & USB_BD_DTS) |
+                           (USB_PID_TOKEN_SETUP << 2);
+
+  /* A setup packet stops the SIE until the MCU has decoded it. */
+  UCON |= DK_USB_MODEL_UCON_PKTDIS;
+
+  /* The data stage starts on DATA1 in both directions. */
+  HostToggle[0][0] = 1;
+  HostToggle[0][1] = 1;
+
+  DK_USB_ModelComplete(0, 0, PingPong);
+  DK_USB_ModelInterrupt();
+
+  return DK_USB_MODEL_ACK;
+}
+
+
+signed DK_USB_ModelIn( unsigned char Endpoint,
+                       unsigned char * pData,
+                       unsigned short * pLength )
+{
+/* This function sends an IN token to an endpoint.
+
+   Endpoint: The endpoint number.
+   pData:    Receives the packet, up to 1023 bytes.
+   pLength:  Receives the packet's length.
+
+   Result:
+   The device's reply; see DK_USB_MODEL_ACK. */
+
+  volatile USB_BufferDescriptor * BufferDescriptor;
+  unsigned char PingPong,
+                Control = DK_USB_ModelUEP[Endpoint],
+                Isochronous = (Control & DK_USB_MODEL_UEP_EPHSHK) == 0,
+                Toggle;
+
+  DK_USB_ModelInterrupt();
+
+  *pLength = 0;
+
+  if( (UCON & DK_USB_MODEL_UCON_USBEN) == 0 ||
+      (Control & DK_USB_MODEL_UEP_EPINEN) == 0 )
+  {
+    return DK_USB_MODEL_NONE;
+  }
+
+  if( (Control & DK_USB_MODEL_UEP_EPSTALL) != 0 )
+  {
+    return DK_USB_MODEL_STALL;
+  }
+
+  BufferDescriptor = DK_USB_ModelBufferDescriptor(Endpoint, 1, &PingPong);
+
+  if( UstatCount == sizeof(UstatFifo) ||
+      (UCON & DK_USB_MODEL_UCON_PKTDIS) != 0 ||
+      (BufferDescriptor->STAT & USB_BD_UOWN) == 0 )
+  {
+    if(Isochronous == TRUE)
+    {
+      return DK_USB_MODEL_NONE;
+    }
+
+    ++DK_USB_ModelStats.Naks;
+    return DK_USB_MODEL_NAK;
+  }
+
+  if( (BufferDescriptor->STAT & 0x04) != 0 )
+  {
+    /* BSTALL. */
+    return DK_USB_MODEL_STALL;
+  }
+
+  *pLength = BufferDescriptor->CNT |
+             ((unsigned short)(BufferDescriptor->STAT & 0x03) << 8);
+  memcpy( pData,
+          BufferDescriptor->ADR,
+          *pLength );
+
+  Toggle = (BufferDescriptor->STAT & USB_BD_DTS) != 0;
+
+  if(Isochronous == FALSE)
+  {
+    if(Toggle != HostToggle[Endpoint][1])
+    {
+      ++DK_USB_ModelStats.ToggleErrors;
+    }
+    else
+    {
+      HostToggle[Endpoint][1] ^= 1;
+    }
+  }
+
+  BufferDescriptor->STAT = (BufferDescriptor->STAT & (USB_BD_DTS | 0x03)) |
+                           (USB_PID_TOKEN_IN << 2);
+
+  DK_USB_ModelComplete(Endpoint, 1, PingPong);
+  DK_USB_ModelInterrupt();
+
+  return DK_USB_MODEL_ACK;
+}
+
+
+signed DK_USB_ModelOut( unsigned char Endpoint,
+                        const unsigned char * pData,
+                        unsigned short Length )
+{
+/* This function sends an OUT token and a data packet to an endpoint.
+
+   Endpoint: The endpoint number.
+   pData:    The packet.
+   Length:   The packet's length.
+
+   Result:
+   The device's reply; see DK_USB_MODEL_ACK. */
+
+  volatile USB_BufferDescriptor * BufferDescriptor;
+  unsigned char PingPong,
+                Control = DK_USB_ModelUEP[Endpoint],
+                Isochronous = (Control & DK_USB_MODEL_UEP_EPHSHK) == 0,
+                Toggle = HostToggle[Endpoint][0];
+  unsigned short Count;
+
+  DK_USB_ModelInterrupt();
+
+  if( (UCON & DK_USB_MODEL_UCON_USBEN) == 0 ||
+      (Control & DK_USB_MODEL_UEP_EPOUTEN) == 0 )
+  {
+    return DK_USB_MODEL_NONE;
+  }
+
+  if( (Control & DK_USB_MODEL_UEP_EPSTALL) != 0 )
+  {
+    return DK_USB_MODEL_STALL;
+  }
+
+  BufferDescriptor = DK_USB_ModelBufferDescriptor(Endpoint, 0, &PingPong);
+
+  if( UstatCount == sizeof(UstatFifo) ||
+      (UCON & DK_USB_MODEL_UCON_PKTDIS) != 0 ||
+      (BufferDescriptor->STAT & USB_BD_UOWN) == 0 )
+  {
+    if(Isochronous == TRUE)
+    {
+      return DK_USB_MODEL_NONE;
+    }
+
+    ++DK_USB_ModelStats.Naks;
+    return DK_USB_MODEL_NAK;
+  }
+
+  if( (BufferDescriptor->STAT & 0x04) != 0 )
+  {
+    /* BSTALL. */
+    return DK_USB_MODEL_STALL;
+  }
+
+  if(Isochronous == FALSE)
+  {
+    HostToggle[Endpoint][0] ^= 1;
+
+    if( (BufferDescriptor->STAT & USB_BD_DTSEN) != 0 &&
+        ((BufferDescriptor->STAT & USB_BD_DTS) != 0) != Toggle )
+    {
+      /* Taken for a retry of a packet already received. */
+      ++DK_USB_ModelStats.IgnoredOuts;
+      return DK_USB_MODEL_ACK;
+    }
+  }
+
+  Count = BufferDescriptor->CNT |
+          ((unsigned short)(BufferDescriptor->STAT & 0x03) << 8);
+
+  if(Length > Count)
+  {
+    ++DK_USB_ModelStats.Overflows;
+    Length = Count;
+  }
+
+  memcpy( BufferDescriptor->ADR,
+          pData,
+          Length );
+  BufferDescriptor->CNT = (unsigned char)Length;
+  BufferDescriptor->STAT = (BufferDescriptor->STAT & USB_BD_DTS) |
+                           (USB_PID_TOKEN_OUT << 2) |
+                           ((Length >> 8) & 0x03);
+
+  DK_USB_ModelComplete(Endpoint, 0, PingPong);
+  DK_USB_ModelInterrupt();
+
+  return DK_USB_MODEL_ACK;
+}
+
+
+signed DK_USB_ModelControlRead( const unsigned char * pSetup,
+                                unsigned char * pData,
+                                unsigned short * pLength )
+{
+/* This function performs a control read on endpoint zero: the setup stage,
+   IN tokens until a short packet or wLength bytes, then a zero length OUT for
+   the status stage.  NAKed tokens are retried, yielding to the device's tasks
+   between tries.
+
+   pSetup:  The setup packet.
+   pData:   Receives the data stage, up to wLength bytes.
+   pLength: Receives the number of bytes in the data stage.
+
+   Result:
+   DK_SUCCESS if every stage was acknowledged, otherwise DK_FAILURE. */
+
+  unsigned short Requested = pSetup[6] | (pSetup[7] << 8),
+                 Length;
+  unsigned Tries = 0;
+  signed Reply;
+
+  *pLength = 0;
+
+  while( (Reply = DK_USB_ModelSetup(pSetup)) == DK_USB_MODEL_NAK )
+  {
+    if(++Tries == DK_USB_MODEL_RETRIES)
+    {
+      return DK_FAILURE;
+    }
+
+    DK_InvokeScheduler();
+  }
+
+  if(Reply != DK_USB_MODEL_ACK)
+  {
+    return DK_FAILURE;
+  }
+
+  for(Tries = 0; *pLength < Requested; )
+  {
+    Reply = DK_USB_ModelIn(0, pData + *pLength, &Length);
+
+    if(Reply == DK_USB_MODEL_NAK)
+    {
+      if(++Tries == DK_USB_MODEL_RETRIES)
+      {
+        return DK_FAILURE;
+      }
+
+      DK_InvokeScheduler();
+      continue;
+    }
+
+    if(Reply != DK_USB_MODEL_ACK || *pLength + Length > Requested)
+    {
+      return DK_FAILURE;
+    }
+
+    *pLength += Length;
+    Tries = 0;
+
+    if(Length < 64)
+    {
+      break;
+    }
+  }
+
+  for(Tries = 0;
+      (Reply = DK_USB_ModelOut(0, pData, 0)) == DK_USB_MODEL_NAK; )
+  {
+    if(++Tries == DK_USB_MODEL_RETRIES)
+    {
+      return DK_FAILURE;
+    }
+
+    DK_InvokeScheduler();
+  }
+
+  return Reply == DK_USB_MODEL_ACK ? DK_SUCCESS : DK_FAILURE;
+}
+
+
+signed DK_USB_ModelControlWrite( const unsigned char * pSetup )
+{
+/* This function performs a control write with no data stage on endpoint zero:
+   the setup stage, then a zero length IN for the status stage.
+
+   pSetup: The setup packet.
+
+   Result:
+   DK_SUCCESS if both stages were acknowledged, otherwise DK_FAILURE. */
+
+  unsigned char Data[64];
+  unsigned short Length;
+  unsigned Tries = 0;
+  signed Reply;
+
+  while( (Reply = DK_USB_ModelSetup(pSetup)) == DK_USB_MODEL_NAK )
+  {
+    if(++Tries == DK_USB_MODEL_RETRIES)
+    {
+      return DK_FAILURE;
+    }
+
+    DK_InvokeScheduler();
+  }
+
+  if(Reply != DK_USB_MODEL_ACK)
+  {
+    return DK_FAILURE;
+  }
+
+  for(Tries = 0;
+      (Reply = DK_USB_ModelIn(0, Data, &Length)) == DK_USB_MODEL_NAK; )
+  {
+    if(++Tries == DK_USB_MODEL_RETRIES)
+    {
+      return DK_FAILURE;
+    }
+
+    DK_InvokeScheduler();
+  }
+
+  return (Reply == DK_USB_MODEL_ACK && Length == 0) ? DK_SUCCESS : DK_FAILURE;
+}
+#endif /* DK_USB_MODEL */
@@ -0,0 +1,228 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the declarations for DK_USB_Model.c, a register level model
+of the PIC18F4550's serial interface engine (SIE) for the POSIX host target.
+When DK_USB_MODEL is defined, DK_Specific.h includes this file in place of
+p18f4550.h and DK_USB.c is built exactly as it is for the PIC, against the
+fake special function registers below.
+
+A scripted host drives the model one transaction at a time.  Each call plays
+the part of the SIE: it checks the endpoint's control register and the UOWN,
+BSTALL, and data toggle bits of the buffer descriptor the ping pong pointer
+selects, moves the data, hands the descriptor back with the token's PID,
+pushes USTAT through its four entry FIFO, and raises TRNIF.  DK_USB_ISR is
+then called the way the PIC would call it: only while GIE, PEIE, and USBIE are
+all set, with GIE cleared and the kernel's signals blocked for the duration.
+*******************************************************************************/
+
+#ifndef DK_USB_MODEL_H
+#define DK_USB_MODEL_H
+
+
+/* Program memory is ordinary memory on the host. */
+#define memcpypgm2ram( pDestination, pSource, Length )\
+  memcpy( (pDestination), (pSource), (Length) )
+
+
+/*******************************************************************************
+Special function registers.  PIC18F2455/2550/4455/4550 Data Sheet, January,
+2007, 17.2 USB Status and Control.
+*******************************************************************************/
+extern volatile unsigned char UCON,
+                              UCFG,
+                              UIR,
+                              UIE,
+                              UEIR,
+                              UEIE,
+                              USTAT,
+                              UADDR,
+                              UFRML,
+                              UFRMH,
+                              PIR2,
+                              PIE2,
+                              INTCON;
+
+/* UEP0 through UEP15 are contiguous, as on the PIC. */
+extern volatile unsigned char DK_USB_ModelUEP[16];
+
+typedef struct
+{
+  unsigned char :      1,
+                SUSPND: 1,
+                RESUME: 1,
+                USBEN:  1,
+                PKTDIS: 1,
+                SE0:    1,
+                PPBRST: 1,
+                :       1;
+} DK_USB_ModelUCONbits;
+
+typedef struct
+{
+  unsigned char PPB0:   1,
+                PPB1:   1,
+                FSEN:   1,
+                UTRDIS: 1,
+                UPUEN:  1,
+                :       1,
+                UOEMON: 1,
+                UTEYE:  1;
+} DK_USB_ModelUCFGbits;
+
+typedef struct
+{
+  unsigned char URSTIF:  1,
+                UERRIF:  1,
+                ACTVIF:  1,
+                TRNIF:   1,
+                IDLEIF:  1,
+                STALLIF: 1,
+                SOFIF:   1,
+                :        1;
+} DK_USB_ModelUIRbits;
+
+typedef struct
+{
+  unsigned char URSTIE:  1,
+                UERRIE:  1,
+                ACTVIE:  1,
+                TRNIE:   1,
+                IDLEIE:  1,
+                STALLIE: 1,
+                SOFIE:   1,
+                :        1;
+} DK_USB_ModelUIEbits;
+
+typedef struct
+{
+  unsigned char EPSTALL:  1,
+                EPINEN:   1,
+                EPOUTEN:  1,
+                EPCONDIS: 1,
+                EPHSHK:   1,
+                :         3;
+} DK_USB_ModelUEPbits;
+
+typedef struct
+{
+  unsigned char :     5,
+                USBIF: 1,
+                :     2;
+} DK_USB_ModelPIR2bits;
+
+typedef struct
+{
+  unsigned char :     5,
+                USBIE: 1,
+                :     2;
+} DK_USB_ModelPIE2bits;
+
+typedef struct
+{
+  unsigned char RBIF:   1,
+                INT0IF: 1,
+                TMR0IF: 1,
+                RBIE:   1,
+                INT0IE: 1,
+                TMR0IE: 1,
+                PEIE:   1,
+                GIE:    1;
+} DK_USB_ModelINTCONbits;
+
+#define DK_USB_MODEL_BITS( Type, Register )\
+  (*(volatile DK_USB_Model##Type *)&(Register))
+
+#define UCONbits    DK_USB_MODEL_BITS(UCONbits, UCON)
+#define UCFGbits    DK_USB_MODEL_BITS(UCFGbits, UCFG)
+#define UIRbits     DK_USB_MODEL_BITS(UIRbits, UIR)
+#define UIEbits     DK_USB_MODEL_BITS(UIEbits, UIE)
+#define PIR2bits    DK_USB_MODEL_BITS(PIR2bits, PIR2)
+#define PIE2bits    DK_USB_MODEL_BITS(PIE2bits, PIE2)
+#define INTCONbits  DK_USB_MODEL_BITS(INTCONbits, INTCON)
+
+#define UEP0   (DK_USB_ModelUEP[0])
+#define UEP1   (DK_USB_ModelUEP[1])
+#define UEP2   (DK_USB_ModelUEP[2])
+#define UEP3   (DK_USB_ModelUEP[3])
+#define UEP0bits  DK_USB_MODEL_BITS(UEPbits, UEP0)
+#define UEP1bits  DK_USB_MODEL_BITS(UEPbits, UEP1)
+#define UEP2bits  DK_USB_MODEL_BITS(UEPbits, UEP2)
+#define UEP3bits  DK_USB_MODEL_BITS(UEPbits, UEP3)
+
+/* Register bits the model itself tests. */
+#define DK_USB_MODEL_UCON_USBEN    0x08
+#define DK_USB_MODEL_UCON_PKTDIS   0x10
+#define DK_USB_MODEL_UIR_URSTIF    0x01
+#define DK_USB_MODEL_UIR_TRNIF     0x08
+#define DK_USB_MODEL_UIR_SOFIF     0x40
+#define DK_USB_MODEL_UEP_EPSTALL   0x01
+#define DK_USB_MODEL_UEP_EPINEN    0x02
+#define DK_USB_MODEL_UEP_EPOUTEN   0x04
+#define DK_USB_MODEL_UEP_EPHSHK    0x10
+#define DK_USB_MODEL_USBIF         0x20
+#define DK_USB_MODEL_INTCON_PEIE   0x40
+#define DK_USB_MODEL_INTCON_GIE    0x80
+
+
+/*******************************************************************************
+The scripted host.
+*******************************************************************************/
+/* The device's reply to a token, as the host sees it.  DK_USB_MODEL_NONE is
+   no reply at all: the module is off, the endpoint is disabled, or an
+   isochronous endpoint had nothing ready. */
+#define DK_USB_MODEL_ACK    (1)
+#define DK_USB_MODEL_NAK    (0)
+#define DK_USB_MODEL_STALL  (-1)
+#define DK_USB_MODEL_NONE   (-2)
+
+/* How many times a control transfer retries a NAKed token before giving up.
+   The host yields to the device's tasks with DK_InvokeScheduler between
+   tries. */
+#ifndef DK_USB_MODEL_RETRIES
+  #define DK_USB_MODEL_RETRIES  1000
+#endif
+
+/* What the model has seen since the last DK_USB_ModelBusReset. */
+typedef struct
+{
+  unsigned long Transactions,
+                Naks,
+                Interrupts,
+
+                /* IN packets that carried the wrong data toggle.  The host
+                   would have thrown their data away. */
+                ToggleErrors,
+
+                /* OUT packets the SIE acknowledged but dropped, because their
+                   data toggle did not match a descriptor with DTSEN set. */
+                IgnoredOuts,
+
+                /* OUT packets longer than the descriptor's CNT. */
+                Overflows;
+
+  /* Host time spent in DK_USB_ISR, in seconds. */
+  double InterruptSeconds;
+} DK_USB_ModelStatistics;
+
+extern DK_USB_ModelStatistics DK_USB_ModelStats;
+
+void DK_USB_ModelInterrupt(void);
+void DK_USB_ModelBusReset(void);
+void DK_USB_ModelStartOfFrame(void);
+signed DK_USB_ModelSetup( const unsigned char * pPacket );
+signed DK_USB_ModelIn( unsigned char Endpoint,
+                       unsigned char * pData,
+                       unsigned short * pLength );
+signed DK_USB_ModelOut( unsigned char Endpoint,
+                        const unsigned char * pData,
+                        unsigned short Length );
+void DK_USB_ModelConfigure(void);
+signed DK_USB_ModelControlRead( const unsigned char * pSetup,
+                                unsigned char * pData,
+                                unsigned short * pLength );
+signed DK_USB_ModelControlWrite( const unsigned char * pSetup );
+
+
+#endif /* DK_USB_MODEL_H */
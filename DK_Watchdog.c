@@ -0,0 +1,433 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the task watchdogs and deadline monitor; see DK_Watchdog.h.
+*******************************************************************************/
+
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  13
+
+#include "DK_Global.h"
+
+
+#if defined(DK_WATCHDOG_HARDWARE) && !defined(__18F4550)
+  #error DK_WATCHDOG_HARDWARE is only supported on the PIC18F4550.
+#endif
+
+
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+typedef struct
+{
+  DK_Time Timeout,      /* Ticks allowed between check ins, zero for none. */
+          LastCheckIn,
+          Deadline;
+  unsigned DeadlineDeclared:1,
+           RestartPending:1,    /* Killed, to be started again once it is no
+                                   longer the running task. */
+           Policy:2;
+  unsigned char Watched;        /* Its place in WatchedSegment plus one, or
+                                   zero. */
+  unsigned Misses;
+
+  /* What the task was started with, for DK_WATCHDOG_RESTART. */
+  DK_TaskAddress Task;
+  unsigned QuantumShare;
+} DK_WatchdogRecord;
+
+/* One for each task but the idle task, which is never watched; see
+   DK_WATCHDOG_RECORD. */
+static DK_WatchdogRecord WatchdogSegment[DK_MAXIMUM_TASKS - 1];
+
+/* A task's record, by identity.  Not for the idle task. */
+#define DK_WATCHDOG_RECORD( Identity )  (WatchdogSegment[(Identity) - 1])
+
+/* The identities of the tasks with a watchdog, deadline, or restart armed, in
+   no particular order, so DK_WatchdogMonitor need not walk every record each
+   tick. */
+static unsigned char WatchedSegment[DK_MAXIMUM_TASKS - 1],
+                     WatchedCount = 0;
+
+
+/*******************************************************************************
+Function definitions.
+*******************************************************************************/
+static unsigned char DK_WatchdogMiss( unsigned char Identity,
+                                      unsigned char Deadline );
+static void DK_WatchdogRestart( unsigned char Identity );
+static void DK_WatchdogWatch( unsigned char Identity );
+static void DK_WatchdogUnwatch( unsigned char Identity );
+
+signed DK_WatchdogInitialize(void)
+{
+/* Starts the hardware watchdog timer if DK_WATCHDOG_HARDWARE is defined.
+   Called by DK_InitializeKernel.
+
+   Result:
+   DK_SUCCESS if successful. */
+
+  #if defined(DK_WATCHDOG_HARDWARE) && defined(__18F4550)
+  _asm
+    clrwdt
+  _endasm
+
+  WDTCONbits.SWDTEN = 1;
+  #endif
+
+  return DK_SUCCESS;
+}
+
+
+void DK_WatchdogReset( unsigned char Identity,
+                       DK_TaskAddress Task,
+                       unsigned QuantumShare )
+{
+/* Clears a task's watchdog and deadline, and notes what it was started with.
+   Called by DK_InitializeTask, which never hands out an identity with a
+   restart pending; see DK_WatchdogIsRestartPending. */
+
+  DK_WatchdogRecord * pRecord = &DK_WATCHDOG_RECORD(Identity);
+
+  DK_EnterCriticalSection();
+
+  pRecord->Timeout = 0;
+  pRecord->DeadlineDeclared = FALSE;
+  DK_WatchdogUnwatch(Identity);
+
+  DK_ExitCriticalSection();
+
+  pRecord->Policy = DK_WATCHDOG_LOG;
+  pRecord->Misses = 0;
+  pRecord->Task = Task;
+  pRecord->QuantumShare = QuantumShare;
+}
+
+
+unsigned char DK_WatchdogIsRestartPending( unsigned char Identity )
+{
+/* Result:
+   TRUE if the task was killed by its policy and is still to be started
+   again.  Its identity stays taken until then, so that the restart cannot be
+   lost to a task initialized in the meantime. */
+
+  return DK_WATCHDOG_RECORD(Identity).RestartPending;
+}
+
+
+signed DK_WatchdogConfigure( unsigned char Identity,
+                             DK_Time Timeout,
+                             DK_WatchdogPolicy Policy )
+{
+/* Sets a task's watchdog timeout and the policy for its misses, watchdog and
+   deadline alike.  The timeout starts now.
+
+   Parameters:
+   Identity  The task, not the idle task.
+   Timeout   Ticks allowed between check ins, or zero for no watchdog.
+   Policy    What to do on a miss.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if there is no such task. */
+
+  if( Identity == (unsigned)0 || Identity >= (unsigned)DK_MAXIMUM_TASKS )
+  {
+    return DK_FAILURE;
+  }
+
+  DK_EnterCriticalSection();
+
+  DK_WATCHDOG_RECORD(Identity).Timeout = Timeout;
+  DK_WATCHDOG_RECORD(Identity).LastCheckIn = DK_GetTickCount();
+  DK_WATCHDOG_RECORD(Identity).Policy = Policy;
+
+  if(Timeout != (unsigned)0)
+  {
+    DK_WatchdogWatch(Identity);
+  }
+  else
+  {
+    DK_WatchdogUnwatch(Identity);
+  }
+
+  DK_ExitCriticalSection();
+
+  return DK_SUCCESS;
+}
+
+
+void DK_WatchdogCheckIn(void)
+{
+/* Restarts the running task's watchdog timeout.  The idle task has none. */
+
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+
+  if(Identity != (unsigned)0)
+  {
+    DK_WATCHDOG_RECORD(Identity).LastCheckIn = DK_GetTickCount();
+  }
+}
+
+
+signed DK_DeadlineDeclare( DK_Time Ticks )
+{
+/* Declares that the running task will call DK_DeadlineComplete within Ticks
+   ticks, replacing any deadline already declared.
+
+   Result:
+   DK_SUCCESS if successful, DK_FAILURE if called from the idle task. */
+
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+
+  if(Identity == (unsigned)0)
+  {
+    return DK_FAILURE;
+  }
+
+  DK_EnterCriticalSection();
+
+  DK_WATCHDOG_RECORD(Identity).Deadline = DK_GetTickCount() + Ticks;
+  DK_WATCHDOG_RECORD(Identity).DeadlineDeclared = TRUE;
+  DK_WatchdogWatch(Identity);
+
+  DK_ExitCriticalSection();
+
+  return DK_SUCCESS;
+}
+
+
+signed DK_DeadlineComplete(void)
+{
+/* Ends the running task's deadline.
+
+   Result:
+   DK_SUCCESS if the deadline was met, DK_FAILURE if it was missed or none was
+   declared. */
+
+  signed Result = DK_FAILURE;
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+
+  if(Identity == (unsigned)0)
+  {
+    return DK_FAILURE;
+  }
+
+  DK_EnterCriticalSection();
+
+  if(DK_WATCHDOG_RECORD(Identity).DeadlineDeclared != FALSE)
+  {
+    DK_WATCHDOG_RECORD(Identity).DeadlineDeclared = FALSE;
+    DK_WatchdogUnwatch(Identity);
+    Result = DK_SUCCESS;
+  }
+
+  DK_ExitCriticalSection();
+
+  return Result;
+}
+
+
+unsigned DK_WatchdogGetMisses( unsigned char Identity )
+{
+/* Result:
+   The number of watchdog timeouts and deadlines the task has missed since it
+   was initialized, or restarted. */
+
+  if( Identity == (unsigned)0 || Identity >= (unsigned)DK_MAXIMUM_TASKS )
+  {
+    return 0;
+  }
+
+  return DK_WATCHDOG_RECORD(Identity).Misses;
+}
+
+
+unsigned char DK_WatchdogMonitor( DK_Time Now )
+{
+/* Checks the watchdog and deadline of every task that has one armed, and
+   starts again any task killed on an earlier tick.  Called by DK_Scheduler
+   once a tick, while the scheduler is not locked.
+
+   Parameters:
+   Now  The tick count.
+
+   Result:
+   TRUE if the running task was suspended or killed, so the scheduler must
+   switch tasks now. */
+
+  unsigned char Result = FALSE,
+                Index = WatchedCount,
+                Identity = 0;
+  DK_WatchdogRecord * pRecord = 0;
+  DK_TaskState State = DEAD;
+
+  #if defined(DK_WATCHDOG_HARDWARE) && defined(__18F4550)
+  /* The scheduler clock still runs. */
+  _asm
+    clrwdt
+  _endasm
+  #endif
+
+  /* Walk the list from its end.  A task that leaves it is replaced by the
+     last, and a restarted task joins it at the end, to be checked from the
+     next tick.  A restart may take more than one task off, so the list can
+     shrink past where the walk has got to. */
+  while(Index != (unsigned)0)
+  {
+    --Index;
+
+    if(Index >= WatchedCount)
+    {
+      continue;
+    }
+
+    Identity = WatchedSegment[Index];
+    pRecord = &DK_WATCHDOG_RECORD(Identity);
+    State = TCBSegment[Identity].State;
+
+    if(pRecord->RestartPending != FALSE)
+    {
+      DK_WatchdogRestart(Identity);
+    }
+    else if( State != DEAD && State != DORMANT )
+    {
+      if( pRecord->Timeout != (unsigned)0 &&
+          DK_TimeAfter(Now, pRecord->LastCheckIn + pRecord->Timeout) )
+      {
+        /* Count again a timeout from now. */
+        pRecord->LastCheckIn = Now;
+        Result |= DK_WatchdogMiss(Identity, FALSE);
+      }
+      else if( pRecord->DeadlineDeclared != FALSE &&
+               DK_TimeAfter(Now, pRecord->Deadline) )
+      {
+        pRecord->DeadlineDeclared = FALSE;
+        Result |= DK_WatchdogMiss(Identity, TRUE);
+        DK_WatchdogUnwatch(Identity);
+      }
+    }
+  }
+
+  return Result;
+}
+
+
+static unsigned char DK_WatchdogMiss( unsigned char Identity,
+                                      unsigned char Deadline )
+{
+/* Counts a miss and applies the task's policy.  Called by DK_WatchdogMonitor.
+
+   Result:
+   TRUE if the task was the running task and no longer runs. */
+
+  DK_WatchdogRecord * pRecord = &DK_WATCHDOG_RECORD(Identity);
+
+  ++pRecord->Misses;
+
+  if(Deadline != FALSE)
+  {
+    DK_Log2("Task %u missed a deadline, miss %u", Identity, pRecord->Misses);
+  }
+  else
+  {
+    DK_Log2("Task %u missed its watchdog, miss %u", Identity, pRecord->Misses);
+  }
+
+  switch(pRecord->Policy)
+  {
+    case DK_WATCHDOG_DEMOTE:
+      TCBSegment[Identity].QuantumShare = 1;
+      break;
+
+    case DK_WATCHDOG_SUSPEND:
+      DK_ConfigureTaskState(Identity, DORMANT);
+      return pCurrentTaskTCB == &TCBSegment[Identity];
+
+    case DK_WATCHDOG_RESTART:
+      /* Started again on the next tick, when it is sure not to be running. */
+      DK_ConfigureTaskState(Identity, DEAD);
+      pRecord->RestartPending = TRUE;
+      return pCurrentTaskTCB == &TCBSegment[Identity];
+
+    default:
+      break;
+  }
+
+  return FALSE;
+}
+
+
+static void DK_WatchdogRestart( unsigned char Identity )
+{
+/* Starts a killed task again, from its entry point and with its watchdog
+   settings.  It may come back with another identity. */
+
+  DK_WatchdogRecord Saved = DK_WATCHDOG_RECORD(Identity);
+  unsigned char NewIdentity = 0;
+
+  /* The old identity is given up along with everything armed on it. */
+  DK_WATCHDOG_RECORD(Identity).Timeout = 0;
+  DK_WATCHDOG_RECORD(Identity).DeadlineDeclared = FALSE;
+  DK_WATCHDOG_RECORD(Identity).RestartPending = FALSE;
+  DK_WatchdogUnwatch(Identity);
+
+  NewIdentity = DK_InitializeTask( Saved.Task,
+                                   READY,
+                                   Saved.QuantumShare );
+
+  if(NewIdentity == (unsigned)0)
+  {
+    DK_Log1("Task %u could not be restarted", Identity);
+    return;
+  }
+
+  DK_WATCHDOG_RECORD(NewIdentity).Timeout = Saved.Timeout;
+  DK_WATCHDOG_RECORD(NewIdentity).LastCheckIn = DK_GetTickCount();
+  DK_WATCHDOG_RECORD(NewIdentity).Policy = Saved.Policy;
+  DK_WATCHDOG_RECORD(NewIdentity).Misses = Saved.Misses;
+
+  if(Saved.Timeout != (unsigned)0)
+  {
+    DK_WatchdogWatch(NewIdentity);
+  }
+
+  DK_Log2("Task %u restarted as task %u", Identity, NewIdentity);
+}
+
+
+static void DK_WatchdogWatch( unsigned char Identity )
+{
+/* Adds a task to the list DK_WatchdogMonitor checks, if it is not there
+   already.  Called with interrupts disabled. */
+
+  if(DK_WATCHDOG_RECORD(Identity).Watched == (unsigned)0)
+  {
+    WatchedSegment[WatchedCount++] = Identity;
+    DK_WATCHDOG_RECORD(Identity).Watched = WatchedCount;
+  }
+}
+
+
+static void DK_WatchdogUnwatch( unsigned char Identity )
+{
+/* Takes a task off the list DK_WatchdogMonitor checks, unless it still has a
+   watchdog, deadline, or restart armed.  The last task on the list takes its
+   place.  Called with interrupts disabled. */
+
+  DK_WatchdogRecord * pRecord = &DK_WATCHDOG_RECORD(Identity);
+  unsigned char Last = 0;
+
+  if( pRecord->Watched == (unsigned)0 ||
+      pRecord->Timeout != (unsigned)0 ||
+      pRecord->DeadlineDeclared != FALSE ||
+      pRecord->RestartPending != FALSE )
+  {
+    return;
+  }
+
+  Last = WatchedSegment[--WatchedCount];
+  WatchedSegment[pRecord->Watched - 1] = Last;
+  DK_WATCHDOG_RECORD(Last).Watched = pRecord->Watched;
+  pRecord->Watched = 0;
+}
@@ -0,0 +1,68 @@
+/*******************************************************************************
+Dreamcatcher Kernel
+Stephen Niedzielski
+
+This file contains the declarations for DK_Watchdog.c, the task watchdogs and
+deadline monitor.
+
+A task given a watchdog timeout must call DK_WatchdogCheckIn at least that
+often, and a task may declare that it will reach a point within so many ticks
+with DK_DeadlineDeclare, then DK_DeadlineComplete when it gets there.  Once a
+tick, the scheduler clock checks each task with a watchdog or deadline armed;
+tasks with neither cost it nothing.  A miss is counted and logged, and then
+the task's policy is applied:
+
+  DK_WATCHDOG_LOG      Nothing more.
+  DK_WATCHDOG_DEMOTE   The task's time share is cut to a single quantum.
+  DK_WATCHDOG_SUSPEND  The task is made DORMANT.
+  DK_WATCHDOG_RESTART  The task is killed and started over from its entry
+                       point, with its watchdog settings, on the next tick.
+                       Its identity is not handed out again until then.
+
+A watchdog keeps counting after a miss, so a task that stays stuck misses
+again every timeout.  A deadline is counted only once.  Tasks that are DEAD
+or DORMANT are not watched.
+
+If DK_WATCHDOG_HARDWARE is defined, the PIC's watchdog timer is enabled as
+well and cleared every tick.  It resets the device if the scheduler clock
+stops, such as when interrupts are left disabled.  The WDTPS configuration
+bits must give it a period of several quanta.
+*******************************************************************************/
+
+#ifndef DK_WATCHDOG_H
+#define DK_WATCHDOG_H
+
+
+/* What is done to a task that misses its watchdog or a deadline. */
+typedef enum
+{
+  DK_WATCHDOG_LOG = 0,
+  DK_WATCHDOG_DEMOTE,
+  DK_WATCHDOG_SUSPEND,
+  DK_WATCHDOG_RESTART
+} DK_WatchdogPolicy;
+
+
+signed DK_WatchdogConfigure( unsigned char Identity,
+                             DK_Time Timeout,
+                             DK_WatchdogPolicy Policy );
+void DK_WatchdogCheckIn(void);
+signed DK_DeadlineDeclare( DK_Time Ticks );
+signed DK_DeadlineComplete(void);
+unsigned DK_WatchdogGetMisses( unsigned char Identity );
+
+
+/*******************************************************************************
+KERNEL
+Kernel function declarations, symbols, macros, and types that users should not
+use.
+*******************************************************************************/
+signed DK_WatchdogInitialize(void);
+void DK_WatchdogReset( unsigned char Identity,
+                       DK_TaskAddress Task,
+                       unsigned QuantumShare );
+unsigned char DK_WatchdogIsRestartPending( unsigned char Identity );
+unsigned char DK_WatchdogMonitor( DK_Time Now );
+
+
+#endif /* DK_WATCHDOG_H */
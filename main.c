@@ -3,10 +3,89 @@ NES Controller
 Stephen Niedzielski
 *******************************************************************************/
 
+/* This file's number in log records; see DK_Log.h. */
+#define DK_LOG_FILE  7
+
 #include "DK_Global.h"
 #include "main.h"
 
 
+#if defined(DK_POSIX) || defined(DK_QEMU)
+/*******************************************************************************
+Stand-ins for the port pins on the host and QEMU.
+*******************************************************************************/
+volatile unsigned char LEDs[8] = {0};
+volatile unsigned char NES_Pins[3] = {0, 0, 0xFF};
+#endif /* DK_POSIX || DK_QEMU. */
+
+
+/*******************************************************************************
+Global variables.
+*******************************************************************************/
+/* Each pad's data line bit on NES_DATA_PORT. */
+static const rom unsigned char NES_DataMasks[NES_PADS_MAX] = {NES_DATA_MASKS};
+
+/* Each pad's debounced buttons, and the low and high bits of its buttons'
+   debounce counters. */
+static volatile unsigned char NES_Buttons[NES_PADS] = {0},
+                              NES_Count0[NES_PADS] = {0},
+                              NES_Count1[NES_PADS] = {0};
+
+/* Each pad's recent debounced changes, the entry the next one goes in, and
+   the number recorded, up to NES_HISTORY.  The history may be larger than
+   what is left of the kernel's bank, so it is a section of its own that the
+   linker may place in any data bank. */
+#ifdef __18F4550
+#pragma udata NES_Histories /* Begin relocatable uninitialized data region. */
+  static volatile NES_Event NES_History[NES_PADS][NES_HISTORY];
+#pragma udata  /* Return to default data region. */
+#else
+  static volatile NES_Event NES_History[NES_PADS][NES_HISTORY];
+#endif
+static volatile unsigned char NES_HistoryHead[NES_PADS] = {0},
+                              NES_HistoryCount[NES_PADS] = {0};
+
+/* The number of scans that have finished. */
+static volatile DK_Time NES_ScanCount = 0;
+
+/* The task asleep in ReadNESController until the next scan finishes, or
+   zero. */
+static volatile unsigned char NES_Reader = 0;
+
+/* The kernel time, in microseconds, and the USB frame at which the latest
+   scan latched the pads. */
+static volatile DK_Time NES_LatchTime = 0;
+static volatile unsigned NES_LatchFrame = 0;
+
+#ifdef __18F4550
+/* Set from the start of a hardware read until its last bit is shifted in. */
+static volatile unsigned char NES_ReadBusy = FALSE;
+
+#if NES_PADS > 1
+/* Each pad's buttons as they are clocked in by CCP1, and the number of bits
+   so far.  Eight shifts push the last scan's bits out, so neither needs
+   clearing. */
+static unsigned char NES_Raw[NES_PADS] = {0},
+                     NES_Bits = 0;
+#endif
+#endif /* __18F4550. */
+
+
+#if !defined(__18F4550) || NES_PADS > 1
+static void NESControllerSample( unsigned char * pRaw );
+#endif
+#ifndef __18F4550
+static void NESControllerShift( unsigned char * pRaw );
+#endif
+static void NESControllerScanned( const unsigned char * pRaw );
+#ifdef __18F4550
+static void NESControllerLatched(void);
+#if NES_PADS == 1
+static void NESControllerShifted(void);
+#endif
+#endif /* __18F4550. */
+
+
 /*******************************************************************************
 User defined functions called by the kernel.
 *******************************************************************************/
@@ -15,6 +94,10 @@ void DK_IdleTaskHook(void)
 /* User defined hook. */
 
   /* Statistic function calls. */
+
+  /* Send what has been logged.  Whatever the line cannot take now is sent on
+     a later pass. */
+  DK_LogDrain(DK_USART_SendCharacter);
 }
 
 
@@ -28,9 +111,33 @@ void DK_ISR()
   /* Turn on an LED. */
   LED7 = 1;
 
-  /* Filter interrupt to appropriate handler. */
-  /* Process interrupt. */
-  /* Clear interrupt flag. */
+  #ifdef __18F4550
+  /* The controller's latch pulse has ended. */
+  if(PIR1bits.CCP1IF == (unsigned)1)
+  {
+    NESControllerLatched();
+  }
+
+  #if NES_PADS == 1
+  /* The controller's buttons have been shifted in. */
+  if(PIR1bits.SSPIF == (unsigned)1)
+  {
+    NESControllerShifted();
+  }
+  #endif
+  #endif /* __18F4550. */
+}
+
+
+void DK_USB_FrameTrigger(void)
+{
+/* This function is called at the start of every USB frame, once a
+   millisecond.  Like DK_QuantumTrigger, it runs in interrupt context and
+   should return normally. */
+
+  /* Scan the pads as late as possible before the host collects the report.
+     The report is sent when the scan finishes. */
+  NESControllerStartRead();
 }
 
 
@@ -41,28 +148,47 @@ void DK_QuantumTrigger(unsigned QuantumCount)
    as the task stack is not blown).  Users will wish to define quantum to be as
    long as possible without affecting the timing constraints of functions within
    this funciton.  This function should return normally. */
+
+  static DK_Time NextBlink = 30,
+                 NextHeartbeat = 60;
+  DK_Time Now = 0;
   
   /* This function is called every quantum.  A quantum was defined by the needs
      of this function, and other functions triggered from here are based on
      multiples of that quantum. */
-  NESControllerManager();
+
+  #ifndef __18F4550
+  /* There is no USB frame to report in, so report every quantum instead. */
+  NESControllerStartRead();
+  #endif
 
   /* Toggle an LED every quantum. */
   LED4 = !LED4;
 
-  if(QuantumCount == (unsigned)30 )
+  /* Kernel time keeps counting through slices of several quanta, and wraps
+     around harmlessly, so the blinks are scheduled against it rather than
+     matched against QuantumCount. */
+  Now = DK_GetTickCount();
+
+  if( DK_TimeAfterOrEqual(Now, NextBlink) )
   {
     /* Toggle an LED. */
     LED5 = !LED5;
+
+    NextBlink = Now + 30;
   }
-  else if(QuantumCount == (unsigned)60 )
+
+  if( DK_TimeAfterOrEqual(Now, NextHeartbeat) )
   {
     /* Toggle an LED. */
     LED6 = !LED6;
-    
-    /* Reset the counter so that a rollover will not produce an unexpected
-       QuantumCount condition. */
-    DK_ResetQuantumCount();
+
+    #ifdef DK_QEMU
+    /* QEMU has no LEDs, so show the heartbeat on the console. */
+    WriteUART(".");
+    #endif
+
+    NextHeartbeat = Now + 60;
   }
 }
 
@@ -92,7 +218,7 @@ signed InitializeLEDs(void)
   TRISD &= ~0xFF;
   #endif
 
-  #ifdef M52233DEMO
+  #if defined(M52233DEMO) && !defined(DK_QEMU)
   /* Configure LED pins for IO operation. */
   MCF_GPIO_PTCPAR &= ~0xFF;
     
@@ -173,43 +299,90 @@ void Task_Test2(void)
     }
     #endif
     
-    /* If there is room, spawn another task. */
-    if(DK_GetNumberOfLivingTasks() < (unsigned)DK_MAXIMUM_TASKS)
-    {
-      DK_InitializeTask((DK_TaskAddress)Task_Test3, READY, 1);
-    }
+    /* If there is room, queue another job.  A full queue is no matter; there
+       will be room again soon enough. */
+    DK_JobSubmit(Job_Test3, 0, 0);
   }
 }
 
 
-void Task_Test3(void)
+void Job_Test3( void * pArgument )
 {
-/* A test task that toggles an LED, then releases its resources. */
+/* A test job that toggles an LED.  It was once a task that killed itself when
+   done; as a job it simply returns, and its worker moves on to the next. */
 
-  static unsigned TaskNumber = 0;
-  unsigned Result = 0;
+  static unsigned JobNumber = 0;
 
   #if 0
-  DK_DisableInterrupts();
-  /* Task number is, effectively, a variable with mutex permissions. */
-  printf("Entered Task_Test3 - %u.\n\r", TaskNumber++);
-  DK_EnableInterrupts();
+  DK_EnterCriticalSection();
+  /* Job number is, effectively, a variable with mutex permissions. */
+  printf("Entered Job_Test3 - %u.\n\r", JobNumber++);
+  DK_ExitCriticalSection();
   #endif
 
   /* Toggle an LED. */
   LED3 = !LED3;
+}
 
-  /*  Kill this task and force a scheduler assertion -- this is the proper means
-      to deallocate a task. */
-  Result = DK_ConfigureTaskState(DK_GetRunningTaskIdentity(), DEAD);
-  DK_Assert(Result != DK_SUCCESS);
-  DK_InvokeScheduler(); /* <-- No guarantee that the task will make make it this
-                               far, but that's O.K., this scheduler invocation
-                               only prevents tasks from returning to no task's
-                               land. */
+
+#ifdef M52233DEMO
+/*******************************************************************************
+ColdFire console.
+*******************************************************************************/
+signed InitializeUART(void)
+{
+/* Initializes UART zero for polled output at 115.2 kbaud, eight data bits, no
+   parity, and one stop bit.
+
+   Result:
+   1 if successful. */
+
+  /* Divider for 115.2 kbaud.  The UART is clocked at the system clock over
+     32. */
+  const unsigned Divider = (DK_SYSTEM_CLOCK_HZ / 32 + 57600) / 115200;
+
+  #ifndef DK_QEMU
+  /* Give UTXD0 and URXD0 their primary functions. */
+  MCF_GPIO_PUAPAR = (MCF_GPIO_PUAPAR & ~0x0F) | 0x05;
+  #endif
+
+  /* Reset the receiver, transmitter, and mode register pointer. */
+  MCF_UART0_UCR = 0x20;
+  MCF_UART0_UCR = 0x30;
+  MCF_UART0_UCR = 0x10;
+
+  /* No parity, eight data bits; then normal mode, one stop bit. */
+  MCF_UART0_UMR = 0x13;
+  MCF_UART0_UMR = 0x07;
+
+  /* Clock both directions from the system clock. */
+  MCF_UART0_UCSR = 0xDD;
+  MCF_UART0_UBG1 = (unsigned char)(Divider >> 8);
+  MCF_UART0_UBG2 = (unsigned char)Divider;
+
+  /* Enable the transmitter and receiver. */
+  MCF_UART0_UCR = 0x05;
+
+  return 1;
 }
 
 
+void WriteUART(const char * pString)
+{
+/* Writes a string to UART zero, waiting for room as needed. */
+
+  while(*pString != 0)
+  {
+    while((MCF_UART0_USR & MCF_UART_USR_TXRDY) == 0)
+    {
+    }
+
+    MCF_UART0_UTB = *pString++;
+  }
+}
+#endif /* M52233DEMO. */
+
+
 /*******************************************************************************
 NES controller specific functions and tasks.
 *******************************************************************************/
@@ -223,12 +396,55 @@ signed InitializeNESController(void)
   /* Zero the data on each pin. */
   NES_IsParallelLoad = 0;
   NES_Clock = 0;
-  NES_DataStream = 0;
+
+  #ifdef __18F4550
+  /* RB0 through RB4 come out of reset as analog inputs.  Nothing uses the
+     A/D converter, so make every pin digital. */
+  ADCON1 = 0x0F;
 
   /* Set the data direction of each pin. */  
-  TRISBbits.TRISB0 = 0; /* IsParallelLoad is output. */
-  TRISBbits.TRISB1 = 0; /* Clock is output. */
-  TRISBbits.TRISB2 = 1; /* DataStream is input. */
+  TRISCbits.TRISC2 = 0; /* IsParallelLoad (CCP1) is output. */
+  TRISBbits.TRISB1 = 0; /* Clock (SCK) is output. */
+  TRISBbits.TRISB0 = 1; /* Pad zero's data (SDI) is input. */
+  TRISBbits.TRISB2 = 1; /* The other pads' data are inputs. */
+  TRISBbits.TRISB3 = 1;
+  TRISBbits.TRISB4 = 1;
+
+  #if NES_PADS == 1
+  /* SDO shares RC7 with the USART's receive line.  Leaving it an input keeps
+     the MSSP from driving it; nothing is sent to the controller anyway. */
+  TRISCbits.TRISC7 = 1;
+
+  /* SPI master at a sixteenth of the instruction clock.  The clock idles
+     high, and each bit is sampled on a falling edge, so the first bit, which
+     the 4021 presents as soon as it is latched, is read before the first
+     rising edge shifts the next one out. */
+  SSPSTAT = 0x40; /* SMP = 0, CKE = 1. */
+  SSPCON1 = 0x32; /* SSPEN = 1, CKP = 1, SSPM = Fosc / 64. */
+
+  PIR1bits.SSPIF = 0;
+  PIE1bits.SSPIE = 1;
+  #endif
+
+  /* Timer1 counts instruction cycles for CCP1, which times the latch pulse,
+     and for several pads the bits.  It only runs during a scan. */
+  T1CON = 0x00;
+  CCP1CON = 0x00;
+
+  PIR1bits.CCP1IF = 0;
+  PIE1bits.CCP1IE = 1;
+
+  /* Peripheral interrupts are enabled along with USB's. */
+  #endif
+
+  #if defined(M52233DEMO) && !defined(DK_QEMU)
+  /* Configure the pins for IO operation. */
+  MCF_GPIO_PTAPAR = 0x00;
+
+  /* Set the data direction of each pin.  IsParallelLoad and Clock are
+     outputs, the data lines are inputs. */
+  MCF_GPIO_DDRTA = (MCF_GPIO_DDRTA & ~0x0F) | 0x03;
+  #endif
   
   return 1;
 }
@@ -236,12 +452,13 @@ signed InitializeNESController(void)
 
 unsigned char ReadNESController(void)
 {
-/* This function manages the NES controller.  When called, the function triggers
-   the NES controller clock line and reads the serial output for each button.
+/* This function puts the calling task to sleep until the next scan of the
+   pads finishes.  For one task at a time, other than the idle task, which may
+   not sleep and gets the latest state at once.
 
    Result:
-   The current state of the controller in an active high unsigned character
-   format as follows:
+   Pad zero's debounced state in an active high unsigned character format as
+   follows:
 
    Bit  Button
    7:   A
@@ -253,8 +470,235 @@ unsigned char ReadNESController(void)
    1:   Left
    0:   Right */
 
-  unsigned char Result = 0,
-                Count = 0;
+  unsigned char Identity = DK_GetRunningTaskIdentity();
+  DK_Time Scan = NESControllerScanCount();
+
+  if(Identity == (unsigned)0)
+  {
+    return NESControllerButtons(0);
+  }
+
+  #ifdef __18F4550
+  /* Scans follow the host's frames, so start one in case there are none.
+     If one is already underway, it will do. */
+  NESControllerStartRead();
+  #endif
+
+  while(1)
+  {
+    DK_EnterCriticalSection();
+
+    if(NES_ScanCount != Scan)
+    {
+      DK_ExitCriticalSection();
+      break;
+    }
+
+    /* As in DK_JobWait, deciding to sleep and going to sleep happen together,
+       so the scan cannot finish in between and leave this task asleep.
+       NESControllerScanned wakes it. */
+    NES_Reader = Identity;
+    DK_ConfigureTaskState(Identity, WAITING);
+
+    DK_ExitCriticalSection();
+
+    DK_InvokeScheduler();
+  }
+
+  return NESControllerButtons(0);
+}
+
+
+unsigned char NESControllerButtons( unsigned char Pad )
+{
+/* Parameters:
+   Pad  The pad, from zero to NES_PADS - 1.
+
+   Result:
+   The pad's debounced state, as described at ReadNESController, or zero if
+   there is no such pad. */
+
+  if(Pad >= (unsigned)NES_PADS)
+  {
+    return 0;
+  }
+
+  return NES_Buttons[Pad];
+}
+
+
+signed NESControllerHistory( unsigned char Pad,
+                             unsigned char Age,
+                             NES_Event * pEvent )
+{
+/* This function copies one of a pad's recent debounced changes.
+
+   Parameters:
+   Pad     The pad, from zero to NES_PADS - 1.
+   Age     Zero for the latest change, one for the change before it, and so
+           on, up to NES_HISTORY - 1.
+   pEvent  Where to copy the change.
+
+   Result:
+   DK_SUCCESS if the change was copied, DK_FAILURE if there is no such pad or
+   fewer than Age + 1 changes have been recorded. */
+
+  signed Result = DK_FAILURE;
+  unsigned char Index = 0;
+
+  if(Pad >= (unsigned)NES_PADS)
+  {
+    return DK_FAILURE;
+  }
+
+  DK_EnterCriticalSection();
+
+  if(Age < NES_HistoryCount[Pad])
+  {
+    Index = (NES_HistoryHead[Pad] - 1 - Age) & (NES_HISTORY - 1);
+    pEvent->Tick = NES_History[Pad][Index].Tick;
+    pEvent->Buttons = NES_History[Pad][Index].Buttons;
+    Result = DK_SUCCESS;
+  }
+
+  DK_ExitCriticalSection();
+
+  return Result;
+}
+
+
+DK_Time NESControllerScanCount(void)
+{
+/* Result:
+   The number of scans that have finished.  Scans follow the host's USB
+   frames on the PIC and quanta elsewhere; like the tick count, this wraps
+   around, so compare it with DK_TimeAfter and friends. */
+
+  DK_Time Result = 0;
+
+  DK_EnterCriticalSection();
+  Result = NES_ScanCount;
+  DK_ExitCriticalSection();
+
+  return Result;
+}
+
+
+#ifdef __18F4550
+signed NESControllerStartRead(void)
+{
+/* This function starts a hardware scan of the pads.  CCP1 raises the latch
+   and drops it NES_LATCH_COUNTS instruction cycles later, then the buttons
+   are shifted in from its interrupt: by the MSSP for a single pad, whose own
+   interrupt finishes the scan, or a bit at a time by further CCP1 compares
+   for several.
+
+   Result:
+   DK_SUCCESS if the scan was started, DK_FAILURE if one is already
+   underway. */
+
+  signed Result = DK_FAILURE;
+
+  DK_EnterCriticalSection();
+
+  if(NES_ReadBusy == FALSE)
+  {
+    NES_ReadBusy = TRUE;
+    Result = DK_SUCCESS;
+
+    NES_LatchTime = DK_GetTimeMicrosecondsFromISR();
+    NES_LatchFrame = DK_USB_GetFrameNumber();
+
+    TMR1H = 0;
+    TMR1L = 0;
+    CCPR1H = (unsigned char)(NES_LATCH_COUNTS >> 8);
+    CCPR1L = (unsigned char)NES_LATCH_COUNTS;
+
+    /* Compare mode: the pin goes high now and low on the match. */
+    CCP1CON = 0x09;
+    PIR1bits.CCP1IF = 0;
+    T1CONbits.TMR1ON = 1;
+  }
+
+  DK_ExitCriticalSection();
+
+  return Result;
+}
+
+
+static void NESControllerLatched(void)
+{
+/* This function follows each CCP1 compare.  The first ends the latch pulse,
+   after which the 4021s hold the buttons and present the first bit.  For a
+   single pad the MSSP shifts them all in.  For several, each compare takes
+   one bit from every pad and, until the eighth, clocks the next bit out and
+   times another compare, so each interrupt handles one bit rather than
+   eight.  Called from DK_ISR. */
+
+  PIR1bits.CCP1IF = 0;
+  T1CONbits.TMR1ON = 0;
+
+  /* Hand the pin back to its latch, which holds it low. */
+  CCP1CON = 0x00;
+
+  #if NES_PADS == 1
+  /* Any write starts the eight clocks. */
+  SSPBUF = 0;
+  #else
+  if(NES_Bits != (unsigned)0)
+  {
+    NES_Clock = 1; /* Clock high. */
+    NES_Clock = 0; /* Clock low. */
+  }
+
+  NESControllerSample(NES_Raw);
+
+  if(++NES_Bits < (unsigned)8)
+  {
+    /* Compare without driving the pin, which stays low. */
+    TMR1H = 0;
+    TMR1L = 0;
+    CCPR1H = (unsigned char)(NES_CLOCK_COUNTS >> 8);
+    CCPR1L = (unsigned char)NES_CLOCK_COUNTS;
+    CCP1CON = 0x0A;
+    T1CONbits.TMR1ON = 1;
+    return;
+  }
+
+  NES_Bits = 0;
+  NES_ReadBusy = FALSE;
+  NESControllerScanned(NES_Raw);
+  #endif
+}
+
+
+#if NES_PADS == 1
+static void NESControllerShifted(void)
+{
+/* This function takes the buttons the MSSP shifted in.  The controller's data
+   line is active low.  Called from DK_ISR. */
+
+  unsigned char Raw = 0;
+
+  PIR1bits.SSPIF = 0;
+
+  Raw = ~SSPBUF;
+
+  NES_ReadBusy = FALSE;
+  NESControllerScanned(&Raw);
+}
+#endif
+
+#else
+signed NESControllerStartRead(void)
+{
+/* This function scans the pads.  Without the PIC's CCP1 and MSSP, the scan
+   finishes before it returns.  Called from interrupt context only.
+
+   Result:
+   DK_SUCCESS. */
+
+  unsigned char Raw[NES_PADS] = {0};
 
   /* Clock to zero. */
   NES_Clock = 0;
@@ -262,45 +706,263 @@ unsigned char ReadNESController(void)
   /* Change from parallel to serial mode. */
   NES_IsParallelLoad = FALSE;
 
-  /* Get the first bit without pulsing (it's always right at the beginning).
-     Note that NES_DataStream is inherently active low, negating it restores it
-     to active high. */
-  Result = ((!NES_DataStream) << 7);
+  NES_LatchTime = DK_GetTimeMicrosecondsFromISR();
+  NES_LatchFrame = DK_USB_GetFrameNumber();
+
+  NESControllerShift(Raw);
+
+  /* Revert to parallel mode. */
+  NES_IsParallelLoad = TRUE;
+
+  NESControllerScanned(Raw);
 
-  /* Pulse the clock, get the output, pulse the clock, get the output, ... */
-  while(Count < (unsigned)7)
+  return DK_SUCCESS;
+}
+#endif /* __18F4550. */
+
+
+#if !defined(__18F4550) || NES_PADS > 1
+static void NESControllerSample( unsigned char * pRaw )
+{
+/* This function takes the bit every pad presents now.  All of the data lines
+   are read together, so scanning NES_PADS pads takes the same clocks as
+   scanning one; only the sorting of the bits grows.
+
+   Parameters:
+   pRaw  Each pad's state so far, NES_PADS bytes, each shifted left to take
+         the new bit. */
+
+  unsigned char Pad = 0,
+                Lines = 0;
+
+  /* Grab every pad's bit at once. */
+  Lines = NES_DATA_PORT;
+
+  /* Push each pad's bit into its result.  Note that the data lines are
+     inherently active low. */
+  for(Pad = 0; Pad < (unsigned)NES_PADS; ++Pad)
   {
-    /* Pulse the clock. */
-    NES_Clock = 1; /* Clock high. */
-    NES_Clock = 0; /* Clock low. */
-    
-    /* Grab the current bit and push it into the result. */
-    Result |= ((!NES_DataStream) << (6 - Count));
+    pRaw[Pad] <<= 1;
+
+    if((Lines & NES_DataMasks[Pad]) == 0)
+    {
+      pRaw[Pad] |= 1;
+    }
+  }
+}
+#endif
+
+
+#ifndef __18F4550
+static void NESControllerShift( unsigned char * pRaw )
+{
+/* This function shifts every pad's buttons in at once.  The latch must
+   already be in serial mode.
+
+   Parameters:
+   pRaw  Where to put each pad's state, NES_PADS bytes, in the format
+         described at ReadNESController. */
+
+  unsigned char Count = 0;
+
+  while(Count < (unsigned)8)
+  {
+    /* The first bit is ready as soon as the latch falls; pulse the clock for
+       each of the rest. */
+    if(Count != (unsigned)0)
+    {
+      NES_Clock = 1; /* Clock high. */
+      NES_Clock = 0; /* Clock low. */
+    }
+
+    NESControllerSample(pRaw);
 
     ++Count;
   }
+}
+#endif
 
-  /* Revert to parallel mode. */
-  NES_IsParallelLoad = TRUE;
-  
-  return Result;
+
+static void NESControllerScanned( const unsigned char * pRaw )
+{
+/* This function finishes every scan started by NESControllerStartRead.  Each
+   button of each pad is debounced: its state only changes once four scans in
+   a row disagree with it.  Each change is recorded in the pad's history, pad
+   zero is reported to the host, and the task in ReadNESController, if any, is
+   woken.  Called from interrupt context.
+
+   Parameters:
+   pRaw  Each pad's state as read, NES_PADS bytes. */
+
+  unsigned char Pad = 0,
+                Delta = 0,
+                Toggle = 0,
+                Head = 0;
+
+  ++NES_ScanCount;
+
+  for(Pad = 0; Pad < (unsigned)NES_PADS; ++Pad)
+  {
+    /* A two bit counter per button, one bit per byte, counts the scans in a
+       row that disagree, and is cleared by any that agrees.  The buttons whose
+       counters roll over to zero change. */
+    Delta = pRaw[Pad] ^ NES_Buttons[Pad];
+    NES_Count1[Pad] = (NES_Count1[Pad] ^ NES_Count0[Pad]) & Delta;
+    NES_Count0[Pad] = ~NES_Count0[Pad] & Delta;
+    Toggle = Delta & ~(NES_Count0[Pad] | NES_Count1[Pad]);
+
+    if(Toggle != 0)
+    {
+      NES_Buttons[Pad] ^= Toggle;
+
+      Head = NES_HistoryHead[Pad];
+      NES_History[Pad][Head].Tick = DK_GetTickCount();
+      NES_History[Pad][Head].Buttons = NES_Buttons[Pad];
+      NES_HistoryHead[Pad] = (Head + 1) & (NES_HISTORY - 1);
+
+      DK_Log2("Pad %u buttons %02x", Pad, NES_Buttons[Pad]);
+
+      if(NES_HistoryCount[Pad] < (unsigned)NES_HISTORY)
+      {
+        ++NES_HistoryCount[Pad];
+      }
+    }
+  }
+
+  NESControllerManager(NES_Buttons[0], NES_LatchTime, NES_LatchFrame);
+
+  /* The reader may have been suspended or killed while it slept. */
+  if( NES_Reader != (unsigned)0 &&
+      TCBSegment[NES_Reader].State == WAITING )
+  {
+    DK_ConfigureTaskState(NES_Reader, READY);
+  }
+
+  NES_Reader = 0;
 }
 
-signed NESControllerManager(void)
+unsigned char NESControllerReport( unsigned char Input )
 {
-/* This function manages the NES controller;  it is responsible for reading from
-   the controller and transmiting the result.
+/* This function converts the controller's state, as read by
+   ReadNESController, into the game pad's HID input report.  A and B are
+   buttons one and two, Select and Start three and four, and the direction pad
+   is the X and Y axes.
+
+   Parameters:
+   Input  The controller's state.
+
+   Result:
+   The input report's first byte, laid out as described at
+   USB_HID_REPORT_SIZE. */
+
+  unsigned char Report = 0;
+
+  if(Input & NES_A)
+  {
+    Report |= USB_HID_REPORT_BUTTON(1);
+  }
+
+  if(Input & NES_B)
+  {
+    Report |= USB_HID_REPORT_BUTTON(2);
+  }
+
+  if(Input & NES_SELECT)
+  {
+    Report |= USB_HID_REPORT_BUTTON(3);
+  }
+
+  if(Input & NES_START)
+  {
+    Report |= USB_HID_REPORT_BUTTON(4);
+  }
+
+
+  if(Input & NES_LEFT)
+  {
+    Report |= USB_HID_REPORT_X(-1);
+  }
+  else if(Input & NES_RIGHT)
+  {
+    Report |= USB_HID_REPORT_X(1);
+  }
+
+  if(Input & NES_UP)
+  {
+    Report |= USB_HID_REPORT_Y(-1);
+  }
+  else if(Input & NES_DOWN)
+  {
+    Report |= USB_HID_REPORT_Y(1);
+  }
+
+  return Report;
+}
+
+
+signed NESControllerManager( unsigned char Input,
+                             DK_Time LatchTime,
+                             unsigned LatchFrame )
+{
+/* This function manages the NES controller;  it is responsible for
+   transmiting each reading as an input report on the game pad's HID
+   interface.  A report is only sent when the buttons change, or after
+   NES_KEEPALIVE_FRAMES calls without one so the host can tell the controller
+   is still there.  Each report carries its sequence number and when the
+   reading was latched, for DK_Latency.py.  Called once per USB frame, as each
+   scan finishes.
+
+   Parameters:
+   Input       Pad zero's debounced state, as described at ReadNESController.
+   LatchTime   The kernel time, in microseconds, at which it was latched.
+   LatchFrame  The USB frame number at which it was latched.
    
    Result:
    1 if successful; */
    
+  /* The last state reported, the number of calls since, and the next
+     report's sequence number. */
+  static unsigned char LastReport = 0;
+  static unsigned FramesSinceReport = NES_KEEPALIVE_FRAMES;
+  static unsigned short Sequence = 0;
+
   signed Result = 0;
-  unsigned char Input = 0;
-  
-  Input = ReadNESController();
+  unsigned char Report[USB_HID_REPORT_SIZE] = {0},
+                Index = 0;
 
-  Result = DK_USB_SendCharacter(Input);
-  DK_Assert(Result != DK_SUCCESS);
+  if(FramesSinceReport < (unsigned)NES_KEEPALIVE_FRAMES)
+  {
+    ++FramesSinceReport;
+  }
+
+  if( Input != LastReport ||
+      FramesSinceReport >= (unsigned)NES_KEEPALIVE_FRAMES )
+  {
+    Report[0] = NESControllerReport(Input);
+
+    Report[USB_HID_REPORT_SEQUENCE] = (unsigned char)Sequence;
+    Report[USB_HID_REPORT_SEQUENCE + 1] = (unsigned char)(Sequence >> 8);
+
+    for(Index = 0; Index < (unsigned)4; ++Index)
+    {
+      Report[USB_HID_REPORT_TIME + Index] =
+        (unsigned char)(LatchTime >> (Index * 8));
+    }
+
+    Report[USB_HID_REPORT_FRAME] = (unsigned char)LatchFrame;
+    Report[USB_HID_REPORT_FRAME + 1] = (unsigned char)(LatchFrame >> 8);
+
+    Result = DK_USB_SendReport(Report);
+
+    /* If both report buffers are still waiting for the host, the report is
+       retried next frame, with the next reading. */
+    if(Result == DK_SUCCESS)
+    {
+      LastReport = Input;
+      FramesSinceReport = 0;
+      ++Sequence;
+    }
+  }
   
   return 1;
 }
@@ -312,8 +974,10 @@ void main(void)
   unsigned Result = 0;
   unsigned Count = 0;
 
+  #ifdef __18F4550
   /* Disable the watchdog timer in software (must also be disabled in
-     hardware). */
+     hardware).  DK_InitializeKernel enables it again if DK_WATCHDOG_HARDWARE is
+     defined. */
   WDTCONbits.SWDTEN = 0;
   
   /* Pause for a moment so that it is more obvious if a reset occurs. */
@@ -326,26 +990,18 @@ void main(void)
   while(++Count != (unsigned)0)
   {
   }
-
-  #ifdef __18F4550
-  OpenUSART( USART_TX_INT_OFF
-             & USART_RX_INT_OFF
-             & USART_ASYNCH_MODE
-             & USART_EIGHT_BIT
-             & USART_CONT_RX
-             & USART_BRGH_HIGH,
-             42 /* 115.2 kbaud at 20 MHz oscillator. */
-             );
-
-  /* This processor supports "enhanced" USART, which means BAUDCON must be
-     configured. */
-  baudUSART( BAUD_IDLE_CLK_LOW
-             & BAUD_16_BIT_RATE
-             & BAUD_WAKEUP_OFF
-             & BAUD_AUTO_OFF );
   #endif /* __18F4550. */
+
+  /* 115.2 kbaud, interrupt driven, and stdout from here on. */
+  Result = DK_USART_Initialize();
+  DK_Assert(Result != DK_SUCCESS);
   
-  /* USART initialization for the MCF52233 is performed by the default project. */
+  #ifdef M52233DEMO
+  Result = InitializeUART();
+  DK_Assert(Result != 1);
+
+  WriteUART("\n\rDreamcatcher Kernel\n\r");
+  #endif /* M52233DEMO. */
 
   /* Put a little greeting up on hyperterminal. */
   /* printf( "\n\rDreamcatcher Kernel\n\rLast compiled on " \
@@ -366,7 +1022,7 @@ void main(void)
   //DK_InitializeTask((DK_TaskAddress)Task_Test0, READY, 10 );    
   //DK_InitializeTask((DK_TaskAddress)Task_Test1, READY, 6  );
   //DK_InitializeTask((DK_TaskAddress)Task_Test2, READY, 30  );
-  //DK_InitializeTask((DK_TaskAddress)Task_Test3, READY, 1 );
+  //DK_JobInitialize(); /* Runs Task_Test2's jobs. */
   
   /* Start the kernel and never return. */
   DK_StartKernel();
@@ -13,6 +13,40 @@
 	#define LED7 (PORTDbits.RD7)
 #endif /* __18F4550. */
 
+#if defined(M52233DEMO) && !defined(DK_QEMU)
+	/* Port TC, one bit per LED.  ColdFire bit fields are allocated most
+	   significant bit first. */
+	typedef struct
+	{
+		unsigned char TC7:1, TC6:1, TC5:1, TC4:1, TC3:1, TC2:1, TC1:1, TC0:1;
+	} PORTTCbits_t;
+
+	#define PORTTCbits (*(volatile PORTTCbits_t *)&MCF_GPIO_PORTTC)
+
+	#define LED0 (PORTTCbits.TC0)
+	#define LED1 (PORTTCbits.TC1)
+	#define LED2 (PORTTCbits.TC2)
+	#define LED3 (PORTTCbits.TC3)
+	#define LED4 (PORTTCbits.TC4)
+	#define LED5 (PORTTCbits.TC5)
+	#define LED6 (PORTTCbits.TC6)
+	#define LED7 (PORTTCbits.TC7)
+#endif /* M52233DEMO && !DK_QEMU. */
+
+#if defined(DK_POSIX) || defined(DK_QEMU)
+	/* The host and QEMU have no lights, so each LED is a plain byte. */
+	extern volatile unsigned char LEDs[8];
+
+	#define LED0 (LEDs[0])
+	#define LED1 (LEDs[1])
+	#define LED2 (LEDs[2])
+	#define LED3 (LEDs[3])
+	#define LED4 (LEDs[4])
+	#define LED5 (LEDs[5])
+	#define LED6 (LEDs[6])
+	#define LED7 (LEDs[7])
+#endif /* DK_POSIX || DK_QEMU. */
+
 
 signed InitializeLEDs(void);
 
@@ -20,17 +54,135 @@ signed InitializeLEDs(void);
 void Task_Test0(void);
 void Task_Test1(void);
 void Task_Test2(void);
-void Task_Test3(void);
+void Job_Test3( void * pArgument );
+
+
+#ifdef M52233DEMO
+signed InitializeUART(void);
+void WriteUART(const char * pString);
+#endif /* M52233DEMO. */
 
 
+/* The number of entries in each pad's history.  A power of two.  Fewer on
+   the PIC18F4550, whose RAM outside the USB banks is mostly stacks. */
+#ifndef NES_HISTORY
+#ifdef __18F4550
+#define NES_HISTORY  4
+#else
+#define NES_HISTORY  8
+#endif
+#endif
+
+/* An entry in a pad's history: the buttons held after a debounced change,
+   and the kernel time, as counted by DK_GetTickCount, of the scan that made
+   it. */
+typedef struct
+{
+  DK_Time Tick;
+  unsigned char Buttons;
+} NES_Event;
+
 signed InitializeNESController(void);
 unsigned char ReadNESController(void);
-signed NESControllerManager(void);
+signed NESControllerStartRead(void);
+unsigned char NESControllerButtons( unsigned char Pad );
+signed NESControllerHistory( unsigned char Pad,
+                             unsigned char Age,
+                             NES_Event * pEvent );
+DK_Time NESControllerScanCount(void);
+unsigned char NESControllerReport( unsigned char Input );
+signed NESControllerManager( unsigned char Input,
+                             DK_Time LatchTime,
+                             unsigned LatchFrame );
+
+/* A pad's buttons, as returned by ReadNESController and NESControllerButtons:
+   one bit per button, set while it is pressed. */
+#define NES_A       0x80
+#define NES_B       0x40
+#define NES_SELECT  0x20
+#define NES_START   0x10
+#define NES_UP      0x08
+#define NES_DOWN    0x04
+#define NES_LEFT    0x02
+#define NES_RIGHT   0x01
+
+/* Pad zero's state is reported at least this often, in USB frames
+   (milliseconds), even when no buttons change.  This stands in for the HID
+   idle rate. */
+#ifndef NES_KEEPALIVE_FRAMES
+#define NES_KEEPALIVE_FRAMES  100
+#endif
+
+
+/* Define the NES controller pins.  The pads share the latch and clock lines,
+   and each has its own data line.  The data lines are on one port, so a
+   single read samples every pad; NES_DATA_MASKS gives each pad's bit, pad
+   zero first.
+
+   On the PIC18F4550 the latch is on CCP1, whose compare output ends the latch
+   pulse, and pad zero's data and the clock are on SDI and SCK.  A single pad,
+   the default, is read by the MSSP in SPI master mode.  The MSSP only samples
+   SDI, so more pads are clocked by CCP1 instead, one bit per compare
+   interrupt, NES_CLOCK_US apart. */
+#ifdef __18F4550
+#define NES_IsParallelLoad  LATCbits.LATC2
+#define NES_Clock           LATBbits.LATB1
+#define NES_DATA_PORT       PORTB
+#define NES_DATA_MASKS      0x01, 0x04, 0x08, 0x10 /* RB0, RB2, RB3, RB4. */
+#define NES_PADS_MAX        4
+
+/* The length of the latch pulse in microseconds, and in Timer1 counts of one
+   instruction cycle each. */
+#define NES_LATCH_US      12
+#define NES_LATCH_COUNTS  (NES_LATCH_US * (DK_SYSTEM_CLOCK_HZ / 4000000))
+
+/* The same for the time between bits when CCP1 clocks several pads. */
+#define NES_CLOCK_US      12
+#define NES_CLOCK_COUNTS  (NES_CLOCK_US * (DK_SYSTEM_CLOCK_HZ / 4000000))
+
+/* Only pad zero's data line is on the MSSP. */
+#ifndef NES_PADS
+#define NES_PADS  1
+#endif
+#endif /* __18F4550. */
+
+#if defined(M52233DEMO) && !defined(DK_QEMU)
+/* Port TA.  The pin data is read through SETTA. */
+typedef struct
+{
+	unsigned char TA7:1, TA6:1, TA5:1, TA4:1, TA3:1, TA2:1, TA1:1, TA0:1;
+} PORTTAbits_t;
+
+#define PORTTAbits (*(volatile PORTTAbits_t *)&MCF_GPIO_PORTTA)
+#define SETTAbits  (*(volatile PORTTAbits_t *)&MCF_GPIO_SETTA)
+
+#define NES_IsParallelLoad  PORTTAbits.TA0
+#define NES_Clock           PORTTAbits.TA1
+#define NES_DATA_PORT       MCF_GPIO_SETTA
+#define NES_DATA_MASKS      0x04, 0x08 /* TA2, TA3. */
+#define NES_PADS_MAX        2
+#endif /* M52233DEMO && !DK_QEMU. */
+
+#if defined(DK_POSIX) || defined(DK_QEMU)
+/* The host and QEMU have no controller attached.  The data lines idle high,
+   which reads as no buttons pressed. */
+extern volatile unsigned char NES_Pins[3];
+
+#define NES_IsParallelLoad  (NES_Pins[0])
+#define NES_Clock           (NES_Pins[1])
+#define NES_DATA_PORT       (NES_Pins[2])
+#define NES_DATA_MASKS      0x01, 0x02, 0x04, 0x08
+#define NES_PADS_MAX        4
+#endif /* DK_POSIX || DK_QEMU. */
 
+/* The number of pads scanned, every pad the board has unless it says
+   otherwise. */
+#ifndef NES_PADS
+#define NES_PADS  NES_PADS_MAX
+#endif
 
-/* Define the NES controller pins. */
-#define NES_IsParallelLoad  PORTBbits.RB0
-#define NES_Clock           PORTBbits.RB1
-#define NES_DataStream      PORTBbits.RB2
+#if NES_PADS < 1 || NES_PADS > NES_PADS_MAX
+#error "NES_PADS is out of range for this board."
+#endif
 
 #endif /* MAIN_H. */